@@ -0,0 +1,423 @@
+// Throughput benchmark: sbl_program_binary_ex() against the simulated ROM
+// bootloader (sbl_sim.c) or a real device, for each image and either a fixed
+// set of option presets or a sweep over the transfer parameters.
+//
+//   bench [-b wire_baud] [-l ack_latency_us] [-e erase_page_us] [-p program_ns_per_byte]
+//         [-r crc_ns_per_byte] [-f rx_fifo] [-c corrupt_every] [-n nack_every] [-x drop_every]
+//         [-D dev [-F flash_size] [-P page_size] [-E]]
+//         [image.bin ...]
+//   bench -s [-k chunk_sizes] [-i status_intervals] [-B bauds] [-d drain_modes] [-w window]
+//         [-C] [the options above] [image.bin ...]
+//
+// Without images the bundled app_full.bin, app_full_128.bin and full_app_128.bin
+// are used. -b 0 removes the UART model and measures host overhead only; -c
+// leaves every Nth SEND_DATA wrongly programmed, for the readback and repair paths,
+// while -n NACKs and -x drops every Nth one, for the retry and resume paths.
+// -f sizes the sim's RX FIFO (32 bytes as on the ROM, 0 = unlimited); bytes that
+// arrive while flash is being written overrun it, and the RETRIES column would
+// show pacing that fails to keep a pipelined transfer within it.
+//
+// -s runs every combination of the comma-separated lists (defaults 128,252 /
+// 1,16 / 460800,921600 / 0,1) and reports time, bytes/s and round trips per KiB
+// of image; -C prints the same as CSV, for comparing runs of different builds.
+// With -s the baud list replaces -b.
+//
+// -D programs dev instead (CC1310 geometry unless -F / -P say otherwise). The
+// ROM autobauds only once per reset, so a sweep over several bauds needs -E:
+// DTR/RTS bootloader entry (sbl_entry_init() wiring) before every run.
+// Without it each run after the first reuses the running bootloader.
+#define _POSIX_C_SOURCE 200809L
+#include "sbl.h"
+#include "sbl_sim.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+{
+    const char *name;
+    uint32_t window;
+    uint32_t status_interval;
+    sbl_erase_mode_t erase;
+    uint32_t sparse_gap;
+    int delta_rerun; // program once (2: with every 4th page changed), then time a --delta run
+    uint32_t verify_group;
+} bench_preset_t;
+
+// Only "pipelined" streams (paced to the RX FIFO, see sbl_stream_data()); the
+// others measure their own feature on top of a lock-step transfer.
+static const bench_preset_t presets[] = {
+    {"lockstep", 1, 1, SBL_ERASE_PAGES, 0, 0, 0},
+    {"pipelined", 4, 16, SBL_ERASE_PAGES, 0, 0, 0},
+    {"grouped", 1, 1, SBL_ERASE_PAGES, 0, 0, 8},
+    {"smart", 1, 1, SBL_ERASE_SMART, 0, 0, 0},
+    {"sparse", 1, 1, SBL_ERASE_PAGES, 256, 0, 0},
+    {"delta-same", 1, 1, SBL_ERASE_PAGES, 0, 1, 0},
+    {"delta-diff", 1, 1, SBL_ERASE_PAGES, 0, 2, 0},
+};
+
+// Where runs program: a fresh simulated ROM each time, or a real device
+typedef struct
+{
+    const char *dev;     // NULL: simulator
+    int entry;           // DTR/RTS bootloader entry before each run on dev
+    uint32_t flash_size; // dev's geometry
+    uint32_t page_size;
+    sbl_sim_config_t sim; // simulator, sized to the image
+} bench_target_t;
+
+// One sweep list: -k / -i / -B / -d
+#define SWEEP_MAX 16
+typedef struct
+{
+    unsigned v[SWEEP_MAX];
+    size_t n;
+} sweep_list_t;
+
+static int parse_list(const char *s, sweep_list_t *l)
+{
+    l->n = 0;
+    while (*s)
+    {
+        char *end;
+        unsigned long v = strtoul(s, &end, 0);
+        if (end == s || (*end && *end != ',') || l->n == SWEEP_MAX)
+            return -1;
+        l->v[l->n++] = (unsigned)v;
+        s = *end ? end + 1 : end;
+    }
+    return l->n ? 0 : -1;
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    uint8_t *buf = NULL;
+    if (fseek(f, 0, SEEK_END) == 0)
+    {
+        long sz = ftell(f);
+        rewind(f);
+        buf = sz > 0 ? (uint8_t *)malloc((size_t)sz) : NULL;
+        if (buf && fread(buf, 1, (size_t)sz, f) != (size_t)sz)
+        {
+            free(buf);
+            buf = NULL;
+        }
+        *len = buf ? (size_t)sz : 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+// Program image with opts at baud (the simulator's wire rate), timing the run
+// into m; delta_rerun programs it (or with 2, a copy differing on every 4th page)
+// once untimed first and times a delta update.
+static int run_once(const bench_target_t *t, int baud, int drain, const uint8_t *image, size_t len,
+                    sbl_program_opts_t *opts, int delta_rerun, sbl_metrics_t *m)
+{
+    sbl_sim_t *sim = NULL;
+    uint32_t flash_size = t->flash_size, page_size = t->page_size;
+    const char *path = t->dev;
+    if (!path)
+    {
+        sbl_sim_config_t c = t->sim;
+        c.wire_baud = baud;
+        if (!(sim = sbl_sim_start(&c)))
+            return -1;
+        path = sbl_sim_path(sim);
+        flash_size = c.flash_size;
+        page_size = c.page_size;
+        // The pty ignores its rate, but the host paces SEND_DATA by it while the
+        // sim charges wire_baud; without a UART model, pace as for a fast one
+        baud = baud > 0 ? baud : 3000000;
+    }
+
+    int rc = -1;
+    int fd = serial_open_configure(path, baud);
+    if (fd < 0)
+        goto out;
+    serial_set_drain(fd, drain);
+    if (t->dev && t->entry)
+    {
+        sbl_entry_t e;
+        sbl_entry_init(&e);
+        if (sbl_enter_bootloader(fd, &e) != 0)
+            goto out;
+    }
+    // A real ROM still running from the last run ignores a second autobaud
+    if (sbl_autobaud(fd, 500) != 0 && (!t->dev || sbl_ping(fd, 100) != 0))
+    {
+        fprintf(stderr, "%s: no bootloader at %d baud\n", path, baud);
+        goto out;
+    }
+
+    opts->no_reset = 1;
+    if (delta_rerun)
+    {
+        uint8_t *first = (uint8_t *)malloc(len);
+        if (!first)
+            goto out;
+        memcpy(first, image, len);
+        for (size_t off = 0; delta_rerun == 2 && off < len; off += 4 * (size_t)page_size)
+            first[off] ^= 0x5A;
+        int first_rc = sbl_program_binary_ex(fd, flash_size, page_size, first, len, 0, opts);
+        free(first);
+        if (first_rc != 0)
+            goto out;
+    }
+    opts->delta = delta_rerun;
+    opts->metrics = m;
+    m->log = NULL;
+    rc = sbl_program_binary_ex(fd, flash_size, page_size, image, len, 0, opts);
+
+out:
+    serial_close(fd);
+    if (sim)
+        sbl_sim_stop(sim);
+    return rc;
+}
+
+static int run_presets(const bench_target_t *t, const char *image_name, const uint8_t *image, size_t len)
+{
+    int failures = 0;
+    for (size_t k = 0; k < sizeof(presets) / sizeof(presets[0]); ++k)
+    {
+        const bench_preset_t *p = &presets[k];
+        sbl_metrics_t m;
+        sbl_program_stats_t stats;
+        sbl_program_opts_t opts;
+        sbl_metrics_init(&m);
+        sbl_program_opts_init(&opts);
+        memset(&stats, 0, sizeof(stats));
+        opts.window = p->window;
+        opts.status_interval = p->status_interval;
+        opts.erase = p->erase;
+        opts.sparse_gap = p->sparse_gap;
+        opts.verify_group = p->verify_group;
+        opts.stats = &stats;
+
+        int rc = run_once(t, t->sim.wire_baud, 0, image, len, &opts, p->delta_rerun, &m);
+
+        double secs = (double)(m.end_us - m.start_us) / 1e6;
+        printf("%-20s %-11s %8.3f %10.0f %10.0f %9llu %9llu %7u  %s\n", image_name, p->name, secs,
+               secs > 0 ? (double)len / secs : 0.0, secs > 0 ? (double)m.wire_tx / secs : 0.0,
+               (unsigned long long)sbl_hist_percentile(&m.ack, 50),
+               (unsigned long long)sbl_hist_percentile(&m.ack, 99), stats.retries, rc == 0 ? "ok" : "FAIL");
+        fflush(stdout);
+        failures += rc != 0;
+    }
+    return failures;
+}
+
+// Every combination of the lists, chunk size varying fastest
+static int run_sweep(const bench_target_t *t, const char *image_name, const uint8_t *image, size_t len,
+                     const sweep_list_t *lists, uint32_t window, int csv)
+{
+    const sweep_list_t *chunks = &lists[0], *intervals = &lists[1], *bauds = &lists[2], *drains = &lists[3];
+    int failures = 0;
+    for (size_t b = 0; b < bauds->n; ++b)
+        for (size_t d = 0; d < drains->n; ++d)
+            for (size_t i = 0; i < intervals->n; ++i)
+                for (size_t k = 0; k < chunks->n; ++k)
+                {
+                    sbl_metrics_t m;
+                    sbl_program_stats_t stats;
+                    sbl_program_opts_t opts;
+                    sbl_metrics_init(&m);
+                    sbl_program_opts_init(&opts);
+                    memset(&stats, 0, sizeof(stats));
+                    opts.chunk_size = chunks->v[k];
+                    opts.status_interval = intervals->v[i];
+                    opts.window = window;
+                    opts.stats = &stats;
+
+                    int rc = run_once(t, (int)bauds->v[b], (int)drains->v[d], image, len, &opts, 0, &m);
+
+                    double secs = (double)(m.end_us - m.start_us) / 1e6;
+                    double rate = secs > 0 ? (double)len / secs : 0.0;
+                    double rt_kb = len ? (double)m.commands * 1024.0 / (double)len : 0.0;
+                    unsigned long long p50 = (unsigned long long)sbl_hist_percentile(&m.ack, 50);
+                    if (csv)
+                        printf("%s,%u,%u,%u,%u,%u,%.3f,%.0f,%.2f,%llu,%s\n", image_name, chunks->v[k],
+                               intervals->v[i], bauds->v[b], drains->v[d], window, secs, rate, rt_kb, p50,
+                               rc == 0 ? "ok" : "fail");
+                    else
+                        printf("%-20s %5u %6u %7u %5u %8.3f %10.0f %8.2f %9llu  %s\n", image_name, chunks->v[k],
+                               intervals->v[i], bauds->v[b], drains->v[d], secs, rate, rt_kb, p50,
+                               rc == 0 ? "ok" : "FAIL");
+                    fflush(stdout);
+                    failures += rc != 0;
+                }
+    return failures;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-b wire_baud] [-l ack_latency_us] [-e erase_page_us] [-p program_ns_per_byte]\n"
+            "          [-r crc_ns_per_byte] [-f rx_fifo] [-c corrupt_every] [-n nack_every] [-x drop_every]\n"
+            "          [-D dev [-F flash_size] [-P page_size] [-E]]\n"
+            "          [image.bin ...]\n"
+            "       %s -s [-k chunk_sizes] [-i status_intervals] [-B bauds] [-d drain_modes] [-w window]\n"
+            "          [-C] [the options above] [image.bin ...]\n",
+            prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    bench_target_t t;
+    memset(&t, 0, sizeof(t));
+    t.flash_size = 0x20000;
+    t.page_size = 0x1000;
+    sbl_sim_config_init(&t.sim);
+    t.sim.wire_baud = 460800;
+    t.sim.ack_latency_us = 100;
+    t.sim.erase_page_us = 10000;
+    t.sim.bank_erase_us = 30000;
+    t.sim.program_ns_per_byte = 2000;
+    t.sim.crc_ns_per_byte = 1000;
+
+    int sweep = 0, csv = 0;
+    uint32_t window = 1;
+    sweep_list_t lists[4]; // chunk sizes, status intervals, bauds, drain modes
+    parse_list("128,252", &lists[0]);
+    parse_list("1,16", &lists[1]);
+    parse_list("460800,921600", &lists[2]);
+    parse_list("0,1", &lists[3]);
+
+    static const char list_opts[] = "kiBd";
+    int opt;
+    while ((opt = getopt(argc, argv, "b:l:e:p:r:f:c:n:x:D:F:P:Esk:i:B:d:w:C")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            t.sim.wire_baud = atoi(optarg);
+            break;
+        case 'l':
+            t.sim.ack_latency_us = atoi(optarg);
+            break;
+        case 'e':
+            t.sim.erase_page_us = atoi(optarg);
+            break;
+        case 'p':
+            t.sim.program_ns_per_byte = atoi(optarg);
+            break;
+        case 'r':
+            t.sim.crc_ns_per_byte = atoi(optarg);
+            break;
+        case 'f':
+            t.sim.rx_fifo = atoi(optarg);
+            break;
+        case 'c':
+            t.sim.corrupt_every = atoi(optarg);
+            break;
+        case 'n':
+            t.sim.nack_every = atoi(optarg);
+            break;
+        case 'x':
+            t.sim.drop_every = atoi(optarg);
+            break;
+        case 'D':
+            t.dev = optarg;
+            break;
+        case 'F':
+            t.flash_size = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            t.page_size = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'E':
+            t.entry = 1;
+            break;
+        case 's':
+            sweep = 1;
+            break;
+        case 'k':
+        case 'i':
+        case 'B':
+        case 'd':
+            if (parse_list(optarg, &lists[strchr(list_opts, opt) - list_opts]) != 0)
+            {
+                fprintf(stderr, "-%c: expected a comma-separated list of up to %d numbers\n", opt, SWEEP_MAX);
+                return 1;
+            }
+            break;
+        case 'w':
+            window = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'C':
+            csv = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    // On a device the presets run at -b as the port rate, and there is no "no UART"
+    if (t.dev && t.sim.wire_baud <= 0)
+        t.sim.wire_baud = 115200;
+
+    static const char *bundled[] = {"app_full_128.bin", "full_app_128.bin", "app_full.bin"};
+    const char *const *images = (const char *const *)&argv[optind];
+    size_t n_images = (size_t)(argc - optind);
+    if (n_images == 0)
+    {
+        images = bundled;
+        n_images = sizeof(bundled) / sizeof(bundled[0]);
+    }
+
+    if (t.dev)
+        printf("device %s, flash 0x%X, page 0x%X%s\n\n", t.dev, t.flash_size, t.page_size,
+               t.entry ? ", DTR/RTS entry per run" : "");
+    else if (sweep)
+        printf("ACK latency %d us, erase %d us/page, program %d ns/byte, CRC %d ns/byte, RX FIFO %d\n\n",
+               t.sim.ack_latency_us, t.sim.erase_page_us, t.sim.program_ns_per_byte, t.sim.crc_ns_per_byte,
+               t.sim.rx_fifo);
+    else
+        printf("wire %d baud, ACK latency %d us, erase %d us/page, program %d ns/byte, CRC %d ns/byte, "
+               "RX FIFO %d\n\n",
+               t.sim.wire_baud, t.sim.ack_latency_us, t.sim.erase_page_us, t.sim.program_ns_per_byte,
+               t.sim.crc_ns_per_byte, t.sim.rx_fifo);
+    if (sweep && csv)
+        printf("image,chunk,status_interval,baud,drain,window,seconds,bytes_per_s,round_trips_per_kb,"
+               "ack_p50_us,result\n");
+    else if (sweep)
+        printf("%-20s %5s %6s %7s %5s %8s %10s %8s %9s  %s\n", "IMAGE", "CHUNK", "STATUS", "BAUD", "DRAIN",
+               "TIME(s)", "PAYLOAD/s", "RT/KB", "ACK p50", "RESULT");
+    else
+        printf("%-20s %-11s %8s %10s %10s %9s %9s %7s  %s\n", "IMAGE", "PRESET", "TIME(s)", "PAYLOAD/s", "WIRE/s",
+               "ACK p50", "ACK p99", "RETRIES", "RESULT");
+
+    int failures = 0;
+    for (size_t i = 0; i < n_images; ++i)
+    {
+        size_t len = 0;
+        uint8_t *image = read_file(images[i], &len);
+        if (!image)
+        {
+            fprintf(stderr, "%s: %s\n", images[i], strerror(errno ? errno : EINVAL));
+            ++failures;
+            continue;
+        }
+
+        // Size the simulated part to the image: CC1310 for 128 KiB, CC13x2 (8 KiB pages) beyond
+        bench_target_t ti = t;
+        if (len > 0x20000)
+        {
+            ti.sim.page_size = 0x2000;
+            ti.sim.flash_size = (uint32_t)((len + ti.sim.page_size - 1) & ~(size_t)(ti.sim.page_size - 1));
+        }
+
+        failures += sweep ? run_sweep(&ti, images[i], image, len, lists, window, csv)
+                          : run_presets(&ti, images[i], image, len);
+        free(image);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+#define _XOPEN_SOURCE 600
+#include "cc1310sbl.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+struct cc1310sbl
+{
+    int fd;
+    char *dev;
+    pthread_mutex_t lock;
+    int synced; // ROM running and answering since the last connect
+};
+
+const char *cc1310sbl_version(void)
+{
+    return STR(CC1310SBL_VERSION_MAJOR) "." STR(CC1310SBL_VERSION_MINOR) "." STR(CC1310SBL_VERSION_PATCH);
+}
+
+cc1310sbl_t *cc1310sbl_open(const char *dev_path, int baud)
+{
+    if (!dev_path)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    cc1310sbl_t *ctx = (cc1310sbl_t *)calloc(1, sizeof(*ctx));
+    if (!ctx || !(ctx->dev = strdup(dev_path)))
+    {
+        free(ctx);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((ctx->fd = serial_open_configure(dev_path, baud)) < 0)
+    {
+        int err = errno;
+        free(ctx->dev);
+        free(ctx);
+        errno = err;
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    return ctx;
+}
+
+void cc1310sbl_close(cc1310sbl_t *ctx)
+{
+    if (!ctx)
+        return;
+    // The per-fd tables outlive the port: a context that reuses the fd must
+    // neither record into metrics freed meanwhile nor start from our estimates
+    sbl_metrics_begin(ctx->fd, NULL);
+    sbl_latency_reset(ctx->fd);
+    serial_close(ctx->fd);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->dev);
+    free(ctx);
+}
+
+int cc1310sbl_fd(const cc1310sbl_t *ctx)
+{
+    return ctx ? ctx->fd : -1;
+}
+
+const char *cc1310sbl_dev(const cc1310sbl_t *ctx)
+{
+    return ctx ? ctx->dev : NULL;
+}
+
+int cc1310sbl_synced(const cc1310sbl_t *ctx)
+{
+    return ctx && ctx->synced;
+}
+
+// Every call below: take the lock, and after a failure stop trusting the link
+// until the next connect (errno survives the unlock)
+static int lock_ctx(cc1310sbl_t *ctx)
+{
+    if (!ctx)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    return 0;
+}
+
+static int unlock_ctx(cc1310sbl_t *ctx, int rc)
+{
+    int err = errno;
+    if (rc != 0)
+        ctx->synced = 0;
+    pthread_mutex_unlock(&ctx->lock);
+    errno = err;
+    return rc;
+}
+
+int cc1310sbl_connect(cc1310sbl_t *ctx, const sbl_entry_t *entry, int timeout_ms)
+{
+    if (lock_ctx(ctx) != 0)
+        return -1;
+    int rc = 0;
+    if (entry && sbl_enter_bootloader(ctx->fd, entry) != 0)
+        rc = -1;
+    else if ((entry || !ctx->synced || sbl_ping(ctx->fd, 100) != 0) &&
+             sbl_autobaud(ctx->fd, timeout_ms > 0 ? timeout_ms : 500) != 0)
+        rc = -1;
+    if (rc == 0)
+        ctx->synced = 1;
+    return unlock_ctx(ctx, rc);
+}
+
+int cc1310sbl_chip_id(cc1310sbl_t *ctx, uint32_t *chip_id)
+{
+    if (lock_ctx(ctx) != 0)
+        return -1;
+    return unlock_ctx(ctx, sbl_get_chip_id(ctx->fd, 0, chip_id));
+}
+
+int cc1310sbl_crc32(cc1310sbl_t *ctx, uint32_t addr, uint32_t len, uint32_t repeat, uint32_t *crc)
+{
+    if (lock_ctx(ctx) != 0)
+        return -1;
+    return unlock_ctx(ctx, sbl_crc32(ctx->fd, addr, len, repeat, 0, crc));
+}
+
+int cc1310sbl_read(cc1310sbl_t *ctx, uint32_t addr, uint8_t *out, size_t len)
+{
+    if (lock_ctx(ctx) != 0)
+        return -1;
+    return unlock_ctx(ctx, sbl_read_range(ctx->fd, addr, out, len, 3));
+}
+
+int cc1310sbl_erase(cc1310sbl_t *ctx, uint32_t addr, uint32_t len, uint32_t page_size)
+{
+    if (lock_ctx(ctx) != 0)
+        return -1;
+    return unlock_ctx(ctx, sbl_erase_pages(ctx->fd, addr, len, page_size));
+}
+
+int cc1310sbl_program(cc1310sbl_t *ctx, uint32_t flash_size, uint32_t page_size,
+                      const sbl_segment_t *segs, size_t n_segs, const sbl_program_opts_t *opts)
+{
+    sbl_program_opts_t o;
+    if (opts)
+        o = *opts;
+    else
+        sbl_program_opts_init(&o);
+
+    // Page CRCs and blank map for this call; pass opts->meta to share one between calls
+    sbl_image_meta_t meta;
+    int own_meta = !o.meta && sbl_image_meta_build(segs, n_segs, page_size, &meta) == 0;
+    if (own_meta)
+        o.meta = &meta;
+
+    if (lock_ctx(ctx) != 0)
+    {
+        if (own_meta)
+            sbl_image_meta_free(&meta);
+        return -1;
+    }
+    int rc = sbl_program_segments(ctx->fd, flash_size, page_size, segs, n_segs, &o);
+    if (rc == 0 && !o.no_reset)
+        ctx->synced = 0;
+    rc = unlock_ctx(ctx, rc);
+
+    if (own_meta)
+    {
+        int err = errno;
+        sbl_image_meta_free(&meta);
+        errno = err;
+    }
+    return rc;
+}
+
+int cc1310sbl_program_file(cc1310sbl_t *ctx, const char *path, uint32_t bin_addr,
+                           uint32_t flash_size, uint32_t page_size, const sbl_program_opts_t *opts)
+{
+    sbl_image_t img;
+    if (!ctx || !path)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sbl_image_load(path, bin_addr, &img) != 0)
+        return -1;
+    int rc = cc1310sbl_program(ctx, flash_size, page_size, img.segs, img.n_segs, opts);
+    int err = errno;
+    sbl_image_free(&img);
+    errno = err;
+    return rc;
+}
+
+int cc1310sbl_reset(cc1310sbl_t *ctx)
+{
+    if (lock_ctx(ctx) != 0)
+        return -1;
+    int rc = sbl_reset(ctx->fd, 0);
+    if (rc == 0)
+        ctx->synced = 0;
+    return unlock_ctx(ctx, rc);
+}
+
+int cc1310sbl_run_job(cc1310sbl_t *ctx, const sbl_multi_job_t *job, sbl_job_result_t *res)
+{
+    if (!job || !res || lock_ctx(ctx) != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(res, 0, sizeof(*res));
+    res->dev = ctx->dev;
+    int rc = sbl_run_job(ctx->fd, job, ctx->synced, res);
+    ctx->synced = rc == 0 && job->opts.no_reset;
+    unlock_ctx(ctx, rc);
+    return rc;
+}
@@ -0,0 +1,100 @@
+// libcc1310sbl: the flasher as a library, for programs that drive ROM
+// bootloaders in-process instead of running the command line tool per step.
+//
+// A context owns one open port and what is known about the bootloader behind
+// it; every call takes the context rather than a bare fd. Calls on one context
+// run one at a time under its lock. The intended use is one context per thread
+// (per port), all of them flashing at once; sbl_program_many() in sbl_multi.h
+// does the same for a list of ports with a thread pool of its own.
+//
+// What contexts do share, process-wide:
+//  - the CRC-32 tables, built once by whichever thread needs them first;
+//  - the baud cache (sbl_baud_cache_put()), whose writers take turns;
+//  - the per-fd tables behind serial.h and sbl.h (receive buffer, timeout
+//    estimates, attached sbl_metrics_t). A context only touches its own fd's
+//    entries, and cc1310sbl_close() detaches them from the fd. Attach and end
+//    metrics on a context's fd from the thread that uses the context;
+//  - the protocol trace and the low-latency profile. serial_trace_open(),
+//    serial_trace_close() and serial_set_low_latency() are not synchronised:
+//    call them before the first context is opened, or while none is in use.
+//
+// The lower layers (sbl.h, sbl_image.h, serial.h) are part of the library too;
+// cc1310sbl_fd() hands the port to them for anything not wrapped here.
+//
+// Functions returning int give 0 on success and -1 on error with errno set.
+#ifndef CC1310SBL_H
+#define CC1310SBL_H
+
+#include "sbl.h"
+#include "sbl_image.h"
+#include "sbl_multi.h"
+
+// Exported from the shared library (built with -fvisibility=hidden)
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define CC1310SBL_VERSION_MAJOR 1
+#define CC1310SBL_VERSION_MINOR 0
+#define CC1310SBL_VERSION_PATCH 0
+
+    // "major.minor.patch" of the library actually linked
+    const char *cc1310sbl_version(void);
+
+    typedef struct cc1310sbl cc1310sbl_t;
+
+    // Open and configure dev_path (see serial_open_configure()). Returns NULL on error.
+    cc1310sbl_t *cc1310sbl_open(const char *dev_path, int baud);
+
+    // Close the port and free the context (NULL is ignored). No RESET is sent.
+    void cc1310sbl_close(cc1310sbl_t *ctx);
+
+    int cc1310sbl_fd(const cc1310sbl_t *ctx);
+    const char *cc1310sbl_dev(const cc1310sbl_t *ctx);
+
+    // 1 while the ROM is known to be running and in step with this context: after
+    // cc1310sbl_connect() and every call since that succeeded without resetting it.
+    int cc1310sbl_synced(const cc1310sbl_t *ctx);
+
+    // Get in step with the ROM: DTR/RTS entry first if entry is non-NULL, then
+    // autobaud, or only a PING while the context is synced. timeout_ms <= 0
+    // waits the usual 500 ms for the autobaud ACK.
+    int cc1310sbl_connect(cc1310sbl_t *ctx, const sbl_entry_t *entry, int timeout_ms);
+
+    int cc1310sbl_chip_id(cc1310sbl_t *ctx, uint32_t *chip_id);
+    // CMD_CRC32 over len bytes at addr, read repeat + 1 times by the ROM (0 for one pass)
+    int cc1310sbl_crc32(cc1310sbl_t *ctx, uint32_t addr, uint32_t len, uint32_t repeat, uint32_t *crc);
+    int cc1310sbl_read(cc1310sbl_t *ctx, uint32_t addr, uint8_t *out, size_t len);
+    int cc1310sbl_erase(cc1310sbl_t *ctx, uint32_t addr, uint32_t len, uint32_t page_size);
+
+    // sbl_program_segments() on a connected context. opts may be NULL for the
+    // defaults; without opts->meta the page map is built for this call only
+    // (sbl_image_meta_build()). The ROM is reset at the end unless opts->no_reset.
+    int cc1310sbl_program(cc1310sbl_t *ctx, uint32_t flash_size, uint32_t page_size,
+                          const sbl_segment_t *segs, size_t n_segs, const sbl_program_opts_t *opts);
+
+    // Load a BIN/HEX/ELF file (bin_addr places a raw image) and cc1310sbl_program() it.
+    int cc1310sbl_program_file(cc1310sbl_t *ctx, const char *path, uint32_t bin_addr,
+                               uint32_t flash_size, uint32_t page_size, const sbl_program_opts_t *opts);
+
+    int cc1310sbl_reset(cc1310sbl_t *ctx);
+
+    // sbl_run_job() on the context's port, skipping the autobaud while synced;
+    // res->dev is set to the context's device, job->baud and max_parallel are
+    // not used. Returns res->rc.
+    int cc1310sbl_run_job(cc1310sbl_t *ctx, const sbl_multi_job_t *job, sbl_job_result_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
+
+#endif // CC1310SBL_H
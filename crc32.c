@@ -0,0 +1,287 @@
+#include "crc32.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_HAVE_PCLMUL
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRC32) || defined(__linux__))
+#include <arm_acle.h>
+#define CRC32_HAVE_ARMV8
+#if !defined(__ARM_FEATURE_CRC32)
+// Not guaranteed by the build flags: compile the kernel for +crc, check HWCAP at runtime
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32_ARMV8_TARGET __attribute__((target("arch=armv8-a+crc")))
+#endif
+#endif
+
+#ifndef CRC32_ARMV8_TARGET
+#define CRC32_ARMV8_TARGET
+#endif
+
+// Kernels work on the raw register (pre/post inversion is done by the callers)
+typedef uint32_t (*crc32_kernel_fn)(uint32_t c, const uint8_t *p, size_t len);
+
+static uint32_t crc_table[8][256];
+static uint32_t x2n_table[32]; // x^(2^k) mod P, for sbl_crc32_combine()
+static crc32_kernel_fn crc_kernel;
+static const char *crc_kernel_name = "slice-by-8";
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32_bytes(uint32_t c, const uint8_t *p, size_t len)
+{
+    while (len--)
+        c = crc_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    return c;
+}
+
+// Eight table lookups per 8 bytes instead of one per byte
+static uint32_t crc32_slice8(uint32_t c, const uint8_t *p, size_t len)
+{
+    while (len >= 8)
+    {
+        uint32_t lo = c ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+        c = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+            crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+            crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+            crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    return crc32_bytes(c, p, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+// Carry-less multiply folding, 64 bytes per iteration, after Intel's "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ" (constants for the
+// reflected 0xEDB88320 polynomial, as used by zlib/Chromium).
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t c, const uint8_t *p, size_t len)
+{
+    if (len < 64)
+        return crc32_slice8(c, p, len);
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)c));
+    p += 64;
+    len -= 64;
+
+    // Four independent 128-bit lanes
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+        p += 64;
+        len -= 64;
+    }
+
+    // Fold the lanes into one
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)p)), x5);
+        p += 16;
+        len -= 16;
+    }
+
+    // 128 -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    c = (uint32_t)_mm_extract_epi32(x1, 1);
+
+    return crc32_slice8(c, p, len);
+}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+// ARMv8 CRC32 instructions implement exactly this polynomial
+CRC32_ARMV8_TARGET
+static uint32_t crc32_armv8(uint32_t c, const uint8_t *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7))
+    {
+        c = __crc32b(c, *p++);
+        --len;
+    }
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __crc32d(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        c = __crc32b(c, *p++);
+    return c;
+}
+#endif
+
+// a * b modulo the CRC polynomial, both in the reflected bit order (x^0 is bit 31)
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ 0xEDB88320u : (b >> 1);
+    }
+    return p;
+}
+
+static void crc32_build(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : (c >> 1);
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        for (int t = 1; t < 8; ++t)
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xFF] ^ (crc_table[t - 1][i] >> 8);
+    }
+
+    // x^1, then repeated squaring
+    x2n_table[0] = 1u << 30;
+    for (int k = 1; k < 32; ++k)
+        x2n_table[k] = multmodp(x2n_table[k - 1], x2n_table[k - 1]);
+
+    crc_kernel = crc32_slice8;
+#if defined(CRC32_HAVE_PCLMUL)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    {
+        crc_kernel = crc32_pclmul;
+        crc_kernel_name = "pclmul";
+    }
+#elif defined(CRC32_HAVE_ARMV8) && defined(__ARM_FEATURE_CRC32)
+    crc_kernel = crc32_armv8;
+    crc_kernel_name = "armv8-crc";
+#elif defined(CRC32_HAVE_ARMV8)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+    {
+        crc_kernel = crc32_armv8;
+        crc_kernel_name = "armv8-crc";
+    }
+#endif
+}
+
+void sbl_crc32_init(void)
+{
+    pthread_once(&crc_once, crc32_build);
+}
+
+const char *sbl_crc32_kernel_name(void)
+{
+    sbl_crc32_init();
+    return crc_kernel_name;
+}
+
+uint32_t sbl_crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    sbl_crc32_init();
+
+    return ~crc_kernel(~crc, data, len);
+}
+
+uint32_t sbl_crc32_fill(uint32_t crc, uint8_t value, size_t len)
+{
+    uint8_t block[256];
+    memset(block, value, sizeof(block));
+    while (len > 0)
+    {
+        size_t n = len < sizeof(block) ? len : sizeof(block);
+        crc = sbl_crc32_update(crc, block, n);
+        len -= n;
+    }
+    return crc;
+}
+
+uint32_t sbl_crc32_rom(uint32_t crc, const uint8_t *data, size_t len, uint32_t repeat)
+{
+    if (repeat == 0)
+        return sbl_crc32_update(crc, data, len);
+
+    sbl_crc32_init();
+
+    // Every location is read repeat + 1 times in a row
+    uint32_t c = ~crc;
+    for (size_t i = 0; i < len; ++i)
+    {
+        for (uint32_t r = 0; r <= repeat; ++r)
+            c = crc_table[0][(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+uint32_t sbl_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    sbl_crc32_init();
+
+    // Shift crc1 over len2 zero bytes: multiply by x^(8 * len2)
+    uint32_t p = 1u << 31;
+    for (unsigned k = 3; len2; len2 >>= 1, ++k)
+    {
+        if (len2 & 1)
+            p = multmodp(x2n_table[k & 31], p);
+    }
+    return multmodp(p, crc1) ^ crc2;
+}
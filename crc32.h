@@ -0,0 +1,30 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Build the lookup tables and pick a kernel. Done once, on first use from
+// whichever thread gets there first; calling it up front only moves the cost.
+void sbl_crc32_init(void);
+
+// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320) as computed by the
+// ROM bootloader's CMD_CRC32. zlib-style chaining: start with crc = 0 and feed
+// consecutive buffers; the return value is the finished CRC of all data so far.
+uint32_t sbl_crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+
+// Same as sbl_crc32_update() over len bytes of the given value (e.g. 0xFF padding).
+uint32_t sbl_crc32_fill(uint32_t crc, uint8_t value, size_t len);
+
+// CRC of A followed by B from crc1 = CRC(A), crc2 = CRC(B) and B's length,
+// without the data: page CRCs computed once add up to the CRC of any run of pages.
+uint32_t sbl_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+// Host equivalent of CMD_CRC32 with a read repeat count: every byte is fed
+// repeat + 1 times in a row. repeat == 0 is plain sbl_crc32_update().
+uint32_t sbl_crc32_rom(uint32_t crc, const uint8_t *data, size_t len, uint32_t repeat);
+
+// Kernel picked by sbl_crc32_init() for this CPU: "slice-by-8", "pclmul" or "armv8-crc".
+const char *sbl_crc32_kernel_name(void);
+
+#endif
@@ -0,0 +1,963 @@
+#define _POSIX_C_SOURCE 200809L
+#include "daemon.h"
+#include "progress.h"
+#include "sbl_image.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DAEMON_MAX_CLIENTS 32
+#define DAEMON_MAX_IMAGES 16
+#define DAEMON_MAX_WORDS 64
+#define DAEMON_LINE_MAX 4096
+#define DAEMON_OUTBUF_MAX (1u << 20) // progress events beyond this are dropped
+
+typedef struct
+{
+    char *path;
+    uint32_t base_addr; // only places raw images
+    uint32_t page_size; // meta is for this page size
+    time_t mtime;
+    off_t size;
+    sbl_image_t img;
+    sbl_image_meta_t meta;
+    int have_meta;
+    unsigned refs;     // jobs using it
+    uint64_t last_ms;  // for evicting the least recently used
+    int cached;        // still in the table (else freed with its last job)
+} cached_image_t;
+
+typedef struct job
+{
+    struct job *next;
+    unsigned id;
+    int client; // slot and generation of the submitting connection
+    unsigned client_gen;
+    cached_image_t *image;
+    sbl_multi_job_t mj;
+    sbl_entry_t entry;
+    uint64_t last_event_ms;
+} job_t;
+
+typedef struct
+{
+    const char *dev;
+    int fd;      // -1 while it cannot be opened
+    int synced;  // left in the bootloader by the last job
+    pthread_t thread;
+    pthread_cond_t cond;
+    job_t *head, *tail;
+    unsigned queued;
+    job_t *running;
+    unsigned done, failed;
+} port_t;
+
+typedef struct
+{
+    int fd; // -1 = free slot
+    unsigned gen;
+    char in[DAEMON_LINE_MAX];
+    size_t in_len;
+    char *out;
+    size_t out_len, out_cap;
+} client_t;
+
+// Everything below is guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static const daemon_config_t *config;
+static port_t *ports;
+static client_t clients[DAEMON_MAX_CLIENTS];
+static cached_image_t *images[DAEMON_MAX_IMAGES];
+static unsigned next_job_id = 1;
+static unsigned loading; // program requests whose image is still being loaded
+static pthread_cond_t loaded = PTHREAD_COND_INITIALIZER; // loading went down
+static int stopping;
+static int wake_pipe[2] = {-1, -1}; // workers and signals -> poll loop
+static volatile sig_atomic_t got_signal;
+
+static void wake_loop(void)
+{
+    char c = 0;
+    ssize_t n = write(wake_pipe[1], &c, 1);
+    (void)n; // a full pipe already has a wake-up pending
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    got_signal = 1;
+    wake_loop();
+}
+
+// --- client output: appended by anyone, written by the poll loop ---
+
+// With lock held. droppable lines are skipped while the client is lagging.
+static void post_locked(int slot, unsigned gen, int droppable, const char *fmt, ...)
+{
+    if (slot < 0)
+        return;
+    client_t *c = &clients[slot];
+    if (c->fd < 0 || c->gen != gen || (droppable && c->out_len > DAEMON_OUTBUF_MAX))
+        return;
+    char line[DAEMON_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if ((size_t)n > sizeof(line) - 2)
+        n = (int)sizeof(line) - 2;
+    line[n++] = '\n';
+    if (c->out_len + (size_t)n > c->out_cap)
+    {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + (size_t)n)
+            cap *= 2;
+        char *p = (char *)realloc(c->out, cap);
+        if (!p)
+            return;
+        c->out = p;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, line, (size_t)n);
+    c->out_len += (size_t)n;
+    wake_loop();
+}
+
+static void client_close_locked(int slot)
+{
+    client_t *c = &clients[slot];
+    close(c->fd);
+    c->fd = -1;
+    c->gen++; // results of its jobs go nowhere now
+    c->in_len = 0;
+    c->out_len = 0;
+}
+
+// Write what is buffered without waiting; drops the client on a hard error.
+static void client_flush_locked(int slot)
+{
+    client_t *c = &clients[slot];
+    while (c->out_len > 0)
+    {
+        ssize_t n = send(c->fd, c->out, c->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                client_close_locked(slot);
+            return;
+        }
+        memmove(c->out, c->out + n, c->out_len - (size_t)n);
+        c->out_len -= (size_t)n;
+    }
+}
+
+// --- image cache ---
+
+// With lock held
+static void image_release_locked(cached_image_t *ci)
+{
+    if (--ci->refs == 0 && !ci->cached)
+    {
+        if (ci->have_meta)
+            sbl_image_meta_free(&ci->meta);
+        sbl_image_free(&ci->img);
+        free(ci->path);
+        free(ci);
+    }
+}
+
+// Take the table slot of an unused image, the least recently used one first.
+// With lock held; -1 if every image is in use.
+static int image_slot_locked(void)
+{
+    int best = -1;
+    for (int i = 0; i < DAEMON_MAX_IMAGES; ++i)
+    {
+        if (!images[i])
+            return i;
+        if (images[i]->refs == 0 && (best < 0 || images[i]->last_ms < images[best]->last_ms))
+            best = i;
+    }
+    if (best >= 0)
+    {
+        images[best]->cached = 0;
+        images[best]->refs++;
+        image_release_locked(images[best]);
+        images[best] = NULL;
+    }
+    return best;
+}
+
+// A reference to path as loaded for base_addr, with its page map for page_size,
+// parsed again only if the file changed since. Returns NULL (errno set) if it
+// cannot be loaded.
+static cached_image_t *image_get(const char *path, uint32_t base_addr, uint32_t page_size)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < DAEMON_MAX_IMAGES; ++i)
+    {
+        cached_image_t *ci = images[i];
+        if (ci && ci->base_addr == base_addr && ci->page_size == page_size && strcmp(ci->path, path) == 0)
+        {
+            if (ci->mtime == st.st_mtime && ci->size == st.st_size)
+            {
+                ci->refs++;
+                ci->last_ms = serial_now_ms();
+                pthread_mutex_unlock(&lock);
+                return ci;
+            }
+            // Rebuilt since: jobs still holding the old copy keep it
+            ci->cached = 0;
+            ci->refs++;
+            image_release_locked(ci);
+            images[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    // Parse outside the lock; the workers keep reporting meanwhile
+    cached_image_t *ci = (cached_image_t *)calloc(1, sizeof(*ci));
+    if (!ci || !(ci->path = strdup(path)) || sbl_image_load(path, base_addr, &ci->img) != 0)
+    {
+        int err = errno;
+        if (ci)
+            free(ci->path);
+        free(ci);
+        errno = err;
+        return NULL;
+    }
+    // Without a page map the job still runs, only working the CRCs out as it goes
+    ci->have_meta = sbl_image_meta_build(ci->img.segs, ci->img.n_segs, page_size, &ci->meta) == 0;
+    ci->base_addr = base_addr;
+    ci->page_size = page_size;
+    ci->mtime = st.st_mtime;
+    ci->size = st.st_size;
+    ci->refs = 1;
+    ci->last_ms = serial_now_ms();
+
+    pthread_mutex_lock(&lock);
+    int slot = image_slot_locked();
+    if (slot >= 0)
+    {
+        images[slot] = ci;
+        ci->cached = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return ci;
+}
+
+// --- per-port workers ---
+
+static void job_progress(const char *dev, const sbl_event_t *ev, void *user)
+{
+    job_t *job = (job_t *)user;
+    (void)dev;
+    int periodic = ev->type == SBL_EV_PROGRESS || ev->type == SBL_EV_PAGE_ERASED;
+    uint64_t now = serial_now_ms();
+    if (periodic && ev->done < ev->total && now - job->last_event_ms < config->progress_ms)
+        return;
+    job->last_event_ms = now;
+
+    char line[256];
+    progress_format(line, sizeof(line), PROGRESS_JSON, NULL, ev);
+    pthread_mutex_lock(&lock);
+    post_locked(job->client, job->client_gen, 1, "event %u %s", job->id, line);
+    pthread_mutex_unlock(&lock);
+}
+
+// sbl_metrics_write_json() folded onto one line; NULL if out of memory
+static char *metrics_line(const sbl_job_result_t *res)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+    if (!f)
+        return NULL;
+    sbl_metrics_write_json(f, &res->metrics, &res->stats, res->rc);
+    fclose(f);
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (buf[i] == '\n')
+            buf[i] = ' ';
+    }
+    return buf;
+}
+
+static void run_port_job(port_t *p, job_t *job)
+{
+    sbl_job_result_t res;
+    memset(&res, 0, sizeof(res));
+    res.dev = p->dev;
+    res.step = SBL_JOB_OPEN;
+    res.rc = -1;
+
+    // Only this worker changes p->fd and p->synced, so it reads them unlocked;
+    // request_status() reads them under lock, so they are written under it.
+    // Ports that vanished (unplugged adapter) are opened again for each job.
+    int fd = p->fd;
+    if (fd < 0 && (fd = serial_open_configure(p->dev, config->baud)) < 0)
+        res.err = errno;
+    else
+        sbl_run_job(fd, &job->mj, p->synced, &res);
+    if (res.rc != 0 && fd >= 0 && (res.err == EIO || res.err == ENXIO || res.err == ENODEV))
+    {
+        serial_close(fd);
+        fd = -1;
+    }
+
+    char *metrics = metrics_line(&res);
+    fprintf(stderr, "Job %u on %s: %s at %s (%.2f s)\n", job->id, p->dev, res.rc == 0 ? "OK" : "FAILED",
+            sbl_job_step_name(res.step), res.seconds);
+
+    pthread_mutex_lock(&lock);
+    p->fd = fd;
+    p->synced = res.rc == 0 && job->mj.opts.no_reset;
+    post_locked(job->client, job->client_gen, 0, "done %u %s %s %.3f %zu %zu %s", job->id,
+                res.rc == 0 ? "ok" : "fail", sbl_job_step_name(res.step), res.seconds, res.stats.bytes_sent,
+                res.stats.bytes_skipped, res.rc == 0 ? "-" : strerror(res.err));
+    post_locked(job->client, job->client_gen, 0, "metrics %u %s", job->id, metrics ? metrics : "{}");
+    if (res.rc == 0)
+        p->done++;
+    else
+        p->failed++;
+    pthread_mutex_unlock(&lock);
+    free(metrics);
+}
+
+static void *port_worker(void *arg)
+{
+    port_t *p = (port_t *)arg;
+    pthread_mutex_lock(&lock);
+    for (;;)
+    {
+        while (!p->head && !stopping)
+            pthread_cond_wait(&p->cond, &lock);
+        if (!p->head)
+            break;
+        job_t *job = p->head;
+        p->head = job->next;
+        if (!p->head)
+            p->tail = NULL;
+        p->queued--;
+        p->running = job;
+        pthread_mutex_unlock(&lock);
+
+        run_port_job(p, job);
+
+        pthread_mutex_lock(&lock);
+        p->running = NULL;
+        image_release_locked(job->image);
+        free(job);
+        wake_loop(); // a shutdown may be waiting for the queues to empty
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+// --- requests ---
+
+static port_t *pick_port_locked(const char *name)
+{
+    port_t *best = NULL;
+    for (size_t i = 0; i < config->n_ports; ++i)
+    {
+        port_t *p = &ports[i];
+        if (strcmp(name, "*") != 0)
+        {
+            if (strcmp(name, p->dev) == 0)
+                return p;
+            continue;
+        }
+        unsigned load = p->queued + (p->running != NULL);
+        if (!best || load < best->queued + (best->running != NULL))
+            best = p;
+    }
+    return best;
+}
+
+// A program request between parsing and queueing: its image is loaded (and its
+// page map built) on a thread of its own, so the poll loop keeps serving
+typedef struct
+{
+    job_t *job;
+    int slot;
+    unsigned gen;
+    char *port;
+    char *path;
+} load_req_t;
+
+static void load_req_free(load_req_t *req)
+{
+    free(req->port);
+    free(req->path);
+    free(req);
+}
+
+static void *load_and_queue(void *arg)
+{
+    load_req_t *req = (load_req_t *)arg;
+    job_t *job = req->job;
+    sbl_multi_job_t *mj = &job->mj;
+
+    cached_image_t *ci = image_get(req->path, mj->base_addr, mj->page_size);
+    pthread_mutex_lock(&lock);
+    loading--;
+    pthread_cond_broadcast(&loaded);
+    wake_loop(); // a shutdown may be waiting for the loads to finish
+    if (!ci)
+    {
+        int err = errno;
+        post_locked(req->slot, req->gen, 0, "error cannot load %s: %s", req->path, strerror(err));
+        pthread_mutex_unlock(&lock);
+        free(job);
+        load_req_free(req);
+        return NULL;
+    }
+    job->image = ci;
+    mj->segs = ci->img.segs;
+    mj->n_segs = ci->img.n_segs;
+    mj->opts.meta = ci->have_meta ? &ci->meta : NULL;
+
+    port_t *p = pick_port_locked(req->port);
+    if (!p || stopping)
+    {
+        post_locked(req->slot, req->gen, 0, stopping ? "error shutting down" : "error unknown port %s", req->port);
+        image_release_locked(ci);
+        pthread_mutex_unlock(&lock);
+        free(job);
+        load_req_free(req);
+        return NULL;
+    }
+    job->id = next_job_id++;
+    job->client = req->slot;
+    job->client_gen = req->gen;
+    if (p->tail)
+        p->tail->next = job;
+    else
+        p->head = job;
+    p->tail = job;
+    p->queued++;
+    post_locked(req->slot, req->gen, 0, "queued %u %s", job->id, p->dev);
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&lock);
+    load_req_free(req);
+    return NULL;
+}
+
+// program <port|*> <image> <addr_hex> <flash_size_hex> <page_size_hex> [options]
+static void request_program(int slot, int argc, char **argv)
+{
+    unsigned gen = clients[slot].gen;
+    if (argc < 6)
+    {
+        pthread_mutex_lock(&lock);
+        post_locked(slot, gen, 0, "error usage: program <port|*> <image> <addr> <flash_size> <page_size> [options]");
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    job_t *job = (job_t *)calloc(1, sizeof(*job));
+    if (!job)
+        return;
+    sbl_multi_job_t *mj = &job->mj;
+    if (config->parse_opts(argc - 6, argv + 6, mj, &job->entry) != 0)
+    {
+        free(job);
+        pthread_mutex_lock(&lock);
+        post_locked(slot, gen, 0, "error bad options");
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    mj->baud = config->baud;
+    mj->base_addr = (uint32_t)strtoul(argv[3], NULL, 0);
+    mj->flash_size = (uint32_t)strtoul(argv[4], NULL, 0);
+    mj->page_size = (uint32_t)strtoul(argv[5], NULL, 0);
+    mj->progress = job_progress;
+    mj->progress_user = job;
+
+    // argv points into the client's input buffer, which the next read reuses
+    load_req_t *req = (load_req_t *)calloc(1, sizeof(*req));
+    if (!req || !(req->port = strdup(argv[1])) || !(req->path = strdup(argv[2])))
+    {
+        if (req)
+            load_req_free(req);
+        free(job);
+        pthread_mutex_lock(&lock);
+        post_locked(slot, gen, 0, "error out of memory");
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    req->job = job;
+    req->slot = slot;
+    req->gen = gen;
+
+    pthread_mutex_lock(&lock);
+    loading++;
+    pthread_mutex_unlock(&lock);
+    pthread_t t;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t, &attr, load_and_queue, req) != 0)
+        load_and_queue(req); // no thread to spare: load here after all
+    pthread_attr_destroy(&attr);
+}
+
+static void request_cancel(int slot, const char *id_str)
+{
+    unsigned id = (unsigned)strtoul(id_str, NULL, 10);
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < config->n_ports; ++i)
+    {
+        port_t *p = &ports[i];
+        job_t *prev = NULL;
+        for (job_t *job = p->head; job; prev = job, job = job->next)
+        {
+            if (job->id != id)
+                continue;
+            if (prev)
+                prev->next = job->next;
+            else
+                p->head = job->next;
+            if (p->tail == job)
+                p->tail = prev;
+            p->queued--;
+            post_locked(job->client, job->client_gen, 0, "done %u fail cancelled 0.000 0 0 cancelled", id);
+            post_locked(job->client, job->client_gen, 0, "metrics %u {}", id);
+            image_release_locked(job->image);
+            free(job);
+            post_locked(slot, clients[slot].gen, 0, "ok");
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+    }
+    post_locked(slot, clients[slot].gen, 0, "error no queued job %u", id);
+    pthread_mutex_unlock(&lock);
+}
+
+static void request_status(int slot)
+{
+    unsigned gen = clients[slot].gen;
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < config->n_ports; ++i)
+    {
+        const port_t *p = &ports[i];
+        post_locked(slot, gen, 0, "port %s %s queued=%u synced=%d done=%u failed=%u", p->dev,
+                    p->running ? "busy" : p->fd < 0 ? "down" : "idle", p->queued, p->synced, p->done, p->failed);
+    }
+    unsigned n = 0;
+    for (int i = 0; i < DAEMON_MAX_IMAGES; ++i)
+        n += images[i] != NULL;
+    post_locked(slot, gen, 0, "images cached=%u", n);
+    post_locked(slot, gen, 0, "ok");
+    pthread_mutex_unlock(&lock);
+}
+
+static void handle_line(int slot, char *line)
+{
+    char *argv[DAEMON_MAX_WORDS];
+    int argc = 0;
+    for (char *save = NULL, *tok = strtok_r(line, " \t\r", &save); tok; tok = strtok_r(NULL, " \t\r", &save))
+    {
+        if (argc == DAEMON_MAX_WORDS)
+        {
+            pthread_mutex_lock(&lock);
+            post_locked(slot, clients[slot].gen, 0, "error too many words");
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        argv[argc++] = tok;
+    }
+    if (argc == 0)
+        return;
+
+    if (strcmp(argv[0], "program") == 0)
+        request_program(slot, argc, argv);
+    else if (strcmp(argv[0], "cancel") == 0 && argc == 2)
+        request_cancel(slot, argv[1]);
+    else if (strcmp(argv[0], "status") == 0)
+        request_status(slot);
+    else
+    {
+        pthread_mutex_lock(&lock);
+        if (strcmp(argv[0], "shutdown") == 0)
+        {
+            stopping = 1;
+            for (size_t i = 0; i < config->n_ports; ++i)
+                pthread_cond_signal(&ports[i].cond);
+            post_locked(slot, clients[slot].gen, 0, "ok");
+        }
+        else
+            post_locked(slot, clients[slot].gen, 0, "error unknown request %s", argv[0]);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+// Read what the client sent and run every complete line; 0, or -1 once it hung up.
+static int client_read(int slot)
+{
+    client_t *c = &clients[slot];
+    ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+    if (n <= 0)
+        return n < 0 && (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    c->in_len += (size_t)n;
+
+    char *start = c->in;
+    char *nl;
+    while ((nl = memchr(start, '\n', c->in_len - (size_t)(start - c->in))) != NULL)
+    {
+        *nl = '\0';
+        handle_line(slot, start);
+        start = nl + 1;
+    }
+    c->in_len -= (size_t)(start - c->in);
+    memmove(c->in, start, c->in_len);
+    if (c->in_len == sizeof(c->in) - 1)
+        return -1; // a line longer than anything valid
+    return 0;
+}
+
+// --- setup and the poll loop ---
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+        return -1;
+    // A socket file nobody answers on is left over from a previous run
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+    {
+        close(s);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    close(s);
+    unlink(path);
+
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+        return -1;
+    if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(s, 8) != 0)
+    {
+        int err = errno;
+        close(s);
+        errno = err;
+        return -1;
+    }
+    return s;
+}
+
+static void accept_client(int listen_fd)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i)
+    {
+        if (clients[i].fd < 0)
+        {
+            clients[i].fd = fd;
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    static const char busy[] = "error too many clients\n";
+    ssize_t n = send(fd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    (void)n;
+    close(fd);
+}
+
+// With lock held: no job loading, queued or running anywhere
+static int all_idle_locked(void)
+{
+    if (loading)
+        return 0;
+    for (size_t i = 0; i < config->n_ports; ++i)
+    {
+        if (ports[i].head || ports[i].running)
+            return 0;
+    }
+    return 1;
+}
+
+static void poll_loop(int listen_fd)
+{
+    for (;;)
+    {
+        struct pollfd pfd[2 + DAEMON_MAX_CLIENTS];
+        int slot_of[2 + DAEMON_MAX_CLIENTS];
+        nfds_t n = 0;
+
+        pthread_mutex_lock(&lock);
+        if (got_signal && !stopping)
+        {
+            fprintf(stderr, "Signal received: finishing the queued jobs\n");
+            stopping = 1;
+            for (size_t i = 0; i < config->n_ports; ++i)
+                pthread_cond_signal(&ports[i].cond);
+        }
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i)
+        {
+            if (clients[i].fd >= 0)
+                client_flush_locked(i);
+        }
+        if (stopping && all_idle_locked())
+        {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        pfd[n].fd = wake_pipe[0];
+        pfd[n].events = POLLIN;
+        slot_of[n++] = -1;
+        pfd[n].fd = listen_fd;
+        pfd[n].events = POLLIN;
+        slot_of[n++] = -1;
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i)
+        {
+            if (clients[i].fd < 0)
+                continue;
+            pfd[n].fd = clients[i].fd;
+            pfd[n].events = (short)(POLLIN | (clients[i].out_len ? POLLOUT : 0));
+            slot_of[n++] = i;
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (poll(pfd, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+        if (pfd[0].revents & POLLIN)
+        {
+            char junk[64];
+            while (read(wake_pipe[0], junk, sizeof(junk)) > 0)
+                ;
+        }
+        if (pfd[1].revents & POLLIN)
+            accept_client(listen_fd);
+        for (nfds_t k = 2; k < n; ++k)
+        {
+            // The loop thread is the only one that opens, reads or closes clients
+            if ((pfd[k].revents & (POLLIN | POLLHUP | POLLERR)) && client_read(slot_of[k]) != 0)
+            {
+                pthread_mutex_lock(&lock);
+                client_close_locked(slot_of[k]);
+                pthread_mutex_unlock(&lock);
+            }
+        }
+    }
+}
+
+int daemon_run(const daemon_config_t *cfg)
+{
+    if (!cfg || !cfg->socket_path || !cfg->ports || cfg->n_ports == 0 || !cfg->parse_opts)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    config = cfg;
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i)
+        clients[i].fd = -1;
+
+    if (pipe(wake_pipe) != 0)
+        return -1;
+    for (int i = 0; i < 2; ++i)
+    {
+        int fl = fcntl(wake_pipe[i], F_GETFL);
+        fcntl(wake_pipe[i], F_SETFL, fl | O_NONBLOCK);
+    }
+    int listen_fd = listen_on(cfg->socket_path);
+    if (listen_fd < 0)
+        return -1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    // Ports are opened (and configured) once, here; autobaud happens with the first job
+    ports = (port_t *)calloc(cfg->n_ports, sizeof(port_t));
+    if (!ports)
+        return -1;
+    size_t started = 0;
+    for (; started < cfg->n_ports; ++started)
+    {
+        port_t *p = &ports[started];
+        p->dev = cfg->ports[started];
+        p->fd = serial_open_configure(p->dev, cfg->baud);
+        if (p->fd < 0)
+            fprintf(stderr, "%s: %s (trying again with its first job)\n", p->dev, strerror(errno));
+        pthread_cond_init(&p->cond, NULL);
+        if (pthread_create(&p->thread, NULL, port_worker, p) != 0)
+        {
+            pthread_cond_destroy(&p->cond);
+            serial_close(p->fd);
+            break;
+        }
+    }
+    if (started == cfg->n_ports)
+    {
+        fprintf(stderr, "Serving %zu port(s) on %s\n", cfg->n_ports, cfg->socket_path);
+        poll_loop(listen_fd);
+    }
+
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    for (size_t i = 0; i < started; ++i)
+        pthread_cond_signal(&ports[i].cond);
+    while (loading) // they queue into ports, or answer "shutting down"
+        pthread_cond_wait(&loaded, &lock);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < started; ++i)
+    {
+        pthread_join(ports[i].thread, NULL);
+        pthread_cond_destroy(&ports[i].cond);
+        serial_close(ports[i].fd);
+    }
+
+    // Answers still buffered (the shutdown "ok", last results) get one more try
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i)
+    {
+        if (clients[i].fd < 0)
+            continue;
+        client_flush_locked(i);
+        if (clients[i].fd >= 0)
+            client_close_locked(i);
+        free(clients[i].out);
+        clients[i].out = NULL;
+        clients[i].out_cap = 0;
+    }
+    for (int i = 0; i < DAEMON_MAX_IMAGES; ++i)
+    {
+        if (images[i])
+        {
+            images[i]->cached = 0;
+            images[i]->refs++;
+            image_release_locked(images[i]);
+            images[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    close(listen_fd);
+    unlink(cfg->socket_path);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    free(ports);
+    ports = NULL;
+    return started == cfg->n_ports ? 0 : -1;
+}
+
+// --- client side ---
+
+int daemon_submit(const char *socket_path, int argc, char **argv)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (argc < 1 || strlen(socket_path) >= sizeof(sa.sun_path))
+    {
+        errno = EINVAL;
+        return 2;
+    }
+    strcpy(sa.sun_path, socket_path);
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0 || connect(s, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+    {
+        fprintf(stderr, "Cannot reach %s: %s\n", socket_path, strerror(errno));
+        if (s >= 0)
+            close(s);
+        return 2;
+    }
+
+    char line[DAEMON_LINE_MAX];
+    size_t len = 0;
+    for (int i = 0; i < argc; ++i)
+    {
+        int n = snprintf(line + len, sizeof(line) - len, "%s%s", i ? " " : "", argv[i]);
+        if (n < 0 || (size_t)n >= sizeof(line) - len - 1)
+        {
+            fprintf(stderr, "Request too long\n");
+            close(s);
+            return 1;
+        }
+        len += (size_t)n;
+    }
+    line[len++] = '\n';
+    if (send(s, line, len, MSG_NOSIGNAL) != (ssize_t)len)
+    {
+        perror("send");
+        close(s);
+        return 2;
+    }
+
+    int is_program = strcmp(argv[0], "program") == 0;
+    unsigned id = 0;
+    int rc = 1;
+    FILE *in = fdopen(s, "r");
+    if (!in)
+    {
+        close(s);
+        return 2;
+    }
+    while (fgets(line, sizeof(line), in))
+    {
+        fputs(line, stdout);
+        fflush(stdout);
+        unsigned got;
+        char result[8];
+        if (strncmp(line, "error", 5) == 0)
+            break;
+        if (!is_program && strncmp(line, "ok", 2) == 0)
+        {
+            rc = 0;
+            break;
+        }
+        if (is_program && sscanf(line, "queued %u", &got) == 1)
+            id = got;
+        else if (is_program && sscanf(line, "done %u %7s", &got, result) == 2 && got == id)
+            rc = strcmp(result, "ok") == 0 ? 0 : 1;
+        else if (is_program && sscanf(line, "metrics %u", &got) == 1 && got == id)
+            break;
+    }
+    fclose(in);
+    return rc;
+}
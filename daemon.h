@@ -0,0 +1,45 @@
+// Long-running flashing service: keeps every port open, remembers which ones are
+// still in the bootloader, caches loaded images and runs jobs submitted over a
+// local (AF_UNIX) socket, one worker and one FIFO queue per port.
+//
+// The protocol is line based, words separated by blanks. Requests:
+//   program <port|*> <image> <addr_hex> <flash_size_hex> <page_size_hex> [options]
+//       -> queued <id> <port>       (* picks the port with the shortest queue)
+//          once the image is loaded, off the request loop: answers to requests
+//          sent after it on the same connection may come first
+//   cancel <id>                     -> ok | error ...   (only jobs not started yet)
+//   status                          -> port <dev> <idle|busy|down> queued=<n> synced=<0|1>
+//                                      done=<n> failed=<n> ..., images cached=<n>, ok
+//   shutdown                        -> ok, then finishes the queued jobs and exits
+// and, for each job, on the connection that submitted it:
+//   event <id> <progress JSON>      (periodic ones rate-limited, dropped if the client lags)
+//   done <id> <ok|fail> <step> <seconds> <bytes sent> <bytes skipped> <error|->
+//   metrics <id> <sbl_metrics_write_json() on one line, {} for a cancelled job>
+// Anything malformed is answered with "error <message>".
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "sbl_multi.h"
+
+typedef struct
+{
+    const char *socket_path;
+    const char *const *ports;
+    size_t n_ports;
+    int baud;
+    unsigned progress_ms; // at most one periodic event per job this often
+    // Fill job->opts / drain / fixed_timeouts / entry (pointing at *entry) from a
+    // request's option words. Returns 0, or -1 if they are malformed.
+    int (*parse_opts)(int argc, char **argv, sbl_multi_job_t *job, sbl_entry_t *entry);
+} daemon_config_t;
+
+// Serve until a shutdown request, SIGINT or SIGTERM. Returns 0, -1 on setup error.
+int daemon_run(const daemon_config_t *cfg);
+
+// Client side: send one request line (argv joined) to the daemon at socket_path
+// and copy the replies to stdout until it is answered: for program, until the
+// job's metrics line. Returns 0 if the request (or job) succeeded, 1 if not,
+// 2 if the daemon could not be reached.
+int daemon_submit(const char *socket_path, int argc, char **argv);
+
+#endif
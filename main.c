@@ -1,8 +1,12 @@
 #define _POSIX_C_SOURCE 200809L
+#include "cc1310sbl.h"
 #include "serial.h"
-#include "sbl.h"
+#include "crc32.h"
+#include "progress.h"
+#include "daemon.h"
 
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,57 +33,558 @@ static void usage(const char *prog)
             "  %s <dev> <baud> rx <timeout_ms>\n"
             "  %s <dev> <baud> sbl_autobaud\n"
             "  %s <dev> <baud> sbl_autobaud_scan\n"
+            "  %s <dev> <baud> sbl_autobaud_probe [max_baud] [--entry-* options]\n"
+            "  %s <dev> <baud> sbl_enter [--entry-* options]\n"
             "  %s <dev> <baud> sbl_ping\n"
             "  %s <dev> <baud> sbl_status\n"
             "  %s <dev> <baud> sbl_chipid\n"
             "  %s <dev> <baud> sbl_reset\n"
             "  %s <dev> <baud> sbl_erase <addr_hex>\n"
-            "  %s <dev> <baud> sbl_full_erase <flash_size_hex> <page_size_hex>\n"
+            "  %s <dev> <baud> sbl_set_ccfg <field_id> <value>\n"
+            "  %s <dev> <baud> sbl_full_erase <flash_size_hex> <page_size_hex> [--bank]\n"
             "  %s <dev> <baud> sbl_send_data <b0> <b1> ... <bn>\n"
-            "  %s <dev> <baud> sbl_crc <addr_hex> <len> <repeat>\n"
-            "  %s <dev> <baud> sbl_program <bin_location> <addr_hex> <flash_size_hex> <page_size_hex>\n",
-            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
+            "  %s <dev> <baud> sbl_crc <addr_hex> <len> <repeat> [image]\n"
+            "  %s <dev> <baud> sbl_dump <addr_hex> <len> <out_file>\n"
+            "  %s <dev> <baud> sbl_program <bin_location> <addr_hex> <flash_size_hex> <page_size_hex> [options]\n"
+            "  %s <dev> <baud> sbl_program_manifest <manifest> <flash_size_hex> <page_size_hex> [options]\n"
+            "  %s <dev,dev,...> <baud> sbl_program_many <bin_location> <addr_hex> <flash_size_hex> <page_size_hex> [options]\n"
+            "  %s <dev> <baud> script <file|-> [--keep-going]\n"
+            "  %s <dev,dev,...> <baud> serve <socket> [--progress-interval <ms>]\n"
+            "  %s <socket> - submit <program|cancel|status|shutdown> [args...]\n"
+            "\n"
+            "script runs one command per line (as it would follow <dev> <baud>, '#' comments)\n"
+            "over a single open port, stopping at the first failure unless --keep-going.\n"
+            "\n"
+            "serve keeps the ports open and runs jobs sent to the socket, one queue per port;\n"
+            "submit sends one request: program <dev|*> <bin_location> <addr_hex>\n"
+            "<flash_size_hex> <page_size_hex> [options], cancel <id>, status or shutdown.\n"
+            "\n"
+            "<bin_location> may be a raw .bin, Intel HEX or ELF file; <addr_hex> only places\n"
+            "raw images, HEX and ELF carry their own addresses. A manifest lists several such\n"
+            "files, one \"<file> [addr_hex]\" per line, to program in one session.\n"
+            "\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog,
+            prog, prog, prog, prog, prog, prog);
+    fputs(
+        "sbl_program / sbl_program_manifest / sbl_program_many options:\n"
+        "  --status-every <n>   GET_STATUS only every n SEND_DATA frames\n"
+        "  --window <n>         SEND_DATA frames in flight before ACKs are read. Above 1 (and\n"
+        "                       --status-every above 1) paces each frame from the ACK of the\n"
+        "                       one before so it reaches the ROM as that frame's flash write\n"
+        "                       ends, within its 32-byte RX FIFO. A transfer that still loses\n"
+        "                       a frame continues lock-step\n"
+        "  --chunk-size <n>     SEND_DATA payload bytes per frame, a multiple of 4 (default 252)\n"
+        "  --no-verify          skip the CRC32 readback of the programmed range (forced\n"
+        "                       back on by --status-every/--window above 1 and --delta)\n"
+        "  --verify-group <n>   CRC-check every n pages as soon as they are written and rewrite\n"
+        "                       just a group that reads back wrong, instead of one final readback\n"
+        "  --erase <mode>       pages (default): erase every page below CCFG\n"
+        "                       smart: CRC each page, erase only non-blank ones\n"
+        "                       bank: one BANK_ERASE (also clears CCFG)\n"
+        "  --delta              only erase and rewrite pages whose CRC differs\n"
+        "  --sparse             don't transmit 0xFF runs of 256 bytes or more\n"
+        "  --sparse-gap <n>     same, with a minimum run of n bytes (multiple of 4)\n"
+        "  --ccfg               erase and write the CCFG page last, then verify it\n"
+        "                       (default: CCFG bytes are programmed without erasing it)\n"
+        "  --no-reset           stay in the bootloader afterwards (e.g. for later script steps)\n"
+        "  --retries <n>        resync and retry a failed command, or resume a broken\n"
+        "                       transfer from the last CRC-confirmed page, n times (default 3)\n"
+        "  --entry              first reset into the ROM bootloader over DTR/RTS and autobaud\n"
+        "  --entry-lines <r>,<b> lines on nRESET and the backdoor pin: dtr, rts or none\n"
+        "                       (default rts,dtr as on XDS110/LaunchPad boards)\n"
+        "  --entry-invert <which> reset, backdoor or both are active with the line released\n"
+        "  --entry-timing <r>,<h>,<s> ms nRESET held, backdoor held after it, settle (5,5,10)\n"
+        "                       any --entry-* option implies --entry\n"
+        "  --drain              wait for the UART to empty after every frame (old behaviour)\n"
+        "  --fixed-timeouts     always wait the worst-case time instead of timeouts learned\n"
+        "                       from the measured round trips\n"
+        "  --timing             log every command with its latency to stderr, then per-phase times\n"
+        "  --quiet              no progress lines (errors and the summary are still printed)\n"
+        "  --progress-json      progress as one JSON object per line\n"
+        "  --progress-interval <ms>  at most one progress line per device this often (default 250)\n"
+        "  --json-metrics <f>   write timing, throughput and latency histograms as JSON (- = stdout)\n"
+        "\n"
+        "Environment:\n"
+        "  CC1310_TRACE=<f>     log every TX/RX buffer with a timestamp to f (- = stderr)\n"
+        "  CC1310_LOW_LATENCY=<ms> set ASYNC_LOW_LATENCY and lower an FTDI adapter's latency\n"
+        "                       timer (16 ms by default) to ms while the port is open; restored on\n"
+        "                       exit and SIGINT/SIGTERM/SIGHUP, not after SIGKILL or a crash\n"
+        "  CC1310_BAUD_CACHE=<f> last working baud per adapter (default ~/.cache/cc1310_flasher.baud)\n",
+        stderr);
 }
 
-unsigned char* load_bin(const char* path, size_t* out_len) {
-    *out_len = 0;
-    FILE* f = fopen(path, "rb");
-    if (!f) return NULL;
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return NULL; }
-    long sz = ftell(f);
-    if (sz < 0) { fclose(f); return NULL; }
-    rewind(f);
+// Load an image for sbl_program*, reporting what was found.
+static int load_image(const char *path, uint32_t bin_addr, sbl_image_t *img)
+{
+    if (sbl_image_load(path, bin_addr, img) != 0)
+    {
+        fprintf(stderr, "Failed to load %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    printf("Loaded %s: %s, %zu segment(s), %zu bytes\n", path, sbl_image_format_name(img->format),
+           img->n_segs, img->total_len);
+    return 0;
+}
 
-    unsigned char* buf = (unsigned char*)malloc((size_t)sz);
-    if (!buf) { fclose(f); return NULL; }
+// Host CRC32 of [addr, addr + len) as the device would read it after flashing img:
+// image bytes where a segment covers the address, erased flash (0xFF) elsewhere.
+static uint32_t image_range_crc(const sbl_image_t *img, uint32_t addr, uint32_t len, uint32_t repeat)
+{
+    uint8_t ff[256];
+    memset(ff, 0xFF, sizeof(ff));
+
+    uint32_t crc = 0;
+    uint64_t pos = addr, end = (uint64_t)addr + len;
+    for (size_t i = 0; i < img->n_segs && pos < end; ++i)
+    {
+        const sbl_segment_t *seg = &img->segs[i];
+        uint64_t seg_end = (uint64_t)seg->addr + seg->len;
+        if (seg_end <= pos)
+            continue;
+        // Gap before this segment
+        uint64_t gap_end = seg->addr < end ? seg->addr : end;
+        while (pos < gap_end)
+        {
+            size_t n = gap_end - pos < sizeof(ff) ? (size_t)(gap_end - pos) : sizeof(ff);
+            crc = sbl_crc32_rom(crc, ff, n, repeat);
+            pos += n;
+        }
+        if (pos >= end)
+            break;
+        uint64_t take_end = seg_end < end ? seg_end : end;
+        crc = sbl_crc32_rom(crc, seg->data + (pos - seg->addr), (size_t)(take_end - pos), repeat);
+        pos = take_end;
+    }
+    while (pos < end)
+    {
+        size_t n = end - pos < sizeof(ff) ? (size_t)(end - pos) : sizeof(ff);
+        crc = sbl_crc32_rom(crc, ff, n, repeat);
+        pos += n;
+    }
+    return crc;
+}
 
-    size_t n = fread(buf, 1, (size_t)sz, f);
-    fclose(f);
-    if (n != (size_t)sz) { free(buf); return NULL; }
+static FILE *open_metrics_file(const char *path)
+{
+    if (strcmp(path, "-") == 0)
+        return stdout;
+    FILE *f = fopen(path, "w");
+    if (!f)
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+    return f;
+}
 
-    *out_len = n;
-    return buf;
+// One line of per-phase times and rates after a --timing run
+static void print_timing(int fd, const sbl_metrics_t *m, const sbl_program_stats_t *stats)
+{
+    double total = (double)(m->end_us - m->start_us) / 1e6;
+    printf("Timing: %.3f s total (plan %.3f, erase %.3f, program %.3f, verify %.3f), %u commands\n", total,
+           (double)m->phase_us[SBL_PHASE_PLAN] / 1e6, (double)m->phase_us[SBL_PHASE_ERASE] / 1e6,
+           (double)m->phase_us[SBL_PHASE_PROGRAM] / 1e6, (double)m->phase_us[SBL_PHASE_VERIFY] / 1e6,
+           m->commands);
+    if (total > 0)
+        printf("Throughput: %.0f B/s payload, %.0f B/s on the wire; ACK p50 %llu us p99 %llu us\n",
+               (double)stats->bytes_sent / total, (double)m->wire_tx / total,
+               (unsigned long long)sbl_hist_percentile(&m->ack, 50),
+               (unsigned long long)sbl_hist_percentile(&m->ack, 99));
+    static const uint8_t tracked[] = {CMD_GET_STATUS, CMD_SEND_DATA, CMD_DOWNLOAD, CMD_SECTOR_ERASE, CMD_CRC32};
+    printf("Timeouts now:");
+    for (size_t i = 0; i < sizeof(tracked); ++i)
+        printf(" %s %d ms", sbl_cmd_info(tracked[i])->name,
+               sbl_latency_timeout_len(fd, tracked[i], tracked[i] == CMD_SEND_DATA ? 252 : 0, 0));
+    printf("\n");
+    char adapter[160];
+    if (serial_latency_describe(fd, adapter, sizeof(adapter)) > 0)
+        printf("Adapter: %s\n", adapter);
 }
 
-int main(int argc, char **argv)
+// sbl_program / sbl_program_many settings that are not SBL options
+typedef struct
 {
-    if (argc < 4)
+    int drain;             // --drain: a port setting
+    int fixed_timeouts;    // --fixed-timeouts: likewise
+    const char *json_path; // --json-metrics: summary file, "-" for stdout
+    int timing;            // --timing: per-command log on stderr plus a phase summary
+    int entry;             // --entry*: DTR/RTS bootloader entry + autobaud first
+    sbl_entry_t entry_cfg;
+    progress_mode_t progress; // --quiet / --progress-json
+    unsigned progress_ms;     // --progress-interval
+} cli_program_t;
+
+static int parse_line(const char *s, size_t len, sbl_line_t *line)
+{
+    if (len == 3 && strncmp(s, "dtr", 3) == 0)
+        *line = SBL_LINE_DTR;
+    else if (len == 3 && strncmp(s, "rts", 3) == 0)
+        *line = SBL_LINE_RTS;
+    else if (len == 4 && strncmp(s, "none", 4) == 0)
+        *line = SBL_LINE_NONE;
+    else
+        return -1;
+    return 0;
+}
+
+// --entry, --entry-lines <reset>,<backdoor>, --entry-invert <reset|backdoor|both>,
+// --entry-timing <reset_ms>,<hold_ms>,<settle_ms>. Returns 1 if argv[*i] was one
+// (advancing *i past its value), 0 if not, -1 if it was malformed.
+static int parse_entry_opt(int argc, char **argv, int *i, sbl_entry_t *e)
+{
+    const char *opt = argv[*i];
+    if (strcmp(opt, "--entry") == 0)
+        return 1;
+    if (strncmp(opt, "--entry-", 8) != 0 || *i + 1 >= argc)
+        return 0;
+    const char *val = argv[++*i];
+    if (strcmp(opt, "--entry-lines") == 0)
+    {
+        const char *comma = strchr(val, ',');
+        if (!comma || parse_line(val, (size_t)(comma - val), &e->reset_line) != 0 ||
+            parse_line(comma + 1, strlen(comma + 1), &e->backdoor_line) != 0)
+            return -1;
+    }
+    else if (strcmp(opt, "--entry-invert") == 0)
+    {
+        int both = strcmp(val, "both") == 0;
+        if (!both && strcmp(val, "reset") != 0 && strcmp(val, "backdoor") != 0)
+            return -1;
+        e->reset_invert = both || strcmp(val, "reset") == 0;
+        e->backdoor_invert = both || strcmp(val, "backdoor") == 0;
+    }
+    else if (strcmp(opt, "--entry-timing") == 0)
+    {
+        if (sscanf(val, "%d,%d,%d", &e->reset_ms, &e->hold_ms, &e->settle_ms) != 3)
+            return -1;
+    }
+    else
+    {
+        --*i;
+        return 0;
+    }
+    return 1;
+}
+
+// Parse sbl_program / sbl_program_many options from argv[first..].
+static int parse_program_opts(int argc, char **argv, int first, sbl_program_opts_t *opts, cli_program_t *cli)
+{
+    sbl_program_opts_init(opts);
+    memset(cli, 0, sizeof(*cli));
+    sbl_entry_init(&cli->entry_cfg);
+    cli->progress_ms = 250;
+    for (int i = first; i < argc; ++i)
+    {
+        int e = parse_entry_opt(argc, argv, &i, &cli->entry_cfg);
+        if (e < 0)
+        {
+            fprintf(stderr, "Bad value for %s\n", argv[i - 1]);
+            return -1;
+        }
+        if (e > 0)
+            cli->entry = 1;
+        else if (strcmp(argv[i], "--drain") == 0)
+            cli->drain = 1;
+        else if (strcmp(argv[i], "--fixed-timeouts") == 0)
+            cli->fixed_timeouts = 1;
+        else if (strcmp(argv[i], "--json-metrics") == 0 && i + 1 < argc)
+            cli->json_path = argv[++i];
+        else if (strcmp(argv[i], "--timing") == 0)
+            cli->timing = 1;
+        else if (strcmp(argv[i], "--quiet") == 0)
+            cli->progress = PROGRESS_NONE;
+        else if (strcmp(argv[i], "--progress-json") == 0)
+            cli->progress = PROGRESS_JSON;
+        else if (strcmp(argv[i], "--progress-interval") == 0 && i + 1 < argc)
+            cli->progress_ms = (unsigned)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--status-every") == 0 && i + 1 < argc)
+            opts->status_interval = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+            opts->window = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--chunk-size") == 0 && i + 1 < argc)
+            opts->chunk_size = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--verify-group") == 0 && i + 1 < argc)
+            opts->verify_group = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--verify") == 0)
+            opts->verify = 1;
+        else if (strcmp(argv[i], "--no-verify") == 0)
+            opts->verify = 0;
+        else if (strcmp(argv[i], "--delta") == 0)
+            opts->delta = 1;
+        else if (strcmp(argv[i], "--ccfg") == 0)
+            opts->ccfg = 1;
+        else if (strcmp(argv[i], "--no-reset") == 0)
+            opts->no_reset = 1;
+        else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc)
+            opts->retries = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--sparse") == 0)
+            opts->sparse_gap = 256;
+        else if (strcmp(argv[i], "--sparse-gap") == 0 && i + 1 < argc)
+            opts->sparse_gap = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--erase") == 0 && i + 1 < argc)
+        {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "pages") == 0)
+                opts->erase = SBL_ERASE_PAGES;
+            else if (strcmp(mode, "smart") == 0)
+                opts->erase = SBL_ERASE_SMART;
+            else if (strcmp(mode, "bank") == 0)
+                opts->erase = SBL_ERASE_BANK;
+            else
+            {
+                fprintf(stderr, "Unknown erase mode: %s\n", mode);
+                return -1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// sbl_program_many: <dev> is a comma-separated list of ports, all flashed at once
+static int run_program_many(const char *dev_list, int baud, int argc, char **argv)
+{
+    if (argc < 8)
     {
         usage(argv[0]);
         return 1;
     }
 
-    const char *dev = argv[1];
-    int baud = atoi(argv[2]);
-    const char *cmd = argv[3];
+    sbl_multi_job_t job;
+    cli_program_t cli;
+    memset(&job, 0, sizeof(job));
+    if (parse_program_opts(argc, argv, 8, &job.opts, &cli) != 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    job.drain = cli.drain;
+    job.fixed_timeouts = cli.fixed_timeouts;
+    job.entry = cli.entry ? &cli.entry_cfg : NULL;
+    job.progress = progress_multi_cb;
 
-    int fd = serial_open_configure(dev, baud);
-    if (fd < 0)
+    char *list = strdup(dev_list);
+    size_t n_devs = 0;
+    const char *devs[64];
+    for (char *save = NULL, *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
     {
-        fprintf(stderr, "Failed to open %s at %d baud: %s\n", dev, baud, strerror(errno));
-        return 2;
+        if (n_devs == sizeof(devs) / sizeof(devs[0]))
+        {
+            fprintf(stderr, "Too many devices (max %zu)\n", n_devs);
+            free(list);
+            return 1;
+        }
+        devs[n_devs++] = tok;
+    }
+
+    job.baud = baud;
+    job.base_addr = (uint32_t)strtoul(argv[5], NULL, 0);
+    job.flash_size = (uint32_t)strtoul(argv[6], NULL, 0);
+    job.page_size = (uint32_t)strtoul(argv[7], NULL, 0);
+
+    // Parsed once; every worker reads the same segments
+    sbl_image_t image;
+    if (load_image(argv[4], job.base_addr, &image) != 0)
+    {
+        free(list);
+        return 1;
+    }
+    job.segs = image.segs;
+    job.n_segs = image.n_segs;
+
+    // Worked out once for every device
+    sbl_image_meta_t meta;
+    if (sbl_image_meta_build(image.segs, image.n_segs, job.page_size, &meta) == 0)
+        job.opts.meta = &meta;
+    else
+        fprintf(stderr, "Image page map unavailable: %s\n", strerror(errno));
+
+    sbl_job_result_t results[64];
+    if (progress_begin(cli.progress, cli.progress_ms) != 0)
+        fprintf(stderr, "Progress reporting unavailable: %s\n", strerror(errno));
+    int failed = sbl_program_many(devs, n_devs, &job, results);
+    progress_end();
+    if (failed < 0)
+    {
+        fprintf(stderr, "sbl_program_many failed: %s\n", strerror(errno));
+        if (job.opts.meta)
+            sbl_image_meta_free(&meta);
+        sbl_image_free(&image);
+        free(list);
+        return 1;
+    }
+
+    printf("\n%-24s %-6s %-9s %8s %9s %8s  %s\n", "DEVICE", "RESULT", "STEP", "TIME(s)", "SENT", "SKIPPED", "ERROR");
+    for (size_t i = 0; i < n_devs; ++i)
+    {
+        const sbl_job_result_t *r = &results[i];
+        printf("%-24s %-6s %-9s %8.2f %9zu %8zu  %s\n", r->dev, r->rc == 0 ? "OK" : "FAIL",
+               sbl_job_step_name(r->step), r->seconds, r->stats.bytes_sent, r->stats.bytes_skipped,
+               r->rc == 0 ? "" : strerror(r->err));
     }
 
+    if (cli.json_path)
+    {
+        FILE *out = open_metrics_file(cli.json_path);
+        if (out)
+        {
+            fprintf(out, "[\n");
+            for (size_t i = 0; i < n_devs; ++i)
+            {
+                fprintf(out, "%s{\"device\": \"%s\", \"metrics\":\n", i ? ",\n" : "", results[i].dev);
+                sbl_metrics_write_json(out, &results[i].metrics, &results[i].stats, results[i].rc);
+                fprintf(out, "}");
+            }
+            fprintf(out, "\n]\n");
+            if (out != stdout)
+                fclose(out);
+        }
+    }
+
+    if (job.opts.meta)
+        sbl_image_meta_free(&meta);
+    sbl_image_free(&image);
+    free(list);
+    return failed == 0 ? 0 : 1;
+}
+
+// daemon_config_t.parse_opts: a program request's options, as sbl_program_many takes them
+static int parse_daemon_opts(int argc, char **argv, sbl_multi_job_t *job, sbl_entry_t *entry)
+{
+    cli_program_t cli;
+    if (parse_program_opts(argc, argv, 0, &job->opts, &cli) != 0)
+        return -1;
+    job->drain = cli.drain;
+    job->fixed_timeouts = cli.fixed_timeouts;
+    *entry = cli.entry_cfg;
+    job->entry = cli.entry ? entry : NULL;
+    return 0;
+}
+
+// serve: <dev> is a comma-separated list of ports kept open for the daemon's jobs
+static int run_serve(const char *dev_list, int baud, int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    daemon_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.socket_path = argv[4];
+    cfg.baud = baud;
+    cfg.progress_ms = 250;
+    cfg.parse_opts = parse_daemon_opts;
+    for (int i = 5; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--progress-interval") == 0 && i + 1 < argc)
+            cfg.progress_ms = (unsigned)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    char *list = strdup(dev_list);
+    const char *devs[64];
+    for (char *save = NULL, *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        if (cfg.n_ports == sizeof(devs) / sizeof(devs[0]))
+        {
+            fprintf(stderr, "Too many devices (max %zu)\n", cfg.n_ports);
+            free(list);
+            return 1;
+        }
+        devs[cfg.n_ports++] = tok;
+    }
+    cfg.ports = devs;
+
+    int rc = daemon_run(&cfg);
+    if (rc != 0)
+        fprintf(stderr, "serve on %s failed: %s\n", cfg.socket_path, strerror(errno));
+    free(list);
+    return rc == 0 ? 0 : 1;
+}
+
+// DTR/RTS entry followed by autobaud, reporting what failed
+static int enter_bootloader(int fd, const sbl_entry_t *e)
+{
+    if (sbl_enter_bootloader(fd, e) != 0)
+    {
+        fprintf(stderr, "Bootloader entry over DTR/RTS failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (sbl_autobaud(fd, 500) != 0)
+    {
+        fprintf(stderr, "Auto-baud after bootloader entry failed.\n");
+        return -1;
+    }
+    printf("Bootloader entered (ACK 0xCC).\n");
+    return 0;
+}
+
+// sbl_program / sbl_program_manifest: program segs with the parsed options and report.
+// Returns the exit code.
+static int program_cli(cc1310sbl_t *ctx, uint32_t flash_size, uint32_t page_size, const sbl_segment_t *segs,
+                       size_t n_segs, sbl_program_opts_t *opts, const cli_program_t *cli)
+{
+    int fd = cc1310sbl_fd(ctx);
+    sbl_latency_set_fixed(fd, cli->fixed_timeouts);
+    if (cli->entry && enter_bootloader(fd, &cli->entry_cfg) != 0)
+        return 1;
+
+    sbl_program_stats_t stats;
+    sbl_metrics_t metrics;
+    opts->stats = &stats;
+    opts->metrics = &metrics;
+    metrics.log = cli->timing ? stderr : NULL;
+    if (cli->json_path && !(opts->metrics_json = open_metrics_file(cli->json_path)))
+        return 1;
+
+    if (progress_begin(cli->progress, cli->progress_ms) != 0)
+        fprintf(stderr, "Progress reporting unavailable: %s\n", strerror(errno));
+    opts->progress = progress_sbl_cb;
+    opts->progress_user = NULL;
+
+    // Page CRCs and blank map, worked out once for planning, erase and resume
+    sbl_image_meta_t meta;
+    if (sbl_image_meta_build(segs, n_segs, page_size, &meta) == 0)
+        opts->meta = &meta;
+    else
+        fprintf(stderr, "Image page map unavailable: %s\n", strerror(errno));
+
+    int rc = 0;
+    if (cc1310sbl_program(ctx, flash_size, page_size, segs, n_segs, opts) != 0)
+        rc = 1;
+    progress_end();
+    if (opts->meta)
+    {
+        if (cli->timing)
+            fprintf(stderr, "Image page map: %u page(s)\n", meta.n_pages);
+        sbl_image_meta_free(&meta);
+        opts->meta = NULL;
+    }
+    if (rc == 0)
+        printf("Programmed %zu bytes in %u download(s), %zu blank bytes skipped, %u page(s) erased, "
+               "%u retr%s\n", stats.bytes_sent, stats.downloads, stats.bytes_skipped, stats.pages_erased,
+               stats.retries, stats.retries == 1 ? "y" : "ies");
+    if (cli->timing)
+        print_timing(fd, &metrics, &stats);
+    if (opts->metrics_json && opts->metrics_json != stdout)
+        fclose(opts->metrics_json);
+    return rc;
+}
+
+// Run one single-port command on an open port: argv is laid out as on the
+// command line (<prog> <dev> <baud> <cmd> <args...>). Returns the exit code.
+static int run_command(cc1310sbl_t *ctx, int argc, char **argv)
+{
+    int fd = cc1310sbl_fd(ctx); // raw bytes and single frames go straight to the port
+    const char *dev = argv[1];
+    const char *cmd = argv[3];
     int rc = 0;
 
     if (strcmp(cmd, "txbyte") == 0)
@@ -197,7 +702,7 @@ int main(int argc, char **argv)
         // Common bauds for CC13xx/CC26xx ROM
         const int try_bauds[] = {115200, 921600, 460800, 230400, 57600, 38400, 19200, 9600};
         int found = 0;
-        if (sbl_autobaud_scan(dev, try_bauds, sizeof(try_bauds) / sizeof(try_bauds[0]), 500, &found) != 0)
+        if (sbl_autobaud_scan_fd(fd, dev, try_bauds, sizeof(try_bauds) / sizeof(try_bauds[0]), 500, &found) != 0)
         {
             fprintf(stderr, "Auto-baud scan failed (no ACK at tested bauds).\n");
             rc = 1;
@@ -205,6 +710,59 @@ int main(int argc, char **argv)
         }
         printf("Auto-baud OK at %d (ACK 0xCC).\n", found);
     }
+    else if (strcmp(cmd, "sbl_autobaud_probe") == 0)
+    {
+        // Above 921600 needs termios2/IOSSIOSPEED and an adapter that can do it
+        const int probe_bauds[] = {3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400, 115200};
+        int max_baud = 0;
+        int use_entry = 0;
+        sbl_entry_t entry;
+        sbl_entry_init(&entry);
+        for (int i = 4; i < argc; ++i)
+        {
+            int e = parse_entry_opt(argc, argv, &i, &entry);
+            if (e == 1)
+                use_entry = 1;
+            else if (e == 0 && i == 4)
+                max_baud = atoi(argv[i]);
+            else
+            {
+                usage(argv[0]);
+                rc = 1;
+                goto done;
+            }
+        }
+        int cand[sizeof(probe_bauds) / sizeof(probe_bauds[0])];
+        size_t n = 0;
+        for (size_t i = 0; i < sizeof(probe_bauds) / sizeof(probe_bauds[0]); ++i)
+            if (max_baud <= 0 || probe_bauds[i] <= max_baud)
+                cand[n++] = probe_bauds[i];
+
+        int found = 0;
+        if (n == 0 || sbl_autobaud_probe(fd, cand, n, use_entry ? &entry : NULL, 500, &found) != 0)
+        {
+            fprintf(stderr, "Baud probe failed.\n");
+            rc = 1;
+            goto done;
+        }
+        printf("Highest clean baud: %d\n", found);
+    }
+    else if (strcmp(cmd, "sbl_enter") == 0)
+    {
+        sbl_entry_t entry;
+        sbl_entry_init(&entry);
+        for (int i = 4; i < argc; ++i)
+        {
+            if (parse_entry_opt(argc, argv, &i, &entry) != 1)
+            {
+                usage(argv[0]);
+                rc = 1;
+                goto done;
+            }
+        }
+        if (enter_bootloader(fd, &entry) != 0)
+            rc = 1;
+    }
     else if (strcmp(cmd, "sbl_ping") == 0)
     {
         if (sbl_ping(fd, 500) != 0)
@@ -229,7 +787,7 @@ int main(int argc, char **argv)
     else if (strcmp(cmd, "sbl_chipid") == 0)
     {
         uint32_t id = 0;
-        if (sbl_get_chip_id(fd, 500, &id) != 0)
+        if (cc1310sbl_chip_id(ctx, &id) != 0)
         {
             fprintf(stderr, "GET_CHIP_ID failed.\n");
             rc = 1;
@@ -239,7 +797,7 @@ int main(int argc, char **argv)
     }
     else if (strcmp(cmd, "sbl_reset") == 0)
     {
-        if (sbl_reset(fd, 500) != 0)
+        if (cc1310sbl_reset(ctx) != 0)
         {
             fprintf(stderr, "RESET failed.\n");
             rc = 1;
@@ -275,36 +833,52 @@ int main(int argc, char **argv)
             printf("Download command returned an error: 0x%02X\n", status);
         }
     }
-    else if (strcmp(cmd, "sbl_erase") == 0)
+    else if (strcmp(cmd, "sbl_set_ccfg") == 0)
     {
-        if (argc != 5)
+        if (argc != 6)
         {
             usage(argv[0]);
             rc = 1;
             goto done;
         }
-        uint32_t addr = (uint32_t)strtoul(argv[4], NULL, 0);
-        if (sbl_sector_erase(fd, addr, 2000) != 0)
+        uint32_t field = (uint32_t)strtoul(argv[4], NULL, 0);
+        uint32_t value = (uint32_t)strtoul(argv[5], NULL, 0);
+        uint8_t status = 0;
+        if (sbl_set_ccfg(fd, field, value, 0) != 0 || sbl_get_status(fd, 0, &status) != 0)
         {
-            fprintf(stderr, "SECTOR_ERASE failed\n");
+            fprintf(stderr, "SET_CCFG failed\n");
             rc = 1;
             goto done;
         }
-
-        uint8_t status;
-        sbl_get_status(fd, 500, &status);
-        if(status == 0x40)
+        if (status != COMMAND_RET_SUCCESS)
         {
-            printf("Erase OK at 0x%08X\n", addr);
+            fprintf(stderr, "SET_CCFG field %u returned an error: 0x%02X\n", field, status);
+            rc = 1;
+            goto done;
         }
-        else
+        printf("CCFG field %u set to 0x%08X\n", field, value);
+    }
+    else if (strcmp(cmd, "sbl_erase") == 0)
+    {
+        if (argc != 5)
+        {
+            usage(argv[0]);
+            rc = 1;
+            goto done;
+        }
+        // One SECTOR_ERASE and its GET_STATUS: the ROM erases the sector holding addr
+        uint32_t addr = (uint32_t)strtoul(argv[4], NULL, 0);
+        if (cc1310sbl_erase(ctx, addr, 1, 1) != 0)
         {
-            printf("Erase command returned an error: 0x%02X\n", status);
+            fprintf(stderr, "SECTOR_ERASE failed at 0x%08X: %s\n", addr, strerror(errno));
+            rc = 1;
+            goto done;
         }
+        printf("Erase OK at 0x%08X\n", addr);
     }
     else if (strcmp(cmd, "sbl_full_erase") == 0)
     {
-        if (argc != 6)
+        if (argc != 6 && argc != 7)
         {
             usage(argv[0]);
             rc = 1;
@@ -313,28 +887,37 @@ int main(int argc, char **argv)
         uint32_t flash_size = (uint32_t)strtoul(argv[4], NULL, 0);
         uint32_t page_size = (uint32_t)strtoul(argv[5], NULL, 0);
 
-        uint32_t last_page_start = flash_size - page_size; // CCFG page
-        for (uint32_t a = 0; a < last_page_start; a += page_size)
+        if (argc == 7 && strcmp(argv[6], "--bank") == 0)
         {
-            if (sbl_sector_erase(fd, a, 2000) != 0)
+            // BANK_ERASE takes the CCFG page along with everything else
+            if (sbl_bank_erase(fd, 10000) != 0)
             {
-                fprintf(stderr, "Erase failed at 0x%08X\n", a);
+                fprintf(stderr, "BANK_ERASE failed\n");
                 rc = 1;
                 goto done;
             }
-
-            uint8_t status;
-            sbl_get_status(fd, 500, &status);
-            if(status == 0x40)
+            uint8_t status = 0;
+            if (sbl_get_status(fd, 500, &status) != 0)
             {
-                printf("Erase OK at 0x%08X\n", a);
+                fprintf(stderr, "GET_STATUS after BANK_ERASE failed: %s\n", strerror(errno));
+                rc = 1;
+                goto done;
             }
-            else
+            if (status != COMMAND_RET_SUCCESS)
             {
-                fprintf(stderr, "Erase failed at 0x%08X with error: 0x%02X\n", a, status);
+                fprintf(stderr, "Bank erase failed with error: 0x%02X\n", status);
                 rc = 1;
                 goto done;
             }
+            printf("Bank erase done (CCFG included)\n");
+            goto done;
+        }
+
+        uint32_t last_page_start = flash_size - page_size; // CCFG page
+        if (cc1310sbl_erase(ctx, 0, last_page_start, page_size) != 0)
+        {
+            rc = 1;
+            goto done;
         }
         printf("Full erase done up to (but not including) CCFG at 0x%08X\n", last_page_start);
     }
@@ -378,7 +961,7 @@ int main(int argc, char **argv)
     }
     else if(strcmp(cmd, "sbl_crc") == 0)
     {
-        if(argc != 7){
+        if(argc != 7 && argc != 8){
             usage(argv[0]);
             rc = 1;
             goto done;
@@ -388,44 +971,149 @@ int main(int argc, char **argv)
         uint32_t len = (uint32_t)strtoul(argv[5], NULL, 0);
         uint32_t repeat = (uint32_t)strtoul(argv[6], NULL, 0);
         uint32_t crc_out = 0;
+        uint8_t status = 0;
+
+        // CRC32 only reads flash, so a garbled exchange is simply asked again
+        for (int attempt = 0;; ++attempt)
+        {
+            int ok = 0;
+            if(cc1310sbl_crc32(ctx, address, len, repeat, &crc_out) != 0)
+                fprintf(stderr, "GETTING CRC FAILED\n");
+            else if(sbl_get_status(fd, 500, &status) != 0 || status != COMMAND_RET_SUCCESS)
+                fprintf(stderr, "Sending failed at 0x%08X with error: 0x%02X\n", address, status);
+            else
+                ok = 1;
+            if (ok)
+                break;
+            if (attempt == 3 || sbl_resync(fd, 1000) != 0)
+            {
+                rc = 1;
+                goto done;
+            }
+            fprintf(stderr, "Retrying CRC32 (%d of 3)\n", attempt + 1);
+        }
+        printf("Sending OK at 0x%08X\n", address);
+        printf("CRC OK. Received CRC: 0x%08X\n", crc_out);
 
-        if(sbl_crc32(fd, address, len, repeat, 5000, &crc_out) != 0){
-            fprintf(stderr, "GETTING CRC FAILED\n");
+        if (argc == 8)
+        {
+            sbl_image_t image;
+            if (load_image(argv[7], address, &image) != 0)
+            {
+                rc = 1;
+                goto done;
+            }
+            uint32_t host = image_range_crc(&image, address, len, repeat);
+            sbl_image_free(&image);
+            printf("Host CRC:  0x%08X (%s)\n", host, host == crc_out ? "match" : "MISMATCH");
+            if (host != crc_out)
+                rc = 1;
+        }
+    }
+    else if (strcmp(cmd, "sbl_dump") == 0)
+    {
+        if (argc != 7)
+        {
+            usage(argv[0]);
             rc = 1;
             goto done;
         }
+        uint32_t address = (uint32_t)strtoul(argv[4], NULL, 0);
+        size_t len = (size_t)strtoul(argv[5], NULL, 0);
+        uint8_t *buf = (uint8_t *)malloc(len ? len : 1);
+        if (!buf)
+        {
+            perror("malloc");
+            rc = 4;
+            goto done;
+        }
 
-        uint8_t status;
-        sbl_get_status(fd, 500, &status);
-        if(status == 0x40)
+        uint64_t t0 = serial_now_us();
+        if (cc1310sbl_read(ctx, address, buf, len) != 0)
         {
-            printf("Sending OK at 0x%08X\n", address);
+            fprintf(stderr, "MEMORY_READ failed\n");
+            free(buf);
+            rc = 1;
+            goto done;
         }
-        else
+        double secs = (double)(serial_now_us() - t0) / 1e6;
+
+        FILE *out = fopen(argv[6], "wb");
+        if (!out || fwrite(buf, 1, len, out) != len || fclose(out) != 0)
         {
-            //TODO maybe add retry mechanism?
-            fprintf(stderr, "Sending failed at 0x%08X with error: 0x%02X\n", address, status);
+            fprintf(stderr, "Cannot write %s: %s\n", argv[6], strerror(errno));
+            free(buf);
             rc = 1;
             goto done;
         }
-        printf("CRC OK. Received CRC: 0x%08X\n", crc_out);
+        free(buf);
+        printf("Read %zu bytes at 0x%08X into %s in %.3f s (%.0f B/s)\n", len, address, argv[6], secs,
+               secs > 0 ? (double)len / secs : 0.0);
     }
     else if(strcmp(cmd, "sbl_program") == 0)
     {
-        if(argc != 8){
+        if(argc < 8){
             usage(argv[0]);
             rc = 1;
             goto done;
         }
-        
-        size_t len;
-        unsigned char* image = load_bin(argv[4], &len);
+
+        sbl_program_opts_t opts;
+        cli_program_t cli;
+        if (parse_program_opts(argc, argv, 8, &opts, &cli) != 0)
+        {
+            usage(argv[0]);
+            rc = 1;
+            goto done;
+        }
+        serial_set_drain(fd, cli.drain);
 
         uint32_t address = (uint32_t)strtoul(argv[5], NULL, 0);
         uint32_t flash_size = (uint32_t)strtoul(argv[6], NULL, 0);
         uint32_t page_size = (uint32_t)strtoul(argv[7], NULL, 0);
-        
-        sbl_program_binary(fd, flash_size, page_size, image, len, address);
+
+        sbl_image_t image;
+        if (load_image(argv[4], address, &image) != 0)
+        {
+            rc = 1;
+            goto done;
+        }
+        rc = program_cli(ctx, flash_size, page_size, image.segs, image.n_segs, &opts, &cli);
+        sbl_image_free(&image);
+    }
+    else if (strcmp(cmd, "sbl_program_manifest") == 0)
+    {
+        if (argc < 7)
+        {
+            usage(argv[0]);
+            rc = 1;
+            goto done;
+        }
+
+        sbl_program_opts_t opts;
+        cli_program_t cli;
+        if (parse_program_opts(argc, argv, 7, &opts, &cli) != 0)
+        {
+            usage(argv[0]);
+            rc = 1;
+            goto done;
+        }
+        serial_set_drain(fd, cli.drain);
+
+        uint32_t flash_size = (uint32_t)strtoul(argv[5], NULL, 0);
+        uint32_t page_size = (uint32_t)strtoul(argv[6], NULL, 0);
+
+        sbl_manifest_t manifest;
+        if (sbl_manifest_load(argv[4], &manifest) != 0)
+        {
+            fprintf(stderr, "Failed to load %s: %s\n", argv[4], strerror(errno));
+            rc = 1;
+            goto done;
+        }
+        printf("Manifest %s: %zu image(s), %zu segment(s), %zu bytes\n", argv[4], manifest.n_images,
+               manifest.n_segs, manifest.total_len);
+        rc = program_cli(ctx, flash_size, page_size, manifest.segs, manifest.n_segs, &opts, &cli);
+        sbl_manifest_free(&manifest);
     }
     else
     {
@@ -434,6 +1122,179 @@ int main(int argc, char **argv)
     }
 
 done:
-    serial_close(fd);
+    return rc;
+}
+
+#define SCRIPT_MAX_ARGS 300 // sbl_send_data with 252 bytes and then some
+
+// script <file|-> [--keep-going]: one command per line as it would follow
+// "<dev> <baud>" on the command line, '#' starts a comment. Every step shares
+// the open port and the ROM's baud lock, so only the first needs sbl_autobaud.
+static int run_script(cc1310sbl_t *ctx, int argc, char **argv)
+{
+    if (argc != 5 && !(argc == 6 && strcmp(argv[5], "--keep-going") == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    int keep_going = argc == 6;
+    FILE *in = strcmp(argv[4], "-") == 0 ? stdin : fopen(argv[4], "r");
+    if (!in)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", argv[4], strerror(errno));
+        return 1;
+    }
+
+    char line[4096];
+    char *args[SCRIPT_MAX_ARGS];
+    args[0] = argv[0];
+    args[1] = argv[1];
+    args[2] = argv[2];
+
+    int rc = 0;
+    unsigned steps = 0, failed = 0, line_no = 0;
+    uint64_t t_script = serial_now_us();
+    while (fgets(line, sizeof(line), in))
+    {
+        ++line_no;
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+
+        int n = 3;
+        char *save = NULL;
+        for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save))
+        {
+            if (n == SCRIPT_MAX_ARGS - 1)
+            {
+                fprintf(stderr, "Line %u: too many arguments\n", line_no);
+                n = -1;
+                break;
+            }
+            args[n++] = tok;
+        }
+        if (n == 3)
+            continue;
+
+        int step_rc;
+        uint64_t t0 = serial_now_us();
+        ++steps;
+        if (n < 0)
+            step_rc = 1;
+        else if (strcmp(args[3], "script") == 0 || strcmp(args[3], "sbl_program_many") == 0)
+        {
+            fprintf(stderr, "Line %u: %s is not available in a script\n", line_no, args[3]);
+            step_rc = 1;
+        }
+        else
+        {
+            args[n] = NULL;
+            serial_set_drain(cc1310sbl_fd(ctx), 0); // --drain only lasts for the step that asked for it
+            step_rc = run_command(ctx, n, args);
+        }
+        fflush(stdout);
+        fprintf(stderr, "[%u] line %u %s: %s (%.1f ms)\n", steps, line_no, n > 3 ? args[3] : "?",
+                step_rc == 0 ? "OK" : "FAILED", (double)(serial_now_us() - t0) / 1e3);
+        if (step_rc != 0)
+        {
+            ++failed;
+            if (rc == 0)
+                rc = step_rc;
+            if (!keep_going)
+                break;
+        }
+    }
+    if (in != stdin)
+        fclose(in);
+
+    printf("Script: %u step(s), %u failed, %.3f s\n", steps, failed, (double)(serial_now_us() - t_script) / 1e6);
+    return rc;
+}
+
+// Ctrl-C or a kill must not leave an FTDI adapter at the lowered latency
+// timer: put it back, then die of the signal as before (serve installs its own
+// handlers, which close the ports on the way out)
+static void restore_on_signal(int sig)
+{
+    serial_restore_all();
+    raise(sig); // SA_RESETHAND: the default action this time
+}
+
+static void restore_at_exit(void)
+{
+    serial_restore_all();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *dev = argv[1];
+    int baud = atoi(argv[2]);
+    const char *cmd = argv[3];
+
+    // CC1310_TRACE=<file|-> logs every byte on the wire with a timestamp
+    const char *trace = getenv("CC1310_TRACE");
+    if (trace && *trace && serial_trace_open(trace) != 0)
+        fprintf(stderr, "Cannot open trace %s: %s\n", trace, strerror(errno));
+    // CC1310_LOW_LATENCY=<ms> tunes every port opened below (and by serve / many)
+    const char *low_latency = getenv("CC1310_LOW_LATENCY");
+    if (low_latency && *low_latency && strcmp(low_latency, "off") != 0)
+    {
+        serial_set_low_latency(1, atoi(low_latency));
+        atexit(restore_at_exit);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = restore_on_signal;
+        sa.sa_flags = SA_RESETHAND;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        sigaction(SIGHUP, &sa, NULL);
+    }
+
+    if (strcmp(cmd, "sbl_program_many") == 0)
+    {
+        int many_rc = run_program_many(dev, baud, argc, argv);
+        serial_trace_close();
+        return many_rc;
+    }
+
+    if (strcmp(cmd, "serve") == 0)
+    {
+        int serve_rc = run_serve(dev, baud, argc, argv);
+        serial_trace_close();
+        return serve_rc;
+    }
+
+    // <dev> is the daemon's socket here; no port is opened
+    if (strcmp(cmd, "submit") == 0)
+    {
+        if (argc < 5)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return daemon_submit(dev, argc - 4, argv + 4);
+    }
+
+    cc1310sbl_t *ctx = cc1310sbl_open(dev, baud);
+    if (!ctx)
+    {
+        fprintf(stderr, "Failed to open %s at %d baud: %s\n", dev, baud, strerror(errno));
+        return 2;
+    }
+
+    int rc;
+    if (strcmp(cmd, "script") == 0)
+        rc = run_script(ctx, argc, argv);
+    else
+        rc = run_command(ctx, argc, argv);
+
+    cc1310sbl_close(ctx);
+    serial_trace_close();
     return rc;
 }
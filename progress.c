@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L
+#include "progress.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define QUEUE_LEN 512
+#define MAX_SOURCES 64
+
+typedef struct
+{
+    const char *dev;
+    sbl_event_t ev;
+} queued_t;
+
+// Coalescing state per device
+typedef struct
+{
+    const char *dev;
+    uint64_t last_ms; // when its last periodic event was queued
+    int held;         // pending is newer than anything queued
+    sbl_event_t pending;
+} source_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER; // printer: work to do
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER; // progress_end(): all written
+static int printer_started;
+static int printing; // the printer is writing an event outside the lock
+static progress_mode_t mode = PROGRESS_NONE;
+static unsigned interval_ms;
+static queued_t queue[QUEUE_LEN];
+static size_t head, count;
+static unsigned dropped;
+static source_t sources[MAX_SOURCES];
+static size_t n_sources;
+
+static int format_text(char *buf, size_t len, const sbl_event_t *ev)
+{
+    switch (ev->type)
+    {
+    case SBL_EV_ERASE_PLAN:
+        return snprintf(buf, len, "Erase plan: %zu of %zu pages need erasing", ev->done, ev->total);
+    case SBL_EV_BANK_ERASED:
+        return snprintf(buf, len, "Bank erased");
+    case SBL_EV_PAGE_ERASED:
+        return snprintf(buf, len, "Erased 0x%08X (%zu of %zu)", ev->addr, ev->done, ev->total);
+    case SBL_EV_PROGRESS:
+        return snprintf(buf, len, "Progress: %u%% (%zu of %zu bytes at 0x%08X)", ev->value, ev->done, ev->total,
+                        ev->addr);
+    case SBL_EV_RESUME:
+        return snprintf(buf, len, "Resuming at 0x%08X", ev->addr);
+    case SBL_EV_SPARSE:
+        return snprintf(buf, len, "Sparse: skipped %zu blank bytes at 0x%08X..0x%08zX", ev->done, ev->addr,
+                        ev->addr + ev->total);
+    case SBL_EV_DELTA:
+        return snprintf(buf, len, "Delta: %zu of %zu pages rewritten in %u run(s)", ev->done, ev->total, ev->value);
+    case SBL_EV_VERIFY_OK:
+        return snprintf(buf, len, "Verify OK at 0x%08X..0x%08zX (CRC32 0x%08X)", ev->addr, ev->addr + ev->total,
+                        ev->value);
+    case SBL_EV_CCFG:
+        if (ev->value)
+            return snprintf(buf, len, "CCFG written at 0x%08X", ev->addr);
+        return snprintf(buf, len, "CCFG unchanged");
+    case SBL_EV_REPROGRAM:
+        return snprintf(buf, len, "Verify failed at 0x%08X..0x%08zX: rewriting it (attempt %zu)", ev->addr,
+                        ev->addr + ev->total, ev->done);
+    default:
+        return snprintf(buf, len, "%s", sbl_event_name(ev->type));
+    }
+}
+
+int progress_format(char *buf, size_t len, progress_mode_t m, const char *dev, const sbl_event_t *ev)
+{
+    if (m == PROGRESS_JSON)
+    {
+        int n = dev ? snprintf(buf, len, "{\"device\": \"%s\", ", dev) : snprintf(buf, len, "{");
+        if (n < 0 || (size_t)n >= len)
+            return n;
+        int k = snprintf(buf + n, len - (size_t)n,
+                         "\"event\": \"%s\", \"addr\": %u, \"done\": %zu, \"total\": %zu, \"value\": %u}",
+                         sbl_event_name(ev->type), ev->addr, ev->done, ev->total, ev->value);
+        return k < 0 ? k : n + k;
+    }
+    int n = dev ? snprintf(buf, len, "%s: ", dev) : 0;
+    if (n < 0 || (size_t)n >= len)
+        return n;
+    int k = format_text(buf + n, len - (size_t)n, ev);
+    return k < 0 ? k : n + k;
+}
+
+static void *printer(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for (;;)
+    {
+        while (count == 0 && dropped == 0)
+            pthread_cond_wait(&wake, &lock);
+
+        queued_t item = {0};
+        unsigned lost = dropped;
+        int have = count > 0;
+        if (have)
+        {
+            item = queue[head];
+            head = (head + 1) % QUEUE_LEN;
+            --count;
+        }
+        dropped = 0;
+        progress_mode_t m = mode;
+        printing = 1;
+        pthread_mutex_unlock(&lock);
+
+        // Only this thread ever waits on stdout
+        if (lost && m == PROGRESS_JSON)
+            printf("{\"event\": \"dropped\", \"value\": %u}\n", lost);
+        else if (lost)
+            printf("(%u progress event(s) dropped)\n", lost);
+        if (have)
+        {
+            char line[256];
+            progress_format(line, sizeof(line), m, item.dev, &item.ev);
+            puts(line);
+        }
+        fflush(stdout);
+
+        pthread_mutex_lock(&lock);
+        printing = 0;
+        if (count == 0 && dropped == 0)
+            pthread_cond_broadcast(&idle);
+    }
+    return NULL;
+}
+
+// With lock held
+static void push(const char *dev, const sbl_event_t *ev)
+{
+    if (count == QUEUE_LEN)
+    {
+        ++dropped;
+        return;
+    }
+    queue[(head + count) % QUEUE_LEN].dev = dev;
+    queue[(head + count) % QUEUE_LEN].ev = *ev;
+    ++count;
+    pthread_cond_signal(&wake);
+}
+
+// With lock held. NULL once every slot is taken: that device is just not coalesced.
+static source_t *source_for(const char *dev)
+{
+    for (size_t i = 0; i < n_sources; ++i)
+    {
+        if (sources[i].dev == dev)
+            return &sources[i];
+    }
+    if (n_sources == MAX_SOURCES)
+        return NULL;
+    source_t *s = &sources[n_sources++];
+    s->dev = dev;
+    s->last_ms = 0;
+    s->held = 0;
+    return s;
+}
+
+int progress_begin(progress_mode_t m, unsigned interval)
+{
+    pthread_mutex_lock(&lock);
+    int rc = 0;
+    if (m != PROGRESS_NONE && !printer_started)
+    {
+        pthread_t t;
+        int err = pthread_create(&t, NULL, printer, NULL);
+        if (err == 0)
+        {
+            pthread_detach(t);
+            printer_started = 1;
+        }
+        else
+        {
+            errno = err;
+            rc = -1;
+        }
+    }
+    mode = rc == 0 ? m : PROGRESS_NONE;
+    interval_ms = interval;
+    n_sources = 0;
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+void progress_event(const char *dev, const sbl_event_t *ev)
+{
+    pthread_mutex_lock(&lock);
+    if (mode == PROGRESS_NONE)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    source_t *s = source_for(dev);
+    int periodic = ev->type == SBL_EV_PROGRESS || ev->type == SBL_EV_PAGE_ERASED;
+    if (s && periodic)
+    {
+        uint64_t now = serial_now_ms();
+        if (ev->done < ev->total && now - s->last_ms < interval_ms)
+        {
+            s->pending = *ev;
+            s->held = 1;
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        s->last_ms = now;
+    }
+    // A held event of another kind still tells where that phase ended; one of the
+    // same kind is superseded by this one
+    if (s && s->held && s->pending.type != ev->type)
+        push(dev, &s->pending);
+    if (s)
+        s->held = 0;
+    push(dev, ev);
+    pthread_mutex_unlock(&lock);
+}
+
+void progress_sbl_cb(const sbl_event_t *ev, void *user)
+{
+    progress_event((const char *)user, ev);
+}
+
+void progress_multi_cb(const char *dev, const sbl_event_t *ev, void *user)
+{
+    (void)user;
+    progress_event(dev, ev);
+}
+
+void progress_end(void)
+{
+    pthread_mutex_lock(&lock);
+    if (mode != PROGRESS_NONE)
+    {
+        for (size_t i = 0; i < n_sources; ++i)
+        {
+            if (sources[i].held)
+                push(sources[i].dev, &sources[i].pending);
+        }
+        while (count > 0 || dropped > 0 || printing)
+            pthread_cond_wait(&idle, &lock);
+    }
+    n_sources = 0;
+    mode = PROGRESS_NONE;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,37 @@
+// Terminal reporting of sbl_event_t for the command line tool. The programming
+// threads only queue events; a printer thread writes them, so a slow or blocked
+// stdout (a full pipe to a line controller) never holds up serial traffic.
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include "sbl.h"
+
+typedef enum
+{
+    PROGRESS_TEXT = 0, // one human-readable line per event
+    PROGRESS_JSON,     // one JSON object per line
+    PROGRESS_NONE      // nothing
+} progress_mode_t;
+
+// Start a reporting session. The periodic events (progress, page_erased) of each
+// device are coalesced to at most one line per interval_ms; the last one of a run
+// and every other event always get through. Returns 0 on success, -1 on error.
+int progress_begin(progress_mode_t mode, unsigned interval_ms);
+
+// Queue ev from dev (NULL for the single-port commands). Safe from any thread and
+// never waits for output: if the queue is full the event is counted as dropped.
+void progress_event(const char *dev, const sbl_event_t *ev);
+
+// Adapters for sbl_program_opts_t.progress (user is the device name or NULL)
+// and sbl_multi_job_t.progress (user unused)
+void progress_sbl_cb(const sbl_event_t *ev, void *user);
+void progress_multi_cb(const char *dev, const sbl_event_t *ev, void *user);
+
+// One event as a line without the newline, prefixed with dev unless NULL;
+// returns what snprintf() does.
+int progress_format(char *buf, size_t len, progress_mode_t mode, const char *dev, const sbl_event_t *ev);
+
+// End the session: returns once everything queued or held back has been written.
+void progress_end(void);
+
+#endif
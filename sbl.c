@@ -1,431 +1,2587 @@
 #define _XOPEN_SOURCE 600
 #include "serial.h"
 #include "sbl.h"
+#include "crc32.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 // --- small I/O helpers ---
-static int read_exact_timeout(int fd, uint8_t *buf, size_t len, int timeout_ms)
+static uint64_t deadline_after(int timeout_ms)
 {
-    size_t got = 0;
-    while (got < len)
-    {
-        ssize_t n = serial_read_timeout(fd, buf + got, len - got, timeout_ms);
-        if (n < 0)
-            return -1;
-        if (n == 0)
-            return 0; // timeout
-        got += (size_t)n;
-    }
-    return 1;
+    return serial_now_ms() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0);
 }
 
-// --- SBL core ---
+// --- instrumentation: one sbl_metrics_t per port while attached ---
 
-// Wait for ACK or NACK, tolerate leading 0x00 or noise.
-// Returns 0 on ACK, -1 on NACK/timeout/error.
-static int sbl_wait_ack(int fd, int timeout_ms)
+#define SBL_MAX_FDS 1024
+static sbl_metrics_t *fd_metrics[SBL_MAX_FDS];
+
+static sbl_metrics_t *metrics_get(int fd)
+{
+    return (fd >= 0 && fd < SBL_MAX_FDS) ? fd_metrics[fd] : NULL;
+}
+
+static void hist_add(sbl_hist_t *h, uint64_t us)
 {
-    const int step_ms = 20; // poll slice
-    int waited = 0;
+    int b = 0;
+    while (b < SBL_HIST_BUCKETS - 1 && (us >> (b + 1)) != 0)
+        ++b;
+    h->bucket[b]++;
+    if (h->count == 0 || us < h->min_us)
+        h->min_us = us;
+    if (us > h->max_us)
+        h->max_us = us;
+    h->count++;
+    h->sum_us += us;
+}
 
-    while (waited < timeout_ms)
+uint64_t sbl_hist_percentile(const sbl_hist_t *h, double p)
+{
+    if (!h || h->count == 0)
+        return 0;
+    uint64_t want = (uint64_t)((double)h->count * p / 100.0 + 0.5);
+    if (want == 0)
+        want = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < SBL_HIST_BUCKETS; ++b)
     {
-        uint8_t b;
-        ssize_t n = serial_read_timeout(fd, &b, 1, step_ms);
-        if (n < 0)
-            return -1; // hard error
-        if (n == 1)
+        seen += h->bucket[b];
+        if (seen >= want)
         {
-            if (b == SBL_ACK)
-                return 0; // 0xCC = ACK
-            if (b == SBL_NACK)
-            {
-                errno = EPROTO;
-                return -1;
-            }
-            // Ignore everything else (0x00 noise etc.)
+            uint64_t top = (2ull << b) - 1;
+            return top < h->max_us ? top : h->max_us;
         }
-        waited += step_ms;
     }
-    errno = ETIMEDOUT;
-    return -1;
+    return h->max_us;
 }
 
-int sbl_autobaud(int fd, int timeout_ms)
+static void phase_end(int fd, sbl_phase_t phase, uint64_t t0_us)
 {
-    uint8_t ub = 0x55;
-    // burst a few 0x55 to help the BL lock
-    for (int i = 0; i < 2; ++i)
-        if (serial_write_byte(fd, ub) != 1)
-            return -1;
+    sbl_metrics_t *m = metrics_get(fd);
+    if (m)
+        m->phase_us[phase] += serial_now_us() - t0_us;
+}
 
-    int elapsed = 0;
-    const int step_ms = 20;
-    uint8_t b = 0;
+// --- Command table ---
 
-    while (elapsed < timeout_ms)
-    {
-        ssize_t n = serial_read_timeout(fd, &b, 1, step_ms);
-        if (n < 0)
-            return -1; // real error
-        if (n == 1)
-        {
-            if (b == 0xCC)
-                return 0; // ACK!
+// Indexed by id - SBL_CMD_FIRST; ids without a row stay zeroed
+#define SBL_CMD_FIRST CMD_PING
+#define SBL_CMD_ROW(name, id, w0, w1, w2, resp, timeout)                              \
+    [id - SBL_CMD_FIRST] = {#name, id, (w0 > 0) + (w1 > 0) + (w2 > 0), {w0, w1, w2}, \
+                            3 + w0 + w1 + w2, resp, timeout},
+static const sbl_cmd_info_t cmd_table[] = {SBL_COMMANDS(SBL_CMD_ROW)};
+#undef SBL_CMD_ROW
 
-            // Many ROMs/ACM stacks spit 0x00 before ACK; ignore it (and any other noise)
-        }
-        elapsed += step_ms;
-    }
-    errno = ETIMEDOUT;
-    return -1;
+const sbl_cmd_info_t *sbl_cmd_info(uint8_t cmd)
+{
+    if (cmd < SBL_CMD_FIRST || cmd - SBL_CMD_FIRST >= (int)(sizeof(cmd_table) / sizeof(cmd_table[0])))
+        return NULL;
+    const sbl_cmd_info_t *c = &cmd_table[cmd - SBL_CMD_FIRST];
+    return c->name ? c : NULL;
 }
 
-int sbl_autobaud_scan(const char *dev_path,
-                      const int *bauds, size_t n_bauds,
-                      int timeout_ms, int *baud_ok)
+static const char *cmd_name(uint8_t cmd)
 {
-    if (!dev_path || !bauds || n_bauds == 0)
+    const sbl_cmd_info_t *c = sbl_cmd_info(cmd);
+    return c ? c->name : "?";
+}
+
+int sbl_cmd_encode(uint8_t *frame, uint8_t cmd, const uint32_t *fields)
+{
+    const sbl_cmd_info_t *c = sbl_cmd_info(cmd);
+    if (!c || cmd == CMD_SEND_DATA || (c->n_fields && !fields))
     {
         errno = EINVAL;
         return -1;
     }
-
-    for (size_t i = 0; i < n_bauds; ++i)
+    // Checksum summed while the fields are packed: no second pass, no copy
+    uint8_t *p = frame + 2;
+    unsigned sum = cmd;
+    *p++ = cmd;
+    for (unsigned f = 0; f < c->n_fields; ++f)
     {
-        int b = bauds[i];
-        int fd = serial_open_configure(dev_path, b);
-        if (fd < 0)
-            continue;
-
-        // small settle
-        usleep(1000 * 10);
-
-        int ok = sbl_autobaud(fd, timeout_ms);
-        serial_close(fd);
-
-        if (ok == 0)
+        for (int shift = 8 * (c->width[f] - 1); shift >= 0; shift -= 8)
         {
-            if (baud_ok)
-                *baud_ok = b;
-            return 0;
+            uint8_t b = (uint8_t)(fields[f] >> shift);
+            sum += b;
+            *p++ = b;
         }
     }
-    return -1;
+    frame[0] = c->frame_len;
+    frame[1] = (uint8_t)sum;
+    return c->frame_len;
 }
 
-static uint8_t checksum_sum(const uint8_t *data, size_t len)
+// --- Adaptive timeouts: round-trip estimate per port, command and size ---
+
+#define SBL_N_CMDS (sizeof(cmd_table) / sizeof(cmd_table[0]))
+#define SBL_RTO_MAX_BACKOFF 6
+// Size classes: fixed-cost commands use class 0, the others the bit length of
+// the bytes they make the ROM handle, so one class spans at most a factor of 2
+// and the margin of sbl_latency_timeout() (>= srtt) still covers its largest.
+#define SBL_RTO_CLASSES 33
+
+typedef struct
 {
-    unsigned sum = 0;
-    for (size_t i = 0; i < len; ++i)
-        sum += data[i];
-    return (uint8_t)(sum & 0xFF);
+    uint32_t n;      // samples so far
+    int64_t srtt_us; // smoothed round trip
+    int64_t rttvar_us;
+    unsigned backoff; // timeouts in a row: the estimate is doubled per step
+} rtt_est_t;
+
+typedef struct
+{
+    int fixed; // sbl_latency_set_fixed()
+    rtt_est_t cmd[SBL_N_CMDS][SBL_RTO_CLASSES];
+} fd_latency_t;
+
+static fd_latency_t *fd_latency[SBL_MAX_FDS];
+
+static fd_latency_t *latency_get(int fd, int create)
+{
+    if (fd < 0 || fd >= SBL_MAX_FDS)
+        return NULL;
+    if (!fd_latency[fd] && create)
+        fd_latency[fd] = (fd_latency_t *)calloc(1, sizeof(fd_latency_t));
+    return fd_latency[fd];
 }
 
-// Send one SBL packet and wait for ACK; if bootloader is sender in response,
-// this function can read the response packet (size+checksum+payload) into out.
-int sbl_send_cmd(int fd, const uint8_t *data, size_t len,
-                 uint8_t *out, size_t out_max, int timeout_ms)
+static unsigned size_class(uint64_t bytes)
 {
-    if (!data || len == 0 || len > 253)
+    unsigned c = 0;
+    while (bytes && c < SBL_RTO_CLASSES - 1)
     {
-        errno = EINVAL;
-        return -1;
+        bytes >>= 1;
+        ++c;
     }
+    return c;
+}
 
-    uint8_t size = (uint8_t)(len + 2); // includes SIZE itself and checksum size
-    uint8_t csum = checksum_sum(data, len);
-
-    // Build frame: [SIZE][CHECKSUM][DATA...]
-    uint8_t frame[2 + 253];
-    frame[0] = size;
-    frame[1] = csum;
-    memcpy(&frame[2], data, len);
+static rtt_est_t *latency_est(int fd, uint8_t cmd, uint64_t bytes, int create)
+{
+    fd_latency_t *l = latency_get(fd, create);
+    if (!l || !sbl_cmd_info(cmd))
+        return NULL;
+    return &l->cmd[cmd - SBL_CMD_FIRST][size_class(bytes)];
+}
 
-    // *** single write — avoids inter-byte gaps on USB CDC/FTDI ***
-    if (serial_write_all(fd, frame, 2 + len) < 0)
-        return -1;
+// One completed (ok) or timed-out exchange of cmd over bytes that took us
+static void latency_sample(int fd, uint8_t cmd, uint64_t bytes, uint64_t us, int ok, int err)
+{
+    rtt_est_t *e = latency_est(fd, cmd, bytes, ok || err == ETIMEDOUT);
+    if (!e)
+        return;
+    if (!ok)
+    {
+        if (err == ETIMEDOUT && e->backoff < SBL_RTO_MAX_BACKOFF)
+            e->backoff++;
+        return;
+    }
+    // Jacobson/Karels, as TCP does it: gains 1/8 and 1/4
+    int64_t s = (int64_t)us;
+    if (e->n++ == 0)
+    {
+        e->srtt_us = s;
+        e->rttvar_us = s / 2;
+    }
+    else
+    {
+        int64_t d = s - e->srtt_us;
+        e->srtt_us += d / 8;
+        e->rttvar_us += ((d < 0 ? -d : d) - e->rttvar_us) / 4;
+    }
+    e->backoff = 0;
+}
 
-    // Read ACK/NACK
-    if (sbl_wait_ack(fd, timeout_ms) != 0)
-        return -1;
+int sbl_latency_timeout(int fd, uint8_t cmd, int ceiling_ms)
+{
+    return sbl_latency_timeout_len(fd, cmd, 0, ceiling_ms);
+}
 
-    // Some commands return nothing else. If caller wants a response, try to read one packet.
-    if (out && out_max)
+int sbl_latency_timeout_len(int fd, uint8_t cmd, uint64_t bytes, int ceiling_ms)
+{
+    if (ceiling_ms <= 0)
     {
-        // Peek for a non-zero size byte within timeout; if timeout, just return success with no data.
-        uint8_t sz = 0;
-        int r = read_exact_timeout(fd, &sz, 1, 50);
-        if (r > 0 && sz != 0)
-        {
-            uint8_t rx_csum = 0;
-            if (read_exact_timeout(fd, &rx_csum, 1, timeout_ms) <= 0)
-                return -1;
-
-            size_t payload_len = (size_t)sz - 2;
-            if (payload_len > out_max)
-            {
-                errno = EMSGSIZE;
-                return -1;
-            }
-            if (read_exact_timeout(fd, out, payload_len, timeout_ms) <= 0)
-                return -1;
+        const sbl_cmd_info_t *c = sbl_cmd_info(cmd);
+        ceiling_ms = c ? c->timeout_ms : 1000;
+    }
+    fd_latency_t *l = latency_get(fd, 0);
+    rtt_est_t *e = latency_est(fd, cmd, bytes, 0);
+    if (!l || l->fixed || !e || e->n < SBL_RTO_SAMPLES || ceiling_ms <= SBL_RTO_MIN_MS)
+        return ceiling_ms;
 
-            // ACK the device’s response frame
-            uint8_t ack[2] = {0x00, SBL_ACK};
-            if (serial_write_all(fd, ack, 2) < 0)
-                return -1;
+    // At least twice the smoothed round trip, so a steady link with no variance
+    // still has headroom
+    int64_t margin = 4 * e->rttvar_us > e->srtt_us ? 4 * e->rttvar_us : e->srtt_us;
+    int64_t rto_ms = ((e->srtt_us + margin) << e->backoff) / 1000 + 1;
+    if (rto_ms < SBL_RTO_MIN_MS)
+        rto_ms = SBL_RTO_MIN_MS;
+    return rto_ms < ceiling_ms ? (int)rto_ms : ceiling_ms;
+}
 
-            if (checksum_sum(out, payload_len) != rx_csum)
-            {
-                errno = EPROTO;
-                return -1;
-            }
-            return (int)payload_len;
-        }
-    }
+void sbl_latency_reset(int fd)
+{
+    fd_latency_t *l = latency_get(fd, 0);
+    if (l)
+        memset(l->cmd, 0, sizeof(l->cmd));
+}
 
-    return 0;
+void sbl_latency_set_fixed(int fd, int fixed)
+{
+    fd_latency_t *l = latency_get(fd, 1);
+    if (l)
+        l->fixed = fixed;
 }
 
-// --- Convenience commands ---
-int sbl_ping(int fd, int timeout_ms)
+// One finished command: t_sent/t_ack are 0 if it never got that far.
+static void metrics_command(int fd, uint8_t cmd, uint64_t t_start, uint64_t t_sent, uint64_t t_ack, int ok)
 {
-    uint8_t cmd = CMD_PING;
-    return sbl_send_cmd(fd, &cmd, 1, NULL, 0, timeout_ms);
+    sbl_metrics_t *m = metrics_get(fd);
+    if (!m)
+        return;
+    uint64_t now = serial_now_us();
+    m->commands++;
+    if (t_sent && t_ack)
+        hist_add(&m->ack, t_ack - t_sent);
+    if (ok && cmd == CMD_GET_STATUS)
+        hist_add(&m->status, now - t_start);
+    if (ok && (cmd == CMD_SECTOR_ERASE || cmd == CMD_BANK_ERASE))
+        hist_add(&m->erase, now - t_start);
+    if (m->log)
+        fprintf(m->log, "%12.3f ms  %-12s %s  ack %8.3f ms  total %8.3f ms\n",
+                (double)(t_start - m->start_us) / 1000.0, cmd_name(cmd), ok ? "ok  " : "FAIL",
+                t_sent && t_ack ? (double)(t_ack - t_sent) / 1000.0 : 0.0, (double)(now - t_start) / 1000.0);
 }
 
-int sbl_get_status(int fd, int timeout_ms, uint8_t *status_out)
+void sbl_metrics_init(sbl_metrics_t *m)
 {
-    uint8_t cmd = CMD_GET_STATUS;
-    uint8_t resp[1];
-    int n = sbl_send_cmd(fd, &cmd, 1, resp, sizeof(resp), timeout_ms);
-    if (n < 0)
-        return -1;
-    if (n == 1 && status_out)
-        *status_out = resp[0];
-    return 0;
+    memset(m, 0, sizeof(*m));
 }
 
-int sbl_get_chip_id(int fd, int timeout_ms, uint32_t *chip_id_out)
+void sbl_metrics_begin(int fd, sbl_metrics_t *m)
 {
-    uint8_t cmd = CMD_GET_CHIP_ID;
-    uint8_t resp[4];
-    int n = sbl_send_cmd(fd, &cmd, 1, resp, sizeof(resp), timeout_ms);
-    if (n < 0)
-        return -1;
-    if (n == 4 && chip_id_out)
+    if (fd < 0 || fd >= SBL_MAX_FDS)
+        return;
+    fd_metrics[fd] = m;
+    if (m)
     {
-        // Little-endian 32-bit
-        *chip_id_out = (uint32_t)resp[0] |
-                       ((uint32_t)resp[1] << 8) |
-                       ((uint32_t)resp[2] << 16) |
-                       ((uint32_t)resp[3] << 24);
+        m->start_us = serial_now_us();
+        serial_get_counters(fd, &m->tx_base, &m->rx_base);
     }
-    return 0;
 }
 
-int sbl_reset(int fd, int timeout_ms)
+void sbl_metrics_end(int fd)
 {
-    uint8_t cmd = CMD_RESET;
-    return sbl_send_cmd(fd, &cmd, 1, NULL, 0, timeout_ms);
+    sbl_metrics_t *m = metrics_get(fd);
+    if (!m)
+        return;
+    uint64_t tx, rx;
+    serial_get_counters(fd, &tx, &rx);
+    m->wire_tx += tx - m->tx_base;
+    m->wire_rx += rx - m->rx_base;
+    m->end_us = serial_now_us();
+    fd_metrics[fd] = NULL;
 }
 
-int sbl_download(int fd, uint32_t addr, uint32_t total_len, int timeout_ms)
+static void json_hist(FILE *out, const char *name, const sbl_hist_t *h, int last)
 {
-    // Command + 4byte address + 4byte length
-    uint8_t msg[1 + 4 + 4];
-    msg[0] = CMD_DOWNLOAD;
-    msg[1] = (uint8_t)(addr >> 24);
-    msg[2] = (uint8_t)(addr >> 16);
-    msg[3] = (uint8_t)(addr >> 8);
-    msg[4] = (uint8_t)(addr);
-    msg[5] = (uint8_t)(total_len >> 24);
-    msg[6] = (uint8_t)(total_len >> 16);
-    msg[7] = (uint8_t)(total_len >> 8);
-    msg[8] = (uint8_t)(total_len);
-    return sbl_send_cmd(fd, msg, sizeof(msg), NULL, 0, timeout_ms);
+    fprintf(out, "    \"%s\": {\"count\": %u, \"min_us\": %llu, \"max_us\": %llu, \"mean_us\": %llu, "
+                 "\"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, \"buckets\": [",
+            name, h->count, (unsigned long long)h->min_us, (unsigned long long)h->max_us,
+            (unsigned long long)(h->count ? h->sum_us / h->count : 0),
+            (unsigned long long)sbl_hist_percentile(h, 50), (unsigned long long)sbl_hist_percentile(h, 90),
+            (unsigned long long)sbl_hist_percentile(h, 99));
+    for (int b = 0; b < SBL_HIST_BUCKETS; ++b)
+        fprintf(out, "%s%u", b ? ", " : "", h->bucket[b]);
+    fprintf(out, "]}%s\n", last ? "" : ",");
 }
 
-int sbl_sector_erase(int fd, uint32_t addr, int timeout_ms)
+void sbl_metrics_write_json(FILE *out, const sbl_metrics_t *m, const sbl_program_stats_t *stats, int rc)
 {
-    uint8_t msg[1 + 4];
-    msg[0] = CMD_SECTOR_ERASE;
-    msg[1] = (uint8_t)(addr >> 24);
-    msg[2] = (uint8_t)(addr >> 16);
-    msg[3] = (uint8_t)(addr >> 8);
-    msg[4] = (uint8_t)(addr);
-    return sbl_send_cmd(fd, msg, sizeof(msg), NULL, 0, timeout_ms);
+    static const char *phase_names[SBL_PHASE_COUNT] = {"plan", "erase", "program", "verify"};
+    double total_s = (double)(m->end_us - m->start_us) / 1e6;
+    double prog_s = (double)m->phase_us[SBL_PHASE_PROGRAM] / 1e6;
+    size_t payload = stats ? stats->bytes_sent : 0;
+
+    fprintf(out, "{\n  \"ok\": %s,\n  \"seconds\": %.6f,\n  \"commands\": %u,\n", rc == 0 ? "true" : "false",
+            total_s, m->commands);
+    fprintf(out, "  \"phases_s\": {");
+    for (int p = 0; p < SBL_PHASE_COUNT; ++p)
+        fprintf(out, "%s\"%s\": %.6f", p ? ", " : "", phase_names[p], (double)m->phase_us[p] / 1e6);
+    fprintf(out, "},\n");
+    fprintf(out, "  \"wire\": {\"tx_bytes\": %llu, \"rx_bytes\": %llu, \"tx_bytes_per_s\": %.1f},\n",
+            (unsigned long long)m->wire_tx, (unsigned long long)m->wire_rx,
+            total_s > 0 ? (double)m->wire_tx / total_s : 0.0);
+    fprintf(out, "  \"payload\": {\"bytes\": %zu, \"bytes_per_s\": %.1f, \"program_bytes_per_s\": %.1f},\n",
+            payload, total_s > 0 ? (double)payload / total_s : 0.0, prog_s > 0 ? (double)payload / prog_s : 0.0);
+    if (stats)
+        fprintf(out, "  \"stats\": {\"pages_erased\": %u, \"pages_unchanged\": %u, \"downloads\": %u, "
+                     "\"bytes_sent\": %zu, \"bytes_skipped\": %zu, \"retries\": %u},\n",
+                stats->pages_erased, stats->pages_unchanged, stats->downloads, stats->bytes_sent,
+                stats->bytes_skipped, stats->retries);
+    fprintf(out, "  \"latency\": {\n");
+    json_hist(out, "ack", &m->ack, 0);
+    json_hist(out, "data_ack_wait", &m->data_ack, 0);
+    json_hist(out, "status", &m->status, 0);
+    json_hist(out, "erase", &m->erase, 1);
+    fprintf(out, "  }\n}\n");
+    fflush(out);
 }
 
-int sbl_send_data(int fd, const uint8_t *chunk, size_t n, int timeout_ms)
+// Consume bytes from the receive buffer until ACK/NACK or the deadline.
+// Leading 0x00 and other noise are skipped. Returns 0 on ACK, -1 on NACK/timeout/error.
+static int sbl_wait_ack_until(int fd, uint64_t deadline_ms, int nack_is_noise)
 {
-    if (!chunk || n == 0 || n > 252)
+    for (;;)
     {
-        errno = EINVAL;
-        return -1;
+        uint8_t b;
+        int r = serial_rx_byte(fd, &b, deadline_ms);
+        if (r < 0)
+            return -1; // hard error
+        if (r == 0)
+            break;
+        if (b == SBL_ACK)
+            return 0; // 0xCC = ACK
+        if (b == SBL_NACK && !nack_is_noise)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        // Ignore everything else (0x00 noise etc.)
     }
+    errno = ETIMEDOUT;
+    return -1;
+}
 
-    uint8_t msg[1 + 252];
-    msg[0] = CMD_SEND_DATA;
-    memcpy(&msg[1], chunk, n);
+// --- SBL core ---
 
-    // data length = 1 (cmd) + n
-    return sbl_send_cmd(fd, msg, (size_t)(1 + n), NULL, 0, timeout_ms);
+// Wait for ACK or NACK, tolerate leading 0x00 or noise.
+// Returns 0 on ACK, -1 on NACK/timeout/error.
+static int sbl_wait_ack(int fd, int timeout_ms)
+{
+    return sbl_wait_ack_until(fd, deadline_after(timeout_ms), 0);
 }
 
-int sbl_crc32(int fd, uint32_t addr, uint32_t len, uint32_t repeat, int timeout_ms, uint32_t *crc_out)
+int sbl_autobaud(int fd, int timeout_ms)
 {
-    // Command + 4-byte addr + 4-byte len + 4-byte repeat
-    uint8_t msg[1 + 4 + 4 + 4];
-    msg[0] = CMD_CRC32;
-    msg[1] = (uint8_t)(addr >> 24);
-    msg[2] = (uint8_t)(addr >> 16);
-    msg[3] = (uint8_t)(addr >> 8);
-    msg[4] = (uint8_t)(addr);
-    msg[5] = (uint8_t)(len >> 24);
-    msg[6] = (uint8_t)(len >> 16);
-    msg[7] = (uint8_t)(len >> 8);
-    msg[8] = (uint8_t)(len);
-    msg[9] = (uint8_t)(repeat >> 24);
-    msg[10] = (uint8_t)(repeat >> 16);
-    msg[11] = (uint8_t)(repeat >> 8);
-    msg[12] = (uint8_t)(repeat);
+    // burst a few 0x55 to help the BL lock
+    const uint8_t ub[2] = {0x55, 0x55};
+    for (int i = 0; i < 2; ++i)
+        if (serial_write_byte(fd, ub[i]) != 1)
+            return -1;
 
-    uint8_t resp[4];
-    int n = sbl_send_cmd(fd, msg, sizeof(msg), resp, sizeof(resp), timeout_ms);
-    if (n < 0)
-        return -1;
-    if (n != 4)
-    {
-        errno = EPROTO;
+    // Many ROMs/ACM stacks spit 0x00 before ACK; ignore it (and any other noise)
+    if (sbl_wait_ack_until(fd, deadline_after(timeout_ms), 1) != 0)
         return -1;
-    }
+    // A new session, possibly at another baud or with another part
+    sbl_latency_reset(fd);
+    return 0;
+}
 
-    if (crc_out)
+// --- last-good baud cache: one "<adapter id> <baud>" line per adapter ---
+
+static int baud_cache_path(char *buf, size_t len)
+{
+    const char *env = getenv("CC1310_BAUD_CACHE");
+    if (env && *env)
     {
-        *crc_out = (uint32_t)resp[0] << 24 |
-                   ((uint32_t)resp[1] << 16) |
-                   ((uint32_t)resp[2] << 8) |
-                   ((uint32_t)resp[3]);
+        snprintf(buf, len, "%s", env);
+        return 0;
     }
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (base && *base)
+        snprintf(buf, len, "%s/cc1310_flasher.baud", base);
+    else if (home && *home)
+        snprintf(buf, len, "%s/.cache/cc1310_flasher.baud", home);
+    else
+        return -1;
     return 0;
 }
 
-int sbl_program_binary(int fd,
-                       uint32_t flash_size, uint32_t page_size,
-                       const uint8_t *image, size_t image_len,
-                       uint32_t base_addr)
+int sbl_baud_cache_get(const char *adapter_id)
 {
-    uint32_t perc = 0;
+    char path[512], line[512];
+    if (!adapter_id || baud_cache_path(path, sizeof(path)) != 0)
+        return 0;
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
 
-    if (base_addr % page_size)
+    int baud = 0;
+    size_t id_len = strlen(adapter_id);
+    while (fgets(line, sizeof(line), f))
     {
-        fprintf(stderr, "Error: base_addr 0x%08X not page aligned (page size %u)\n", base_addr, page_size);
-        return -1;
+        if (strncmp(line, adapter_id, id_len) == 0 && line[id_len] == ' ')
+            baud = atoi(line + id_len + 1);
     }
+    fclose(f);
+    return baud;
+}
 
-    // Erase only what’s needed (rounded up to page size)
-    uint32_t erase_len = (image_len + page_size - 1) & ~(page_size - 1);
-    uint32_t last_page_start = flash_size - page_size; // CCFG
-    if (base_addr + erase_len > last_page_start)
-        erase_len = last_page_start - base_addr;
+// mkdir -p of the directory path is in, mode 0700 like the XDG base dirs
+static void mkdir_parents(const char *path)
+{
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        mkdir(dir, 0700); // EEXIST for all but the missing ones
+        *p = '/';
+    }
+}
 
-    for (uint32_t a = base_addr; a < base_addr + erase_len; a += page_size)
+// Serialises writers: baud_lock within this process, a lockf() on
+// "<cache>.lock" between processes (its locks are per process, not per thread)
+static pthread_mutex_t baud_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int sbl_baud_cache_put(const char *adapter_id, int baud)
+{
+    char path[512], tmp[520], line[512];
+    if (!adapter_id || baud_cache_path(path, sizeof(path)) != 0)
+        return -1;
+
+    // The default locations ($XDG_CACHE_HOME, ~/.cache) are created on first use
+    if (!getenv("CC1310_BAUD_CACHE"))
+        mkdir_parents(path);
+
+    pthread_mutex_lock(&baud_lock);
+    snprintf(tmp, sizeof(tmp), "%s.lock", path);
+    int lock_fd = open(tmp, O_RDWR | O_CREAT, 0600);
+    if (lock_fd >= 0)
+        lockf(lock_fd, F_LOCK, 0); // without it the cache is still written whole, below
+
+    // A private temp file next to the cache, renamed over it when complete
+    int rc = -1;
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int tmp_fd = mkstemp(tmp);
+    FILE *out = tmp_fd >= 0 ? fdopen(tmp_fd, "w") : NULL;
+    if (!out)
     {
-        if (sbl_sector_erase(fd, a, 5000) != 0)
+        if (tmp_fd >= 0)
         {
-            fprintf(stderr, "Erase failed at 0x%08X\n", a);
-            return -1;
+            close(tmp_fd);
+            unlink(tmp);
         }
-        printf("Erased 0x%08X\n", a);
-        uint8_t st = 0;
-        if (sbl_get_status(fd, 1000, &st) != 0)
+        goto out;
+    }
+
+    // Copy every other adapter's entry, then write ours
+    size_t id_len = strlen(adapter_id);
+    FILE *in = fopen(path, "r");
+    if (in)
+    {
+        while (fgets(line, sizeof(line), in))
         {
-            perror("GET_STATUS after ERASE");
-            return -1;
+            if (strncmp(line, adapter_id, id_len) == 0 && line[id_len] == ' ')
+                continue;
+            fputs(line, out);
         }
-        printf("ERASE status: 0x%02X\n", st); // expect 0x40
+        fclose(in);
     }
+    fprintf(out, "%s %d\n", adapter_id, baud);
+    if (fclose(out) != 0 || rename(tmp, path) != 0)
+        unlink(tmp);
+    else
+        rc = 0;
 
-    // Calculate the image lenght + needed padding to allign by 4
-    size_t remainder = image_len % 4;
-    size_t total_len = image_len;
-    if (remainder != 0)
+out:
+    if (lock_fd >= 0)
+        close(lock_fd); // drops the lockf() lock
+    pthread_mutex_unlock(&baud_lock);
+    return rc;
+}
+
+int sbl_autobaud_scan_fd(int fd, const char *dev_path,
+                         const int *bauds, size_t n_bauds,
+                         int timeout_ms, int *baud_ok)
+{
+    if (fd < 0 || !bauds || n_bauds == 0)
     {
-        total_len += (4 - remainder);
+        errno = EINVAL;
+        return -1;
     }
 
-    if (sbl_download(fd, base_addr, (uint32_t)total_len, 1000) != 0)
+    char id[256];
+    int have_id = dev_path && serial_adapter_id(dev_path, id, sizeof(id)) == 0;
+    int cached = have_id ? sbl_baud_cache_get(id) : 0;
+
+    // Cached rate first (index -1), then the list without it
+    for (long i = cached > 0 ? -1 : 0; i < (long)n_bauds; ++i)
     {
-        fprintf(stderr, "DOWNLOAD failed\n");
-        return -1;
+        int b = i < 0 ? cached : bauds[i];
+        if (i >= 0 && b == cached)
+            continue;
+
+        // Same fd, new rate: no reopen, no settle delay
+        if (serial_set_baud(fd, b) != 0)
+            continue;
+        serial_rx_flush(fd);
+
+        if (sbl_autobaud(fd, timeout_ms) == 0)
+        {
+            if (have_id && b != cached)
+                sbl_baud_cache_put(id, b);
+            if (baud_ok)
+                *baud_ok = b;
+            return 0;
+        }
     }
+    errno = ETIMEDOUT;
+    return -1;
+}
 
-    uint8_t st = 0;
-    if (sbl_get_status(fd, 500, &st) != 0)
+int sbl_autobaud_scan(const char *dev_path,
+                      const int *bauds, size_t n_bauds,
+                      int timeout_ms, int *baud_ok)
+{
+    if (!dev_path || !bauds || n_bauds == 0)
     {
-        fprintf(stderr, "GET_STATUS after DOWNLOAD failed\n");
+        errno = EINVAL;
         return -1;
     }
-    if (st != 0x40)
-    { // 0x40 = success per your table
-        fprintf(stderr, "DOWNLOAD rejected: status 0x%02X\n", st);
+
+    int fd = serial_open_configure(dev_path, bauds[0]);
+    if (fd < 0)
         return -1;
-    }
+    int ok = sbl_autobaud_scan_fd(fd, dev_path, bauds, n_bauds, timeout_ms, baud_ok);
+    int err = errno;
+    serial_close(fd);
+    errno = err;
+    return ok;
+}
 
-    // send exactly total_len bytes in <=252-byte chunks, padding with 0xFF as needed
-    for (size_t off = 0; off < total_len;)
+int sbl_autobaud_probe(int fd, const int *bauds, size_t n_bauds, const sbl_entry_t *entry,
+                       int timeout_ms, int *baud_ok)
+{
+    if (fd < 0 || !bauds || n_bauds == 0)
     {
-        size_t chunk_len = total_len - off;
-        if (chunk_len > 252)
-            chunk_len = 252;
+        errno = EINVAL;
+        return -1;
+    }
 
-        uint8_t buf[252];
-        size_t copy_len = chunk_len;
-        if (off + copy_len > image_len)
-            copy_len = image_len - off; // may be 0 near the end
+    // Highest rate first, whatever order the caller listed them in
+    int used[64] = {0};
+    if (n_bauds > sizeof(used) / sizeof(used[0]))
+        n_bauds = sizeof(used) / sizeof(used[0]);
 
-        if (copy_len)
-            memcpy(buf, &image[off], copy_len);
-        for (size_t i = copy_len; i < chunk_len; ++i)
-            buf[i] = 0xFF; // pad last chunk
+    for (size_t k = 0; k < n_bauds; ++k)
+    {
+        size_t best = n_bauds;
+        for (size_t i = 0; i < n_bauds; ++i)
+            if (!used[i] && (best == n_bauds || bauds[i] > bauds[best]))
+                best = i;
+        used[best] = 1;
+        int b = bauds[best];
 
-        if (sbl_send_data(fd, buf, chunk_len, 1000) != 0)
-        {
-            fprintf(stderr, "SEND_DATA failed at offset %zu\n", off);
+        if (serial_set_baud(fd, b) != 0)
+            continue; // adapter can't do this rate
+        // A fresh ROM for every rate: the last one may have locked it wrongly
+        if (entry && sbl_enter_bootloader(fd, entry) != 0)
             return -1;
-        }
+        serial_rx_flush(fd);
 
+        // Only call a rate good if real traffic is clean after autobaud too
         uint8_t st = 0;
-        if (sbl_get_status(fd, 500 /*ms*/, &st) != 0)
+        int synced = sbl_autobaud(fd, timeout_ms) == 0;
+        if (synced && sbl_ping(fd, timeout_ms) == 0 &&
+            sbl_get_status(fd, timeout_ms, &st) == 0 && st == COMMAND_RET_SUCCESS)
         {
-            fprintf(stderr, "GET_STATUS failed after offset %zu\n", off);
-            return -1;
-        }
-        if (st != 0x40)
-        { // 0x40 is the ROM's "SUCCESS" on many parts; print whatever you see.
-            fprintf(stderr, "Prog status != SUCCESS (0x%02X) at offset %zu\n", st, off);
-            return -1;
+            if (baud_ok)
+                *baud_ok = b;
+            return 0;
         }
 
-        off += chunk_len;
-
-        uint32_t calc_perc = ((double) off / (double)total_len) * 100.00;
-        if(calc_perc != perc)
+        if (!entry)
         {
-            printf("Progress: %d%%\n", perc);
-            perc = calc_perc;
+            // The ROM is now locked at b, or at whatever it made of the sync
+            // bytes, until a reset: lower rates would talk to it in vain
+            fprintf(stderr, "Baud %d %s; without bootloader entry wiring the ROM cannot be reset to try a lower one\n",
+                    b, synced ? "synced but traffic is not clean" : "got no autobaud ACK");
+            errno = synced ? EIO : ETIMEDOUT;
+            return -1;
         }
+        fprintf(stderr, "Baud %d %s\n", b, synced ? "synced but traffic is not clean" : "got no autobaud ACK");
     }
+    errno = ETIMEDOUT;
+    return -1;
+}
 
-    // Optional reset into app
-    sbl_reset(fd, 1000);
+// --- bootloader entry over DTR/RTS ---
 
+void sbl_entry_init(sbl_entry_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    e->reset_line = SBL_LINE_RTS;
+    e->backdoor_line = SBL_LINE_DTR;
+    e->reset_ms = 5;
+    e->hold_ms = 5;
+    e->settle_ms = 10;
+}
+
+static int entry_line(int fd, sbl_line_t line, int active, int invert)
+{
+    int level = (active != 0) != (invert != 0);
+    if (line == SBL_LINE_DTR)
+        return serial_set_modem_lines(fd, level, -1);
+    if (line == SBL_LINE_RTS)
+        return serial_set_modem_lines(fd, -1, level);
     return 0;
-}
\ No newline at end of file
+}
+
+static void entry_sleep(int ms)
+{
+    if (ms > 0)
+        usleep((useconds_t)ms * 1000);
+}
+
+int sbl_enter_bootloader(int fd, const sbl_entry_t *e)
+{
+    if (!e || e->reset_line == SBL_LINE_NONE || e->reset_line == e->backdoor_line)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // The backdoor pin must be at its active level when the ROM comes out of reset
+    if (entry_line(fd, e->backdoor_line, 1, e->backdoor_invert) != 0 ||
+        entry_line(fd, e->reset_line, 1, e->reset_invert) != 0)
+        return -1;
+    entry_sleep(e->reset_ms);
+    if (entry_line(fd, e->reset_line, 0, e->reset_invert) != 0)
+        return -1;
+    entry_sleep(e->hold_ms);
+    if (entry_line(fd, e->backdoor_line, 0, e->backdoor_invert) != 0)
+        return -1;
+    entry_sleep(e->settle_ms);
+    serial_rx_flush(fd); // whatever the target printed while resetting
+    return 0;
+}
+
+static uint8_t checksum_sum(const uint8_t *data, size_t len)
+{
+    unsigned sum = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // PSADBW against zero sums 16 bytes into two 64-bit lanes
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + i)), _mm_setzero_si128()));
+    sum = (unsigned)_mm_cvtsi128_si32(acc) + (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for (; i + 16 <= len; i += 16)
+        sum += vaddlvq_u8(vld1q_u8(data + i));
+#endif
+    for (; i < len; ++i)
+        sum += data[i];
+    return (uint8_t)(sum & 0xFF);
+}
+
+// Write a SEND_DATA frame carrying n image bytes followed by pad bytes of 0xFF.
+// Header and padding come from small buffers; the payload is sent straight from
+// the caller's memory with a single writev().
+static int sbl_write_data_frame(int fd, const uint8_t *data, size_t n, size_t pad)
+{
+    if (n + pad > 252)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    uint8_t ff[252];
+    if (pad)
+        memset(ff, 0xFF, pad); // only the last frame of a download is padded
+
+    uint8_t hdr[3];
+    hdr[0] = (uint8_t)(3 + n + pad);
+    hdr[1] = (uint8_t)(CMD_SEND_DATA + checksum_sum(data, n) + 0xFF * pad);
+    hdr[2] = CMD_SEND_DATA;
+
+    struct iovec iov[3] = {
+        {hdr, sizeof(hdr)},
+        {(void *)data, n},
+        {ff, pad},
+    };
+    if (serial_writev_all(fd, iov, pad ? 3 : 2) < 0)
+        return -1;
+    return 0;
+}
+
+// Length of the response frame the ROM sends after ACKing cmd.
+// 0 = ACK only, -1 = not known (fall back to a short peek).
+static int sbl_response_len(uint8_t cmd)
+{
+    const sbl_cmd_info_t *c = sbl_cmd_info(cmd);
+    return c ? c->resp_len : -1;
+}
+
+// --- Resumable command state machine ---
+
+static int sbl_op_finish(sbl_op_t *op, int result, int err)
+{
+    metrics_command(op->fd, op->cmd, op->t_start_us, op->t_sent_us, op->t_ack_us, result >= 0);
+    latency_sample(op->fd, op->cmd, op->work, serial_now_us() - op->t_start_us, result >= 0, err);
+    op->state = SBL_OP_DONE;
+    op->result = result;
+    op->err = err;
+    return 1;
+}
+
+static uint32_t be32_get(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Bytes of flash a command makes the ROM go through, which is what its round
+// trip grows with (0 for the fixed-cost ones). frame is the encoded command, or
+// NULL when it was sent as part of another op; MEMORY_READ is sized by out_max.
+static uint64_t cmd_work(uint8_t cmd, const uint8_t *frame, size_t out_max)
+{
+    switch (cmd)
+    {
+    case CMD_CRC32:
+        // [SIZE][CSUM][CMD][addr][len][repeat]: every location read repeat + 1 times
+        return frame ? (uint64_t)be32_get(frame + 7) * ((uint64_t)be32_get(frame + 11) + 1) : 0;
+    case CMD_MEMORY_READ:
+        return out_max;
+    default:
+        return 0;
+    }
+}
+
+// Everything but the frame in op->tx
+static void op_init(sbl_op_t *op, int fd, uint8_t cmd, size_t frame_len, uint8_t *out, size_t out_max,
+                    int timeout_ms)
+{
+    op->fd = fd;
+    op->tx_len = frame_len;
+    op->tx_off = 0;
+    op->out = out;
+    op->out_max = out_max;
+    op->resp_len = (out && out_max) ? sbl_response_len(cmd) : 0;
+    op->work = cmd_work(cmd, frame_len ? op->tx : NULL, out_max);
+    timeout_ms = sbl_latency_timeout_len(fd, cmd, op->work, timeout_ms);
+    op->timeout_ms = timeout_ms;
+    op->deadline_ms = deadline_after(timeout_ms);
+    op->state = SBL_OP_SEND;
+    op->cmd = cmd;
+    op->rx_got = 0;
+    op->rx_have_csum = 0;
+    op->result = 0;
+    op->err = 0;
+    op->t_start_us = serial_now_us();
+    op->t_sent_us = op->t_ack_us = 0;
+    op->chain = NULL;
+    op->chain_len = 0;
+    op->chain_sent = 0;
+}
+
+int sbl_op_start(sbl_op_t *op, int fd, const uint8_t *data, size_t len,
+                 uint8_t *out, size_t out_max, int timeout_ms)
+{
+    if (!op || !data || len == 0 || len > 253)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Frame: [SIZE][CHECKSUM][DATA...] — written in one go to avoid inter-byte gaps
+    op->tx[0] = (uint8_t)(len + 2);
+    op->tx[1] = checksum_sum(data, len);
+    memcpy(&op->tx[2], data, len);
+    op_init(op, fd, data[0], len + 2, out, out_max, timeout_ms);
+    return 0;
+}
+
+int sbl_op_start_cmd(sbl_op_t *op, int fd, uint8_t cmd, const uint32_t *fields,
+                     uint8_t *out, size_t out_max, int timeout_ms)
+{
+    if (!op)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    int n = sbl_cmd_encode(op->tx, cmd, fields);
+    if (n < 0)
+        return -1;
+    op_init(op, fd, cmd, (size_t)n, out, out_max, timeout_ms);
+    return 0;
+}
+
+int sbl_op_start_sent(sbl_op_t *op, int fd, uint8_t cmd, uint8_t *out, size_t out_max, int timeout_ms)
+{
+    if (!op)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    op_init(op, fd, cmd, 0, out, out_max, timeout_ms);
+    op->t_sent_us = op->t_start_us;
+    op->state = SBL_OP_WAIT_ACK;
+    return 0;
+}
+
+int sbl_op_chain(sbl_op_t *op, const uint8_t *frame, size_t frame_len)
+{
+    if (!op || !frame || frame_len < 3 || frame_len > 255 || !op->out || op->resp_len == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    op->chain = frame;
+    op->chain_len = frame_len;
+    return 0;
+}
+
+short sbl_op_events(const sbl_op_t *op)
+{
+    switch (op->state)
+    {
+    case SBL_OP_SEND:
+    case SBL_OP_SEND_ACK:
+        return POLLOUT;
+    case SBL_OP_DONE:
+        return 0;
+    default:
+        return POLLIN;
+    }
+}
+
+int sbl_op_timeout(const sbl_op_t *op)
+{
+    uint64_t now = serial_now_ms();
+    return op->deadline_ms > now ? (int)(op->deadline_ms - now) : 0;
+}
+
+int sbl_op_step(sbl_op_t *op, short revents)
+{
+    (void)revents; // progress is decided by what the port can do right now
+
+    for (;;)
+    {
+        uint8_t b;
+        int r;
+
+        switch (op->state)
+        {
+        case SBL_OP_SEND:
+        case SBL_OP_SEND_ACK:
+        {
+            ssize_t n = serial_write_some(op->fd, op->tx + op->tx_off, op->tx_len - op->tx_off);
+            if (n < 0)
+                return sbl_op_finish(op, -1, errno);
+            op->tx_off += (size_t)n;
+            if (op->tx_off < op->tx_len)
+            {
+                if (serial_now_ms() >= op->deadline_ms)
+                    return sbl_op_finish(op, -1, ETIMEDOUT);
+                return 0;
+            }
+            if (serial_write_done(op->fd) < 0)
+                return sbl_op_finish(op, -1, errno);
+            if (op->state == SBL_OP_SEND)
+            {
+                op->t_sent_us = serial_now_us();
+                op->state = SBL_OP_WAIT_ACK;
+                continue;
+            }
+            op->chain_sent = op->chain != NULL;
+            // Our ACK of the response frame is out; now judge the frame
+            if (checksum_sum(op->out, op->rx_got) != op->rx_csum)
+                return sbl_op_finish(op, -1, EPROTO);
+            if (op->resp_len > 0 && (int)op->rx_got != op->resp_len)
+                return sbl_op_finish(op, -1, EPROTO);
+            return sbl_op_finish(op, (int)op->rx_got, 0);
+        }
+
+        case SBL_OP_WAIT_ACK:
+            // Leading 0x00 and other noise are skipped
+            r = serial_rx_byte(op->fd, &b, 0);
+            if (r < 0)
+                return sbl_op_finish(op, -1, errno);
+            if (r == 0)
+            {
+                if (serial_now_ms() >= op->deadline_ms)
+                    return sbl_op_finish(op, -1, ETIMEDOUT);
+                return 0;
+            }
+            if (b == SBL_NACK)
+                return sbl_op_finish(op, -1, EPROTO);
+            if (b != SBL_ACK)
+                continue;
+            op->t_ack_us = serial_now_us();
+            if (op->resp_len == 0)
+                return sbl_op_finish(op, 0, 0);
+            // The response follows the ACK; give it a fresh timeout window.
+            // Unknown commands only get a short peek for a size byte.
+            op->deadline_ms = deadline_after(op->resp_len < 0 ? 50 : op->timeout_ms);
+            op->state = SBL_OP_RESP_SIZE;
+            continue;
+
+        case SBL_OP_RESP_SIZE:
+            r = serial_rx_byte(op->fd, &b, 0);
+            if (r < 0)
+                return sbl_op_finish(op, -1, errno);
+            if (r == 0)
+            {
+                if (serial_now_ms() < op->deadline_ms)
+                    return 0;
+                if (op->resp_len < 0)
+                    return sbl_op_finish(op, 0, 0); // nothing came: no response
+                return sbl_op_finish(op, -1, ETIMEDOUT);
+            }
+            if (b == 0)
+            {
+                if (op->resp_len < 0)
+                    return sbl_op_finish(op, 0, 0);
+                continue; // fill byte before SIZE
+            }
+            if (b < 2)
+                return sbl_op_finish(op, -1, EPROTO);
+            if ((size_t)b - 2 > op->out_max)
+                return sbl_op_finish(op, -1, EMSGSIZE);
+            op->rx_size = b;
+            op->rx_got = 0;
+            op->rx_have_csum = 0;
+            if (op->resp_len < 0)
+                op->deadline_ms = deadline_after(op->timeout_ms);
+            op->state = SBL_OP_RESP_BODY;
+            continue;
+
+        case SBL_OP_RESP_BODY:
+            while (!op->rx_have_csum || op->rx_got < (size_t)op->rx_size - 2)
+            {
+                r = serial_rx_byte(op->fd, &b, 0);
+                if (r < 0)
+                    return sbl_op_finish(op, -1, errno);
+                if (r == 0)
+                {
+                    if (serial_now_ms() >= op->deadline_ms)
+                        return sbl_op_finish(op, -1, ETIMEDOUT);
+                    return 0;
+                }
+                if (!op->rx_have_csum)
+                {
+                    op->rx_csum = b;
+                    op->rx_have_csum = 1;
+                }
+                else
+                    op->out[op->rx_got++] = b;
+            }
+            // ACK the device’s response frame, with the chained command behind it
+            op->tx[0] = 0x00;
+            op->tx[1] = SBL_ACK;
+            op->tx_len = 2;
+            op->tx_off = 0;
+            if (op->chain)
+            {
+                memcpy(&op->tx[2], op->chain, op->chain_len);
+                op->tx_len += op->chain_len;
+            }
+            op->state = SBL_OP_SEND_ACK;
+            continue;
+
+        case SBL_OP_DONE:
+        default:
+            return 1;
+        }
+    }
+}
+
+int sbl_op_wait(sbl_op_t *op)
+{
+    while (!sbl_op_step(op, 0))
+    {
+        struct pollfd pfd = {.fd = op->fd, .events = sbl_op_events(op)};
+        if (poll(&pfd, 1, sbl_op_timeout(op)) < 0 && errno != EINTR)
+            sbl_op_finish(op, -1, errno);
+    }
+    if (op->result < 0)
+        errno = op->err;
+    return op->result;
+}
+
+// Send one SBL packet and wait for ACK; if bootloader is sender in response,
+// this function reads the response packet (size+checksum+payload) into out.
+// Commands known to answer (GET_STATUS, GET_CHIP_ID, CRC32) block for exactly
+// that frame; commands known not to answer never wait for one.
+// Blocking wrapper around sbl_op_start() / sbl_op_wait().
+int sbl_send_cmd(int fd, const uint8_t *data, size_t len,
+                 uint8_t *out, size_t out_max, int timeout_ms)
+{
+    sbl_op_t op;
+    if (sbl_op_start(&op, fd, data, len, out, out_max, timeout_ms) != 0)
+        return -1;
+    return sbl_op_wait(&op);
+}
+
+// Blocking table command: sbl_op_start_cmd() / sbl_op_wait()
+static int sbl_cmd(int fd, uint8_t cmd, const uint32_t *fields, uint8_t *out, size_t out_max, int timeout_ms)
+{
+    sbl_op_t op;
+    if (sbl_op_start_cmd(&op, fd, cmd, fields, out, out_max, timeout_ms) != 0)
+        return -1;
+    return sbl_op_wait(&op);
+}
+
+// --- Convenience commands ---
+int sbl_ping(int fd, int timeout_ms)
+{
+    return sbl_cmd(fd, CMD_PING, NULL, NULL, 0, timeout_ms);
+}
+
+int sbl_resync(int fd, int timeout_ms)
+{
+    // A frame cut short leaves the ROM waiting for up to 255 more bytes: zeros
+    // finish it (it fails its checksum and is NACKed), and once the ROM is back
+    // to waiting for a SIZE byte it skips them as idle filler.
+    uint8_t filler[256];
+    memset(filler, 0, sizeof(filler));
+    serial_rx_flush(fd);
+    if (serial_write_all(fd, filler, sizeof(filler)) != (ssize_t)sizeof(filler))
+        return -1;
+
+    // Drop the NACK/ACK and any response still coming in
+    uint8_t junk[64];
+    while (serial_read_timeout(fd, junk, sizeof(junk), 50) > 0)
+        ;
+
+    for (int i = 0; i < 3; ++i)
+        if (sbl_ping(fd, timeout_ms) == 0)
+            return 0;
+
+    // No ACK at all: the part may have reset and lost its baud lock
+    serial_rx_flush(fd);
+    if (sbl_autobaud(fd, timeout_ms) == 0 && sbl_ping(fd, timeout_ms) == 0)
+        return 0;
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int sbl_get_status(int fd, int timeout_ms, uint8_t *status_out)
+{
+    uint8_t resp[1];
+    int n = sbl_cmd(fd, CMD_GET_STATUS, NULL, resp, sizeof(resp), timeout_ms);
+    if (n < 0)
+        return -1;
+    if (n == 1 && status_out)
+        *status_out = resp[0];
+    return 0;
+}
+
+int sbl_get_chip_id(int fd, int timeout_ms, uint32_t *chip_id_out)
+{
+    uint8_t resp[4];
+    int n = sbl_cmd(fd, CMD_GET_CHIP_ID, NULL, resp, sizeof(resp), timeout_ms);
+    if (n < 0)
+        return -1;
+    if (n == 4 && chip_id_out)
+    {
+        // Little-endian 32-bit
+        *chip_id_out = (uint32_t)resp[0] |
+                       ((uint32_t)resp[1] << 8) |
+                       ((uint32_t)resp[2] << 16) |
+                       ((uint32_t)resp[3] << 24);
+    }
+    return 0;
+}
+
+int sbl_reset(int fd, int timeout_ms)
+{
+    return sbl_cmd(fd, CMD_RESET, NULL, NULL, 0, timeout_ms);
+}
+
+int sbl_download(int fd, uint32_t addr, uint32_t total_len, int timeout_ms)
+{
+    uint32_t f[2] = {addr, total_len};
+    return sbl_cmd(fd, CMD_DOWNLOAD, f, NULL, 0, timeout_ms);
+}
+
+int sbl_sector_erase(int fd, uint32_t addr, int timeout_ms)
+{
+    return sbl_cmd(fd, CMD_SECTOR_ERASE, &addr, NULL, 0, timeout_ms);
+}
+
+int sbl_bank_erase(int fd, int timeout_ms)
+{
+    return sbl_cmd(fd, CMD_BANK_ERASE, NULL, NULL, 0, timeout_ms);
+}
+
+int sbl_set_ccfg(int fd, uint32_t field_id, uint32_t value, int timeout_ms)
+{
+    uint32_t f[2] = {field_id, value};
+    return sbl_cmd(fd, CMD_SET_CCFG, f, NULL, 0, timeout_ms);
+}
+
+// Record a SEND_DATA of n bytes whose ACK wait started at t0 and ended in rc:
+// timeout estimate, command count and the data_ack histogram
+static void data_ack_done(int fd, size_t n, uint64_t t0, int rc)
+{
+    int err = errno;
+    latency_sample(fd, CMD_SEND_DATA, n, serial_now_us() - t0, rc == 0, err);
+    sbl_metrics_t *m = metrics_get(fd);
+    if (m)
+    {
+        hist_add(&m->data_ack, serial_now_us() - t0);
+        metrics_command(fd, CMD_SEND_DATA, t0, 0, 0, rc == 0);
+    }
+    errno = err;
+}
+
+int sbl_send_data(int fd, const uint8_t *chunk, size_t n, int timeout_ms)
+{
+    if (!chunk || n == 0 || n > 252)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // SEND_DATA has no response frame: write it from the caller's buffer and wait for the ACK
+    if (sbl_write_data_frame(fd, chunk, n, 0) != 0)
+        return -1;
+    uint64_t t0 = serial_now_us();
+    int rc = sbl_wait_ack(fd, sbl_latency_timeout_len(fd, CMD_SEND_DATA, n, timeout_ms));
+    data_ack_done(fd, n, t0, rc);
+    return rc;
+}
+
+int sbl_crc32(int fd, uint32_t addr, uint32_t len, uint32_t repeat, int timeout_ms, uint32_t *crc_out)
+{
+    uint32_t f[3] = {addr, len, repeat};
+    uint8_t resp[4];
+    int n = sbl_cmd(fd, CMD_CRC32, f, resp, sizeof(resp), timeout_ms);
+    if (n < 0)
+        return -1;
+    if (n != 4)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (crc_out)
+    {
+        *crc_out = (uint32_t)resp[0] << 24 |
+                   ((uint32_t)resp[1] << 16) |
+                   ((uint32_t)resp[2] << 8) |
+                   ((uint32_t)resp[3]);
+    }
+    return 0;
+}
+
+// MEMORY_READ fields (addr, type, count) for the largest read at addr within
+// len bytes; returns its length in bytes.
+static size_t memory_read_fields(uint32_t f[3], uint32_t addr, size_t len)
+{
+    int type = SBL_READ_32BIT;
+    size_t count = len / 4;
+    if ((addr & 3) || count == 0)
+    {
+        type = SBL_READ_8BIT;
+        count = (addr & 3) ? 4 - (addr & 3) : len;
+        if (count > len)
+            count = len;
+    }
+    else if (count > SBL_READ_MAX_32BIT)
+        count = SBL_READ_MAX_32BIT;
+
+    f[0] = addr;
+    f[1] = (uint32_t)type;
+    f[2] = (uint32_t)count;
+    return type == SBL_READ_32BIT ? count * 4 : count;
+}
+
+int sbl_memory_read(int fd, uint32_t addr, int type, uint8_t count, uint8_t *out, int timeout_ms)
+{
+    size_t n = type == SBL_READ_32BIT ? (size_t)count * 4 : count;
+    if (!out || count == 0 || (type == SBL_READ_32BIT && ((addr & 3) || count > SBL_READ_MAX_32BIT)) ||
+        (type != SBL_READ_32BIT && type != SBL_READ_8BIT) || n > SBL_READ_MAX_8BIT)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t f[3] = {addr, (uint32_t)type, count};
+    sbl_op_t op;
+    if (sbl_op_start_cmd(&op, fd, CMD_MEMORY_READ, f, out, n, timeout_ms) != 0)
+        return -1;
+    op.resp_len = (int)n;
+    return sbl_op_wait(&op) < 0 ? -1 : 0;
+}
+
+// Run MEMORY_READs from out[off] on, each next request chained to the previous
+// response's ACK. Returns the offset of the first byte not read.
+static size_t read_range_pipelined(int fd, uint32_t addr, uint8_t *out, size_t len, size_t off)
+{
+    uint32_t f[3];
+    uint8_t next_frame[SBL_CMD_FRAME_MAX];
+    size_t n = memory_read_fields(f, addr + (uint32_t)off, len - off);
+    sbl_op_t op;
+    if (sbl_op_start_cmd(&op, fd, CMD_MEMORY_READ, f, out + off, n, 0) != 0)
+        return off;
+    for (;;)
+    {
+        op.resp_len = (int)n;
+        size_t next = off + n;
+        size_t next_n = 0;
+        if (next < len)
+        {
+            next_n = memory_read_fields(f, addr + (uint32_t)next, len - next);
+            int frame_len = sbl_cmd_encode(next_frame, CMD_MEMORY_READ, f);
+            sbl_op_chain(&op, next_frame, (size_t)frame_len);
+        }
+        if (sbl_op_wait(&op) < 0)
+            return off;
+        off = next;
+        if (!next_n)
+            return off;
+        n = next_n;
+        if (sbl_op_start_sent(&op, fd, CMD_MEMORY_READ, out + off, n, 0) != 0)
+            return off;
+    }
+}
+
+int sbl_read_range(int fd, uint32_t addr, uint8_t *out, size_t len, int retries)
+{
+    size_t off = 0;
+    int attempt = 0;
+    while (off < len)
+    {
+        size_t got = read_range_pipelined(fd, addr, out, len, off);
+        if (got == len)
+            break;
+        if (got > off)
+            attempt = 0;
+        off = got;
+        if (attempt++ >= retries)
+        {
+            fprintf(stderr, "MEMORY_READ failed at 0x%08zX\n", addr + off);
+            return -1;
+        }
+        fprintf(stderr, "MEMORY_READ failed at 0x%08zX, resynchronising (retry %d of %d)\n", addr + off, attempt,
+                retries);
+        if (sbl_resync(fd, 1000) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// After an idempotent command failed: resync and say whether to issue it again.
+// opts == NULL (the single-shot public calls) never retries.
+static int retry_after(int fd, const sbl_program_opts_t *opts, int *attempt, const char *what, uint32_t addr)
+{
+    if (!opts || (uint32_t)*attempt >= opts->retries)
+        return 0;
+    ++*attempt;
+    if (opts->stats)
+        opts->stats->retries++;
+    fprintf(stderr, "%s failed at 0x%08X, resynchronising (retry %d of %u)\n", what, addr, *attempt,
+            opts->retries);
+    return sbl_resync(fd, 1000) == 0;
+}
+
+static const char *const event_names[SBL_EV_COUNT] = {
+    "erase_plan", "bank_erased", "page_erased", "progress", "resume",
+    "sparse", "delta", "verify_ok", "ccfg", "reprogram",
+};
+
+const char *sbl_event_name(sbl_event_type_t type)
+{
+    return (unsigned)type < SBL_EV_COUNT ? event_names[type] : "?";
+}
+
+// Hand one event to opts->progress, if there is one
+static void emit(const sbl_program_opts_t *opts, sbl_event_type_t type, uint32_t addr, size_t done, size_t total,
+                 uint32_t value)
+{
+    if (!opts || !opts->progress)
+        return;
+    sbl_event_t ev = {type, addr, done, total, value};
+    opts->progress(&ev, opts->progress_user);
+}
+
+static int sbl_crc32_retry(int fd, uint32_t addr, uint32_t len, const sbl_program_opts_t *opts, uint32_t *crc_out)
+{
+    int attempt = 0;
+    while (sbl_crc32(fd, addr, len, 0, 5000, crc_out) != 0)
+    {
+        if (!retry_after(fd, opts, &attempt, "CRC32", addr))
+            return -1;
+    }
+    return 0;
+}
+
+static int erase_page(int fd, uint32_t a)
+{
+    if (sbl_sector_erase(fd, a, 5000) != 0)
+    {
+        fprintf(stderr, "Erase failed at 0x%08X\n", a);
+        return -1;
+    }
+    uint8_t st = 0;
+    if (sbl_get_status(fd, 1000, &st) != 0)
+    {
+        perror("GET_STATUS after ERASE");
+        return -1;
+    }
+    if (st != COMMAND_RET_SUCCESS)
+    {
+        fprintf(stderr, "Erase failed at 0x%08X with status 0x%02X\n", a, st);
+        return -1;
+    }
+    return 0;
+}
+
+static int erase_pages_run(int fd, uint32_t addr, uint32_t len, uint32_t page_size, const sbl_program_opts_t *opts)
+{
+    uint32_t n_pages = len / page_size;
+    for (uint32_t a = addr; a < addr + len; a += page_size)
+    {
+        int attempt = 0;
+        while (erase_page(fd, a) != 0)
+        {
+            if (!retry_after(fd, opts, &attempt, "Erase", a))
+                return -1;
+        }
+        emit(opts, SBL_EV_PAGE_ERASED, a, (a - addr) / page_size + 1, n_pages, 0);
+    }
+    return 0;
+}
+
+static int erase_pages_timed(int fd, uint32_t addr, uint32_t len, uint32_t page_size, const sbl_program_opts_t *opts)
+{
+    uint64_t t0 = serial_now_us();
+    int rc = erase_pages_run(fd, addr, len, page_size, opts);
+    phase_end(fd, SBL_PHASE_ERASE, t0);
+    return rc;
+}
+
+int sbl_erase_pages(int fd, uint32_t addr, uint32_t len, uint32_t page_size)
+{
+    return erase_pages_timed(fd, addr, len, page_size, NULL);
+}
+
+// CRC32 of len image bytes at off, 0xFF past image_len.
+static uint32_t data_crc(const uint8_t *image, size_t image_len, size_t off, size_t len)
+{
+    size_t n = off < image_len ? image_len - off : 0;
+    if (n > len)
+        n = len;
+    uint32_t crc = sbl_crc32_update(0, image + off, n);
+    return sbl_crc32_fill(crc, 0xFF, len - n);
+}
+
+// Index of the opts->meta page starting at addr, or -1 if it has none there
+static long meta_page(const sbl_program_opts_t *opts, uint32_t addr)
+{
+    const sbl_image_meta_t *meta = opts ? opts->meta : NULL;
+    if (!meta || addr < meta->first_page || (addr - meta->first_page) % meta->page_size)
+        return -1;
+    uint32_t p = (addr - meta->first_page) / meta->page_size;
+    return p < meta->n_pages ? (long)p : -1;
+}
+
+// data_crc() of an image placed at addr, taking whole pages from opts->meta.
+static uint32_t image_crc(const sbl_program_opts_t *opts, uint32_t addr, const uint8_t *image, size_t image_len,
+                          size_t off, size_t len)
+{
+    const sbl_image_meta_t *meta = opts ? opts->meta : NULL;
+    if (!meta)
+        return data_crc(image, image_len, off, len);
+
+    uint32_t crc = 0;
+    for (size_t done = 0; done < len;)
+    {
+        uint32_t a = addr + (uint32_t)(off + done);
+        size_t n = meta->page_size - a % meta->page_size;
+        if (n > len - done)
+            n = len - done;
+        long p = n == meta->page_size ? meta_page(opts, a) : -1;
+        uint32_t part = p >= 0 ? meta->crc[p] : data_crc(image, image_len, off + done, n);
+        crc = done ? sbl_crc32_combine(crc, part, n) : part;
+        done += n;
+    }
+    return crc;
+}
+
+// The page at addr + off lies within total_len and opts->meta has it all 0xFF
+static int meta_page_blank(const sbl_program_opts_t *opts, uint32_t addr, size_t off, size_t total_len)
+{
+    long p = meta_page(opts, addr + (uint32_t)off);
+    return p >= 0 && off + opts->meta->page_size <= total_len && opts->meta->blank[p];
+}
+
+// Length programmed for len image bytes: SEND_DATA moves whole words
+static size_t word_pad(size_t len)
+{
+    return (len + 3) & ~(size_t)3;
+}
+
+static int plan_erase_run(int fd, uint32_t addr, uint32_t page_size, uint32_t n_pages,
+                          const uint8_t *image, size_t image_len, uint8_t *plan,
+                          const sbl_program_opts_t *opts)
+{
+    if (!plan || page_size == 0 || (addr % page_size))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (n_pages == 0)
+        return 0;
+
+    uint32_t blank_crc = sbl_crc32_fill(0, 0xFF, page_size);
+
+    // One CRC over the whole range settles the common all-blank / all-equal cases
+    uint32_t range_len = n_pages * page_size;
+    uint32_t dev = 0;
+    if (sbl_crc32_retry(fd, addr, range_len, opts, &dev) != 0)
+        return -1;
+    if (dev == image_crc(opts, addr, image, image_len, 0, range_len))
+    {
+        memset(plan, SBL_PAGE_MATCH, n_pages);
+        return 0;
+    }
+    if (dev == sbl_crc32_fill(0, 0xFF, range_len))
+    {
+        memset(plan, SBL_PAGE_BLANK, n_pages);
+        return 0;
+    }
+
+    for (uint32_t p = 0; p < n_pages; ++p)
+    {
+        uint32_t a = addr + p * page_size;
+        if (sbl_crc32_retry(fd, a, page_size, opts, &dev) != 0)
+        {
+            fprintf(stderr, "CRC32 of page 0x%08X failed\n", a);
+            return -1;
+        }
+        if (dev == image_crc(opts, addr, image, image_len, (size_t)p * page_size, page_size))
+            plan[p] = SBL_PAGE_MATCH;
+        else if (dev == blank_crc)
+            plan[p] = SBL_PAGE_BLANK;
+        else
+            plan[p] = SBL_PAGE_DIFF;
+    }
+    return 0;
+}
+
+static int plan_erase_timed(int fd, uint32_t addr, uint32_t page_size, uint32_t n_pages,
+                            const uint8_t *image, size_t image_len, uint8_t *plan,
+                            const sbl_program_opts_t *opts)
+{
+    uint64_t t0 = serial_now_us();
+    int rc = plan_erase_run(fd, addr, page_size, n_pages, image, image_len, plan, opts);
+    phase_end(fd, SBL_PHASE_PLAN, t0);
+    return rc;
+}
+
+int sbl_plan_erase(int fd, uint32_t addr, uint32_t page_size, uint32_t n_pages,
+                   const uint8_t *image, size_t image_len, uint8_t *plan)
+{
+    return plan_erase_timed(fd, addr, page_size, n_pages, image, image_len, plan, NULL);
+}
+
+// Bank erase followed by a GET_STATUS check
+static int bank_erase_run(int fd, const sbl_program_opts_t *opts)
+{
+    if (sbl_bank_erase(fd, 10000) != 0)
+    {
+        fprintf(stderr, "BANK_ERASE failed\n");
+        return -1;
+    }
+    uint8_t st = 0;
+    if (sbl_get_status(fd, 1000, &st) != 0 || st != COMMAND_RET_SUCCESS)
+    {
+        fprintf(stderr, "BANK_ERASE status 0x%02X\n", st);
+        return -1;
+    }
+    emit(opts, SBL_EV_BANK_ERASED, 0, 0, 0, 0);
+    return 0;
+}
+
+static int sbl_bank_erase_checked(int fd, const sbl_program_opts_t *opts)
+{
+    uint64_t t0 = serial_now_us();
+    int rc = bank_erase_run(fd, opts);
+    phase_end(fd, SBL_PHASE_ERASE, t0);
+    return rc;
+}
+
+// Erase ahead of programming image at base_addr, per opts->erase.
+// erase_len is the page-rounded range below CCFG the image covers.
+static int sbl_erase_for_image(int fd, uint32_t flash_size, uint32_t page_size,
+                               const uint8_t *image, size_t image_len,
+                               uint32_t base_addr, uint32_t erase_len,
+                               const sbl_program_opts_t *opts)
+{
+    uint32_t last_page_start = flash_size - page_size; // CCFG
+
+    sbl_program_stats_t unused;
+    sbl_program_stats_t *stats = opts->stats ? opts->stats : &unused;
+
+    if (opts->erase == SBL_ERASE_BANK)
+    {
+        if (base_addr + image_len < flash_size)
+            fprintf(stderr, "Warning: bank erase also clears CCFG, which this image does not rewrite\n");
+        stats->pages_erased++;
+        return sbl_bank_erase_checked(fd, opts);
+    }
+    if (opts->erase == SBL_ERASE_NONE)
+        return 0;
+    if (opts->erase != SBL_ERASE_SMART)
+    {
+        stats->pages_erased += erase_len / page_size;
+        return erase_pages_timed(fd, base_addr, erase_len, page_size, opts);
+    }
+
+    uint32_t n_pages = erase_len / page_size;
+    if (n_pages == 0)
+        return 0;
+    uint8_t *plan = (uint8_t *)malloc(n_pages);
+    if (!plan)
+        return -1;
+    if (plan_erase_timed(fd, base_addr, page_size, n_pages, image, image_len, plan, opts) != 0)
+    {
+        free(plan);
+        return -1;
+    }
+
+    // Everything gets rewritten, so only pages that are blank now can be skipped
+    uint32_t blank_crc = sbl_crc32_fill(0, 0xFF, page_size);
+    uint32_t need = 0;
+    for (uint32_t p = 0; p < n_pages; ++p)
+    {
+        if (plan[p] == SBL_PAGE_MATCH &&
+            image_crc(opts, base_addr, image, image_len, (size_t)p * page_size, page_size) == blank_crc)
+            plan[p] = SBL_PAGE_BLANK;
+        need += plan[p] != SBL_PAGE_BLANK;
+    }
+    emit(opts, SBL_EV_ERASE_PLAN, base_addr, need, n_pages, 0);
+
+    // The image rewrites every page including CCFG: a single bank erase does the same job
+    int rc = 0;
+    if (need == n_pages && base_addr == 0 && erase_len == last_page_start && image_len >= flash_size)
+    {
+        stats->pages_erased++;
+        rc = sbl_bank_erase_checked(fd, opts);
+    }
+    else
+    {
+        for (uint32_t p = 0; p < n_pages && rc == 0; ++p)
+        {
+            if (plan[p] != SBL_PAGE_BLANK)
+            {
+                stats->pages_erased++;
+                rc = erase_pages_timed(fd, base_addr + p * page_size, page_size, page_size, opts);
+            }
+        }
+    }
+    free(plan);
+    return rc;
+}
+
+void sbl_program_opts_init(sbl_program_opts_t *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->status_interval = 1;
+    opts->window = 1;
+    opts->verify = 1;
+    opts->retries = 3;
+}
+
+// --- pacing SEND_DATA around the ROM's flash writes ---
+
+// The ROM ACKs a SEND_DATA frame and only then writes it to flash, without
+// reading its UART meanwhile: whatever arrives in that time has to fit the RX
+// FIFO. Frames sent without a GET_STATUS in between (--window, --status-every)
+// are therefore held until the previous write should be over, counted from
+// the ACK as it reached the host: nothing the host estimates about the wire
+// or the ROM's turnaround can run ahead of that.
+#define SBL_ROM_RX_FIFO 32
+#define SBL_PROGRAM_NS_PER_BYTE 3000 // flash write time assumed until measured
+
+// Microseconds len bytes take on fd's wire (8N1), 0 if its rate is unknown
+static uint64_t wire_us(int fd, size_t len)
+{
+    int baud = serial_get_baud(fd);
+    return baud > 0 ? (uint64_t)len * 10u * 1000000u / (uint64_t)baud : 0;
+}
+
+// Time from the ACK of an n-byte SEND_DATA frame until the ROM reads its UART
+// again, less the half RX FIFO the next frame may start early with: what a
+// GET_STATUS right after such a frame takes over a plain one (see
+// status_after_data()) with its variance, but never less than
+// SBL_PROGRAM_NS_PER_BYTE says
+static uint64_t program_us(int fd, size_t n)
+{
+    int64_t us = (int64_t)n * SBL_PROGRAM_NS_PER_BYTE / 1000;
+    const rtt_est_t *busy = latency_est(fd, CMD_GET_STATUS, n, 0);
+    const rtt_est_t *idle = latency_est(fd, CMD_GET_STATUS, 0, 0);
+    if (busy && idle && busy->n >= SBL_RTO_SAMPLES && idle->n >= SBL_RTO_SAMPLES &&
+        busy->srtt_us + busy->rttvar_us - idle->srtt_us > us)
+        us = busy->srtt_us + busy->rttvar_us - idle->srtt_us;
+    uint64_t early = wire_us(fd, SBL_ROM_RX_FIFO / 2);
+    return (uint64_t)us > early ? (uint64_t)us - early : 0;
+}
+
+static void sleep_until_us(uint64_t t)
+{
+    uint64_t now = serial_now_us();
+    if (t <= now)
+        return;
+    struct timespec ts = {(time_t)((t - now) / 1000000u), (long)((t - now) % 1000000u) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+// GET_STATUS after the ACK of a frame of frame_len bytes. Its round trip holds
+// what is left of that frame's flash write, so it is learned in the frame's size
+// class, apart from the fixed-cost GET_STATUS round trips.
+static int status_after_data(int fd, size_t frame_len, uint8_t *st)
+{
+    uint8_t resp[1];
+    sbl_op_t op;
+    if (sbl_op_start_cmd(&op, fd, CMD_GET_STATUS, NULL, resp, sizeof(resp), 0) != 0)
+        return -1;
+    op.work = frame_len;
+    op.timeout_ms = sbl_latency_timeout_len(fd, CMD_GET_STATUS, frame_len, 500);
+    op.deadline_ms = deadline_after(op.timeout_ms);
+    int n = sbl_op_wait(&op);
+    if (n < 0)
+        return -1;
+    if (n != 1)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    *st = resp[0];
+    return 0;
+}
+
+// Collect the ACK of the oldest SEND_DATA frame still in flight.
+static int sbl_collect_data_ack(int fd, uint32_t addr, size_t acked, size_t total_len, size_t chunk)
+{
+    size_t frame_len = total_len - acked;
+    if (frame_len > chunk)
+        frame_len = chunk;
+    uint64_t t0 = serial_now_us();
+    int rc = sbl_wait_ack(fd, sbl_latency_timeout_len(fd, CMD_SEND_DATA, frame_len, 0));
+    data_ack_done(fd, frame_len, t0, rc);
+    if (rc != 0)
+    {
+        fprintf(stderr, "SEND_DATA failed at 0x%08zX\n", addr + acked);
+        return -1;
+    }
+    return (int)frame_len;
+}
+
+// How far a DOWNLOAD got before it failed, in bytes from its start
+typedef struct
+{
+    size_t acked; // covered by ACKed frames
+    size_t sent;  // written to the port, ACKed or not
+} stream_pos_t;
+
+// Stream total_len bytes for a DOWNLOAD at addr in SEND_DATA frames of
+// opts->chunk_size bytes (252 by default; a multiple of 4, so a resume point
+// stays word aligned), padding past image_len with 0xFF. Up to opts->window
+// frames are written before their ACKs are read back, and GET_STATUS is only
+// issued every opts->status_interval frames and after the last one.
+//
+// Without a GET_STATUS in between, a frame is written no earlier than the ROM
+// should be done writing the one before to flash, so the bytes that reach it
+// during a write stay within its RX FIFO. The write starts at that frame's
+// ACK, so the ACK is read first whatever the window; it takes the port's rate
+// as well, and without one the stream goes lock-step.
+static int sbl_stream_data(int fd, uint32_t addr, const uint8_t *image, size_t image_len, size_t total_len,
+                           const sbl_program_opts_t *opts, stream_pos_t *pos)
+{
+    uint32_t window = opts->window ? opts->window : 1;
+    uint32_t interval = opts->status_interval ? opts->status_interval : 1;
+    size_t chunk = opts->chunk_size >= 4 && opts->chunk_size < 252 ? (opts->chunk_size & ~3u) : 252;
+    if ((window > 1 || interval > 1) && serial_get_baud(fd) <= 0)
+        window = interval = 1;
+    int paced = window > 1 || interval > 1;
+    uint64_t next_tx = 0; // when the ROM should be done writing the last frame to flash
+    uint32_t perc = 0;
+    uint32_t inflight = 0;  // frames written, ACK not yet read
+    uint32_t unchecked = 0; // frames ACKed since the last GET_STATUS
+    size_t acked = 0;       // bytes covered by ACKed frames
+    size_t checked = 0;     // bytes covered by the last successful GET_STATUS
+    int rc = -1;
+
+    size_t off = 0;
+    while (off < total_len)
+    {
+        size_t chunk_len = total_len - off;
+        if (chunk_len > chunk)
+            chunk_len = chunk;
+
+        size_t data_len = chunk_len;
+        if (off + data_len > image_len)
+            data_len = off < image_len ? image_len - off : 0; // may be 0 near the end
+
+        // Payload straight from the image, 0xFF padding for the last chunk
+        sleep_until_us(next_tx);
+        if (sbl_write_data_frame(fd, image + off, data_len, chunk_len - data_len) != 0)
+        {
+            fprintf(stderr, "SEND_DATA write failed at 0x%08zX\n", addr + off);
+            goto out;
+        }
+        ++inflight;
+        off += chunk_len;
+
+        // Checkpoint: every status_interval frames and after the last frame
+        int checkpoint = (unchecked + inflight >= interval) || off == total_len;
+
+        while (inflight >= window || (inflight && (checkpoint || paced)))
+        {
+            int n = sbl_collect_data_ack(fd, addr, acked, total_len, chunk);
+            if (n < 0)
+                goto out;
+            acked += (size_t)n;
+            --inflight;
+            ++unchecked;
+        }
+        if (paced)
+            next_tx = serial_now_us() + program_us(fd, chunk_len);
+
+        if (checkpoint)
+        {
+            uint8_t st = 0;
+            if (status_after_data(fd, chunk_len, &st) != 0)
+            {
+                fprintf(stderr, "GET_STATUS failed after 0x%08zX\n", addr + acked);
+                goto out;
+            }
+            if (st != COMMAND_RET_SUCCESS)
+            {
+                fprintf(stderr, "Prog status != SUCCESS (0x%02X) between 0x%08zX and 0x%08zX\n",
+                        st, addr + checked, addr + acked);
+                goto out;
+            }
+            checked = acked;
+            unchecked = 0;
+            next_tx = 0; // the ROM answered, so the write is over
+        }
+
+        uint32_t calc_perc = (uint32_t)((double)off / (double)total_len * 100.0);
+        if (calc_perc != perc)
+        {
+            perc = calc_perc;
+            emit(opts, SBL_EV_PROGRESS, addr, off, total_len, perc);
+        }
+    }
+    rc = 0;
+
+out:
+    pos->acked = acked;
+    pos->sent = off;
+    return rc;
+}
+
+// Compare the device CRC32 over [addr, addr + total_len) with the image
+// padded to total_len with 0xFF. The host side always comes from the image
+// bytes, never from opts->meta, so a stale page map cannot pass a bad flash.
+static int verify_crc_run(int fd, uint32_t addr, const uint8_t *image, size_t image_len, size_t total_len,
+                          const sbl_program_opts_t *opts)
+{
+    uint32_t host = data_crc(image, image_len, 0, total_len);
+
+    uint32_t dev = 0;
+    if (sbl_crc32_retry(fd, addr, (uint32_t)total_len, opts, &dev) != 0)
+    {
+        fprintf(stderr, "CRC32 readback failed\n");
+        return -1;
+    }
+    if (dev != host)
+    {
+        fprintf(stderr, "Verify failed: device CRC 0x%08X, image CRC 0x%08X\n", dev, host);
+        errno = EIO;
+        return -1;
+    }
+    emit(opts, SBL_EV_VERIFY_OK, addr, total_len, total_len, dev);
+    return 0;
+}
+
+static int sbl_verify_crc(int fd, uint32_t addr, const uint8_t *image, size_t image_len, size_t total_len,
+                          const sbl_program_opts_t *opts)
+{
+    uint64_t t0 = serial_now_us();
+    int rc = verify_crc_run(fd, addr, image, image_len, total_len, opts);
+    phase_end(fd, SBL_PHASE_VERIFY, t0);
+    return rc;
+}
+
+// DOWNLOAD [addr, addr + total_len) and stream it from image (image_len bytes, 0xFF beyond).
+static int program_range_run(int fd, uint32_t addr, const uint8_t *image, size_t image_len, size_t total_len,
+                             const sbl_program_opts_t *opts, stream_pos_t *pos)
+{
+    if (sbl_download(fd, addr, (uint32_t)total_len, 1000) != 0)
+    {
+        fprintf(stderr, "DOWNLOAD failed\n");
+        return -1;
+    }
+
+    uint8_t st = 0;
+    if (sbl_get_status(fd, 500, &st) != 0)
+    {
+        fprintf(stderr, "GET_STATUS after DOWNLOAD failed\n");
+        return -1;
+    }
+    if (st != COMMAND_RET_SUCCESS)
+    {
+        fprintf(stderr, "DOWNLOAD rejected: status 0x%02X\n", st);
+        return -1;
+    }
+
+    if (opts->stats)
+        opts->stats->downloads++;
+    int rc = sbl_stream_data(fd, addr, image, image_len, total_len, opts, pos);
+    if (opts->stats)
+        opts->stats->bytes_sent += pos->sent;
+    return rc;
+}
+
+// Where a broken transfer may erase pages again: anything below CCFG
+typedef struct
+{
+    uint32_t page_size;
+    uint32_t erase_end; // CCFG page start
+    // Set by sbl_program_sparse(), whose runs share pages: a resume may erase
+    // back to rewind_start, and the caller resends the run from that page
+    int rewind;
+    uint32_t rewind_start;
+} flash_geom_t;
+
+// Device CRC over len bytes at addr + off against the image there (0xFF past image_len)
+static int range_matches(int fd, uint32_t addr, const uint8_t *image, size_t image_len, size_t off, size_t len,
+                         const sbl_program_opts_t *opts, int *match)
+{
+    uint32_t dev = 0;
+    if (sbl_crc32_retry(fd, addr + (uint32_t)off, (uint32_t)len, opts, &dev) != 0)
+        return -1;
+    *match = dev == image_crc(opts, addr, image, image_len, off, len);
+    return 0;
+}
+
+// A DOWNLOAD of [addr, addr + total_len) restarted at start broke at pos. Find
+// how much of it the device CRC confirms, check that nothing unconfirmed was
+// programmed past that (frames in flight after a NACK land at the wrong place)
+// and erase those pages again if it was. *resume is the offset to restart from;
+// 1 means it erased the page holding addr, which starts before it (geom->rewind).
+static int resume_point(int fd, const flash_geom_t *geom, uint32_t addr, const uint8_t *image, size_t image_len,
+                        size_t start, const stream_pos_t *pos, const sbl_program_opts_t *opts, size_t *resume)
+{
+    uint32_t page = geom->page_size;
+    size_t good = start + pos->acked; // offsets from addr
+    size_t dirty = start + pos->sent; // nothing past this can have been programmed
+    int match = 1;
+
+    if (good > 0 && range_matches(fd, addr, image, image_len, 0, good, opts, &match) != 0)
+        return -1;
+    if (!match)
+    {
+        // Keep the pages before the first one that differs
+        size_t p = 0;
+        while (p < good)
+        {
+            size_t end = ((addr + p) / page + 1) * page - addr;
+            if (end > good)
+                end = good;
+            if (range_matches(fd, addr, image, image_len, p, end - p, opts, &match) != 0)
+                return -1;
+            if (!match)
+                break;
+            p = end;
+        }
+        good = p;
+    }
+
+    // The resent frames land cleanly only if the rest is still blank
+    if (dirty > good)
+    {
+        uint32_t dev = 0;
+        if (sbl_crc32_retry(fd, addr + (uint32_t)good, (uint32_t)(dirty - good), opts, &dev) != 0)
+            return -1;
+        match = dev == sbl_crc32_fill(0, 0xFF, dirty - good);
+    }
+    if (match)
+    {
+        *resume = good;
+        return 0;
+    }
+
+    uint32_t first = (addr + (uint32_t)good) & ~(page - 1);
+    uint32_t last = (addr + (uint32_t)dirty + page - 1) & ~(page - 1);
+    int back = first < addr;
+    if ((back && !(geom->rewind && first >= geom->rewind_start)) || last > geom->erase_end)
+    {
+        fprintf(stderr, "Cannot resume at 0x%08zX: its page holds data outside this download\n", addr + good);
+        errno = EIO;
+        return -1;
+    }
+    if (erase_pages_run(fd, first, last - first, page, opts) != 0)
+        return -1;
+    if (opts->stats)
+        opts->stats->pages_erased += (last - first) / page;
+    if (back)
+        return 1;
+    *resume = first - addr;
+    return 0;
+}
+
+// program_range_run(), resynchronising and resuming when the transfer breaks,
+// up to opts->retries times without progress in between. sbl_stream_data()
+// paces frames so the ROM's RX FIFO is not overrun during flash writes; should
+// a frame still be lost in flight under --window or --status-every (a write
+// slower than estimated), the rest of the range goes lock-step rather than
+// losing the next one the same way. Returns 1 when resume_point() erased the
+// page before addr, for the caller to start again from there.
+static int sbl_program_range(int fd, const flash_geom_t *geom, uint32_t addr, const uint8_t *image,
+                             size_t image_len, size_t total_len, const sbl_program_opts_t *opts)
+{
+    uint64_t t0 = serial_now_us();
+    sbl_program_opts_t run = *opts;
+    size_t start = 0;
+    int attempt = 0;
+    int rc;
+    for (;;)
+    {
+        stream_pos_t pos = {0, 0};
+        size_t skip = start < image_len ? start : image_len;
+        rc = program_range_run(fd, addr + (uint32_t)start, image + skip, image_len - skip, total_len - start,
+                               &run, &pos);
+        if (rc == 0)
+            break;
+        size_t prev = start;
+        if (!retry_after(fd, opts, &attempt, "Transfer", addr + (uint32_t)(start + pos.acked)))
+            break;
+        int rp = resume_point(fd, geom, addr, image, image_len, start, &pos, opts, &start);
+        if (rp != 0)
+        {
+            if (rp > 0)
+                rc = 1;
+            break;
+        }
+        if ((run.window > 1 || run.status_interval > 1) && pos.sent > pos.acked)
+        {
+            fprintf(stderr, "SEND_DATA frame lost in flight: lock-step for the rest of 0x%08X..0x%08zX\n", addr,
+                    addr + total_len);
+            run.window = 1;
+            run.status_interval = 1;
+        }
+        // The budget is for breaks in a row: one that still moved forward starts it afresh
+        if (start > prev)
+            attempt = 0;
+        emit(opts, SBL_EV_RESUME, addr + (uint32_t)start, start, total_len, 0);
+    }
+    phase_end(fd, SBL_PHASE_PROGRAM, t0);
+    return rc;
+}
+
+// 4 bytes at off all 0xFF (bytes past image_len count as 0xFF)
+static int word_blank(const uint8_t *image, size_t image_len, size_t off)
+{
+    for (size_t i = off; i < off + 4 && i < image_len; ++i)
+        if (image[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+// sbl_program_range() that leaves out blank words: leading and trailing blank
+// words are dropped, and interior 0xFF runs of at least opts->sparse_gap bytes
+// split the range into separate DOWNLOADs. Flash is only ever written from 1
+// to 0, so skipping 0xFF is safe whatever the erase state. total_len must
+// be a multiple of 4.
+static int sbl_program_sparse(int fd, const flash_geom_t *geom, uint32_t addr, const uint8_t *image,
+                              size_t image_len, size_t total_len, const sbl_program_opts_t *opts)
+{
+    size_t skipped = 0;
+    size_t pos = 0;
+    flash_geom_t g = *geom;
+    g.rewind = 1;
+    g.rewind_start = addr;
+
+    while (pos < total_len)
+    {
+        size_t start = pos;
+        while (start < total_len)
+        {
+            if (meta_page_blank(opts, addr, start, total_len))
+                start += opts->meta->page_size;
+            else if (word_blank(image, image_len, start))
+                start += 4;
+            else
+                break;
+        }
+        skipped += start - pos;
+        if (start >= total_len)
+            break;
+
+        // Extend until a long enough blank run or the end of the range
+        size_t end = start;
+        size_t run = 0;
+        for (size_t w = start; w < total_len;)
+        {
+            size_t step = meta_page_blank(opts, addr, w, total_len) ? opts->meta->page_size : 4;
+            if (step == 4 && !word_blank(image, image_len, w))
+            {
+                run = 0;
+                end = w + 4;
+            }
+            else if ((run += step) >= opts->sparse_gap)
+                break;
+            w += step;
+        }
+
+        size_t avail = start < image_len ? image_len - start : 0;
+        int rc = sbl_program_range(fd, &g, addr + (uint32_t)start, image + start, avail, end - start, opts);
+        if (rc > 0)
+        {
+            // A broken transfer spoilt the page this run shares with the one
+            // before; that page is blank again, so both go out from its start
+            size_t back = ((addr + (uint32_t)start) & ~(geom->page_size - 1)) - addr;
+            emit(opts, SBL_EV_RESUME, addr + (uint32_t)back, 0, end - back, 0);
+            avail = back < image_len ? image_len - back : 0;
+            rc = sbl_program_range(fd, geom, addr + (uint32_t)back, image + back, avail, end - back, opts);
+        }
+        if (rc != 0)
+            return -1;
+        pos = end;
+    }
+
+    if (opts->stats)
+        opts->stats->bytes_skipped += skipped;
+    if (skipped)
+        emit(opts, SBL_EV_SPARSE, addr, skipped, total_len, 0);
+    return 0;
+}
+
+// Program [addr, addr + total_len), sparse or in one DOWNLOAD
+static int sbl_program_span(int fd, const flash_geom_t *geom, uint32_t addr, const uint8_t *image,
+                            size_t image_len, size_t total_len, const sbl_program_opts_t *opts)
+{
+    if (opts->sparse_gap)
+        return sbl_program_sparse(fd, geom, addr, image, image_len, total_len, opts);
+    return sbl_program_range(fd, geom, addr, image, image_len, total_len, opts);
+}
+
+// CMD_CRC32 over len bytes at addr + off, the host's side worked out from the
+// image bytes while the ROM computes its own (as in verify_crc_run()). *dev_out
+// gets the device CRC, *match the comparison.
+static int verify_range(int fd, uint32_t addr, const uint8_t *image, size_t image_len, size_t off, size_t len,
+                        const sbl_program_opts_t *opts, uint32_t *dev_out, int *match)
+{
+    uint32_t a = addr + (uint32_t)off;
+    uint32_t f[3] = {a, (uint32_t)len, 0};
+    uint8_t resp[4];
+    sbl_op_t op;
+    if (sbl_op_start_cmd(&op, fd, CMD_CRC32, f, resp, sizeof(resp), 0) != 0)
+        return -1;
+    sbl_op_step(&op, POLLOUT); // the frame goes out now; sbl_op_wait() finishes it if this could not
+    uint32_t host = data_crc(image, image_len, off, len);
+
+    int attempt = 0;
+    uint32_t dev = 0;
+    if (sbl_op_wait(&op) == 4)
+        dev = (uint32_t)resp[0] << 24 | ((uint32_t)resp[1] << 16) | ((uint32_t)resp[2] << 8) | resp[3];
+    else
+    {
+        do
+        {
+            if (!retry_after(fd, opts, &attempt, "CRC32", a))
+                return -1;
+        } while (sbl_crc32(fd, a, (uint32_t)len, 0, 0, &dev) != 0);
+    }
+    *dev_out = dev;
+    *match = dev == host;
+    return 0;
+}
+
+// Program [addr, addr + total_len) (addr page aligned) in groups of
+// opts->verify_group pages, each CRC-checked right after its last frame, so
+// checking costs a CMD_CRC32 per group rather than a readback pass of its own.
+// A group that reads back wrong is erased and written again on its own, up to
+// opts->retries times; groups reaching into CCFG cannot be and fail at once.
+static int program_verified(int fd, const flash_geom_t *geom, uint32_t addr, const uint8_t *image,
+                            size_t image_len, size_t total_len, const sbl_program_opts_t *opts)
+{
+    uint32_t page_size = geom->page_size;
+    size_t group = (size_t)opts->verify_group * page_size;
+    for (size_t off = 0; off < total_len;)
+    {
+        size_t end = off + group < total_len ? off + group : total_len;
+        // The CCFG page cannot be erased again: keep it out of the groups before it
+        // so that a bad page there can still be rewritten
+        if (addr + off < geom->erase_end && addr + end > geom->erase_end)
+            end = geom->erase_end - addr;
+        size_t skip = off < image_len ? off : image_len;
+        if (sbl_program_span(fd, geom, addr + (uint32_t)off, image + skip, image_len - skip, end - off, opts) != 0)
+            return -1;
+
+        for (uint32_t attempt = 1;; ++attempt)
+        {
+            uint64_t t0 = serial_now_us();
+            uint32_t dev = 0;
+            int match = 0;
+            int rc = verify_range(fd, addr, image, image_len, off, end - off, opts, &dev, &match);
+            phase_end(fd, SBL_PHASE_VERIFY, t0);
+            if (rc != 0)
+                return -1;
+            if (match)
+            {
+                emit(opts, SBL_EV_VERIFY_OK, addr + (uint32_t)off, end - off, end - off, dev);
+                break;
+            }
+
+            uint32_t first = addr + (uint32_t)off;
+            uint32_t last = (addr + (uint32_t)end + page_size - 1) & ~(page_size - 1);
+            if (attempt > opts->retries || last > geom->erase_end)
+            {
+                fprintf(stderr, "Verify failed at 0x%08X..0x%08X: device CRC 0x%08X\n", first,
+                        addr + (uint32_t)end, dev);
+                errno = EIO;
+                return -1;
+            }
+            emit(opts, SBL_EV_REPROGRAM, first, attempt, end - off, 0);
+            if (opts->stats)
+            {
+                opts->stats->retries++;
+                opts->stats->pages_erased += (last - first) / page_size;
+            }
+            if (erase_pages_timed(fd, first, last - first, page_size, opts) != 0 ||
+                sbl_program_span(fd, geom, first, image + skip, image_len - skip, end - off, opts) != 0)
+                return -1;
+        }
+        off = end;
+    }
+    return 0;
+}
+
+// sbl_program_span(), checked group by group if opts->verify_group asks for it
+static int program_checked(int fd, const flash_geom_t *geom, uint32_t addr, const uint8_t *image,
+                           size_t image_len, size_t total_len, const sbl_program_opts_t *opts)
+{
+    if (opts->verify_group)
+        return program_verified(fd, geom, addr, image, image_len, total_len, opts);
+    return sbl_program_span(fd, geom, addr, image, image_len, total_len, opts);
+}
+
+// Delta update: only pages whose device CRC differs from the image are erased
+// and rewritten; each run of adjacent differing pages is one DOWNLOAD.
+// Pages at or past base_addr + erase_len (CCFG) are programmed without erase.
+static int sbl_program_delta(int fd, const flash_geom_t *geom,
+                             const uint8_t *image, size_t image_len, size_t total_len,
+                             uint32_t base_addr, uint32_t erase_len,
+                             const sbl_program_opts_t *opts)
+{
+    uint32_t page_size = geom->page_size;
+    uint32_t n_pages = (uint32_t)((total_len + page_size - 1) / page_size);
+    uint8_t *plan = (uint8_t *)malloc(n_pages ? n_pages : 1);
+    if (!plan)
+        return -1;
+    if (plan_erase_timed(fd, base_addr, page_size, n_pages, image, image_len, plan, opts) != 0)
+    {
+        free(plan);
+        return -1;
+    }
+
+    uint32_t changed = 0, runs = 0;
+    int rc = 0;
+    for (uint32_t p = 0; p < n_pages && rc == 0;)
+    {
+        if (plan[p] == SBL_PAGE_MATCH)
+        {
+            ++p;
+            continue;
+        }
+
+        uint32_t first = p;
+        while (p < n_pages && plan[p] != SBL_PAGE_MATCH)
+        {
+            uint32_t off = p * page_size;
+            if (plan[p] == SBL_PAGE_DIFF && off < erase_len)
+            {
+                rc = erase_pages_timed(fd, base_addr + off, page_size, page_size, opts);
+                if (rc == 0 && opts->stats)
+                    opts->stats->pages_erased++;
+            }
+            if (rc != 0)
+                break;
+            ++p;
+        }
+        if (rc != 0)
+            break;
+
+        size_t off = (size_t)first * page_size;
+        size_t end = (size_t)p * page_size;
+        if (end > total_len)
+            end = total_len;
+        size_t avail = off < image_len ? image_len - off : 0;
+        rc = program_checked(fd, geom, base_addr + (uint32_t)off, image + off, avail, end - off, opts);
+        changed += p - first;
+        ++runs;
+    }
+    free(plan);
+
+    if (opts->stats)
+        opts->stats->pages_unchanged += n_pages - changed;
+    if (rc == 0)
+        emit(opts, SBL_EV_DELTA, base_addr, changed, n_pages, runs);
+    return rc;
+}
+
+int sbl_program_binary(int fd,
+                       uint32_t flash_size, uint32_t page_size,
+                       const uint8_t *image, size_t image_len,
+                       uint32_t base_addr)
+{
+    return sbl_program_binary_ex(fd, flash_size, page_size, image, image_len, base_addr, NULL);
+}
+
+// Attach opts->metrics (or local when only a JSON summary is wanted) for one run.
+static sbl_metrics_t *metrics_open(int fd, const sbl_program_opts_t *opts, sbl_metrics_t *local)
+{
+    sbl_metrics_t *m = opts->metrics ? opts->metrics : (opts->metrics_json ? local : NULL);
+    if (!m)
+        return NULL;
+    FILE *log = opts->metrics ? m->log : NULL;
+    sbl_metrics_init(m);
+    m->log = log;
+    sbl_metrics_begin(fd, m);
+    return m;
+}
+
+static void metrics_close(int fd, sbl_metrics_t *m, const sbl_program_opts_t *opts, int rc)
+{
+    if (!m)
+        return;
+    int err = errno;
+    sbl_metrics_end(fd);
+    if (opts->metrics_json)
+        sbl_metrics_write_json(opts->metrics_json, m, opts->stats, rc);
+    errno = err;
+}
+
+// Erase, program and (if asked) verify one page-aligned span; no stats reset, no RESET.
+static int sbl_program_image(int fd,
+                             uint32_t flash_size, uint32_t page_size,
+                             const uint8_t *image, size_t image_len,
+                             uint32_t base_addr,
+                             const sbl_program_opts_t *opts)
+{
+    if (base_addr % page_size)
+    {
+        fprintf(stderr, "Error: base_addr 0x%08X not page aligned (page size %u)\n", base_addr, page_size);
+        return -1;
+    }
+
+    // Erase only what’s needed (rounded up to page size)
+    uint32_t erase_len = (image_len + page_size - 1) & ~(page_size - 1);
+    uint32_t last_page_start = flash_size - page_size; // CCFG
+    if (base_addr + erase_len > last_page_start)
+        erase_len = last_page_start - base_addr;
+    flash_geom_t geom = {page_size, last_page_start, 0, 0};
+
+    size_t total_len = word_pad(image_len);
+
+    if (opts->delta)
+    {
+        if (sbl_program_delta(fd, &geom, image, image_len, total_len, base_addr, erase_len, opts) != 0)
+            return -1;
+    }
+    else
+    {
+        if (sbl_erase_for_image(fd, flash_size, page_size, image, image_len, base_addr, erase_len, opts) != 0)
+            return -1;
+        if (program_checked(fd, &geom, base_addr, image, image_len, total_len, opts) != 0)
+            return -1;
+    }
+
+    // With sparse status checks the CRC is the backstop for anything GET_STATUS missed;
+    // verify groups have checked every byte already
+    if (!opts->verify_group && (opts->verify || opts->delta || opts->status_interval > 1 || opts->window > 1))
+    {
+        if (sbl_verify_crc(fd, base_addr, image, image_len, total_len, opts) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int sbl_program_binary_ex(int fd,
+                          uint32_t flash_size, uint32_t page_size,
+                          const uint8_t *image, size_t image_len,
+                          uint32_t base_addr,
+                          const sbl_program_opts_t *opts)
+{
+    sbl_program_opts_t local;
+    if (opts)
+        local = *opts;
+    else
+        sbl_program_opts_init(&local);
+    if (local.meta && local.meta->page_size != page_size)
+        local.meta = NULL;
+    opts = &local;
+
+    if (local.ccfg)
+    {
+        sbl_segment_t seg = {base_addr, image, image_len};
+        return sbl_program_segments(fd, flash_size, page_size, &seg, 1, opts);
+    }
+
+    // The JSON summary reports payload counters even if the caller doesn't want them
+    sbl_program_stats_t local_stats;
+    if (!local.stats && local.metrics_json)
+        local.stats = &local_stats;
+    if (opts->stats)
+        memset(opts->stats, 0, sizeof(*opts->stats));
+
+    sbl_metrics_t local_metrics;
+    sbl_metrics_t *m = metrics_open(fd, opts, &local_metrics);
+
+    int rc = sbl_program_image(fd, flash_size, page_size, image, image_len, base_addr, opts);
+
+    // Optional reset into app
+    if (rc == 0 && !opts->no_reset)
+        sbl_reset(fd, 1000);
+
+    metrics_close(fd, m, opts, rc);
+    return rc;
+}
+
+// One sbl_program_image() per group of segments on shared or adjacent pages.
+static int program_segment_groups(int fd, uint32_t flash_size, uint32_t page_size,
+                                  const sbl_segment_t *segs, size_t n_segs,
+                                  const sbl_program_opts_t *opts)
+{
+    // Segments on shared or back-to-back pages are programmed together, so regions
+    // that follow each other (bootloader, then application) take one DOWNLOAD,
+    // the 0xFF filler between them included (under two pages each); only
+    // opts->sparse_gap splits it. Whole blank pages between groups are never
+    // erased or sent
+    for (size_t i = 0; i < n_segs;)
+    {
+        uint32_t start = segs[i].addr & ~(page_size - 1);
+        uint32_t end = segs[i].addr + (uint32_t)segs[i].len;
+        size_t j = i + 1;
+        while (j < n_segs && (segs[j].addr & ~(page_size - 1)) <= ((end + page_size - 1) & ~(page_size - 1)))
+        {
+            end = segs[j].addr + (uint32_t)segs[j].len;
+            ++j;
+        }
+
+        int rc;
+        if (j == i + 1 && segs[i].addr == start)
+        {
+            // The common case: program straight from the caller's buffer
+            rc = sbl_program_image(fd, flash_size, page_size, segs[i].data, segs[i].len, start, opts);
+        }
+        else
+        {
+            size_t len = end - start;
+            uint8_t *buf = (uint8_t *)malloc(len);
+            if (!buf)
+                return -1;
+            memset(buf, 0xFF, len);
+            for (size_t k = i; k < j; ++k)
+                memcpy(buf + (segs[k].addr - start), segs[k].data, segs[k].len);
+            rc = sbl_program_image(fd, flash_size, page_size, buf, len, start, opts);
+            free(buf);
+        }
+        if (rc != 0)
+            return -1;
+        i = j;
+    }
+
+    return 0;
+}
+
+// Erase the CCFG page and write what the segments put there, as the last step so
+// the time with a blank CCFG stays short, then CRC-check the page whatever opts->verify says.
+static int program_ccfg(int fd, uint32_t flash_size, uint32_t page_size,
+                        const sbl_segment_t *segs, size_t n_segs, const sbl_program_opts_t *opts)
+{
+    uint32_t ccfg = flash_size - page_size;
+    uint8_t *page = (uint8_t *)malloc(page_size);
+    if (!page)
+        return -1;
+    memset(page, 0xFF, page_size);
+    int have = 0;
+    for (size_t i = 0; i < n_segs; ++i)
+    {
+        uint32_t end = segs[i].addr + (uint32_t)segs[i].len;
+        if (end <= ccfg)
+            continue;
+        uint32_t from = segs[i].addr > ccfg ? segs[i].addr : ccfg;
+        memcpy(page + (from - ccfg), segs[i].data + (from - segs[i].addr), end - from);
+        have = 1;
+    }
+    if (!have)
+    {
+        free(page);
+        return 0;
+    }
+
+    // BL_CONFIG is the 11th word from the end on CC13x0 and CC13x2 alike
+    if (page_size >= 0x28 && page[page_size - 0x25] != 0xC5)
+        fprintf(stderr, "Warning: this CCFG disables the ROM bootloader (BOOTLOADER_ENABLE 0x%02X)\n",
+                page[page_size - 0x25]);
+
+    int rc = 0;
+    uint32_t dev = 0;
+    if (opts->delta && sbl_crc32_retry(fd, ccfg, page_size, opts, &dev) == 0 &&
+        dev == image_crc(opts, ccfg, page, page_size, 0, page_size))
+    {
+        emit(opts, SBL_EV_CCFG, ccfg, 0, page_size, 0);
+        if (opts->stats)
+            opts->stats->pages_unchanged++;
+        free(page);
+        return 0;
+    }
+
+    // Bank erase already took the CCFG page along
+    if (opts->erase != SBL_ERASE_NONE)
+    {
+        rc = erase_pages_timed(fd, ccfg, page_size, page_size, opts);
+        if (rc == 0 && opts->stats)
+            opts->stats->pages_erased++;
+    }
+    if (rc == 0)
+    {
+        // The page is blank now: only the CCFG words themselves go over the wire
+        sbl_program_opts_t ccfg_opts = *opts;
+        if (!ccfg_opts.sparse_gap)
+            ccfg_opts.sparse_gap = 256;
+        flash_geom_t geom = {page_size, flash_size, 0, 0};
+        rc = sbl_program_span(fd, &geom, ccfg, page, page_size, page_size, &ccfg_opts);
+    }
+    if (rc == 0)
+        rc = sbl_verify_crc(fd, ccfg, page, page_size, page_size, opts);
+    if (rc == 0)
+        emit(opts, SBL_EV_CCFG, ccfg, page_size, page_size, 1);
+    free(page);
+    return rc;
+}
+
+// Everything below the CCFG page, then (opts->ccfg) the CCFG page itself.
+static int program_segments_run(int fd, uint32_t flash_size, uint32_t page_size,
+                                const sbl_segment_t *segs, size_t n_segs, sbl_program_opts_t *opts)
+{
+    uint32_t ccfg = flash_size - page_size;
+
+    // One bank erase for the whole image rather than one per group
+    if (opts->erase == SBL_ERASE_BANK && !opts->delta)
+    {
+        const sbl_segment_t *last = &segs[n_segs - 1];
+        if (last->addr + last->len <= ccfg)
+            fprintf(stderr, "Warning: bank erase also clears CCFG, which this image does not rewrite\n");
+        if (sbl_bank_erase_checked(fd, opts) != 0)
+            return -1;
+        if (opts->stats)
+            opts->stats->pages_erased++;
+        opts->erase = SBL_ERASE_NONE;
+    }
+
+    if (!opts->ccfg)
+        return program_segment_groups(fd, flash_size, page_size, segs, n_segs, opts);
+
+    // Clip the segment list at the CCFG page; that page is written on its own at the end
+    sbl_segment_t *main_segs = (sbl_segment_t *)malloc(n_segs * sizeof(*main_segs));
+    if (!main_segs)
+        return -1;
+    size_t n_main = 0;
+    for (size_t i = 0; i < n_segs && segs[i].addr < ccfg; ++i)
+    {
+        main_segs[n_main] = segs[i];
+        if (segs[i].addr + segs[i].len > ccfg)
+            main_segs[n_main].len = ccfg - segs[i].addr;
+        ++n_main;
+    }
+    int rc = program_segment_groups(fd, flash_size, page_size, main_segs, n_main, opts);
+    free(main_segs);
+    if (rc != 0)
+        return -1;
+    return program_ccfg(fd, flash_size, page_size, segs, n_segs, opts);
+}
+
+int sbl_program_segments(int fd,
+                         uint32_t flash_size, uint32_t page_size,
+                         const sbl_segment_t *segs, size_t n_segs,
+                         const sbl_program_opts_t *opts)
+{
+    sbl_program_opts_t local;
+    if (opts)
+        local = *opts;
+    else
+        sbl_program_opts_init(&local);
+    if (local.meta && local.meta->page_size != page_size)
+        local.meta = NULL;
+
+    sbl_program_stats_t local_stats;
+    if (!local.stats && local.metrics_json)
+        local.stats = &local_stats;
+    if (local.stats)
+        memset(local.stats, 0, sizeof(*local.stats));
+
+    if (!segs || n_segs == 0 || page_size == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < n_segs; ++i)
+    {
+        uint64_t end = (uint64_t)segs[i].addr + segs[i].len;
+        if (end > flash_size || (i > 0 && segs[i].addr < segs[i - 1].addr + segs[i - 1].len))
+        {
+            fprintf(stderr, "Error: segment 0x%08X+0x%zX outside flash or out of order\n",
+                    segs[i].addr, segs[i].len);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    sbl_metrics_t local_metrics;
+    sbl_metrics_t *m = metrics_open(fd, &local, &local_metrics);
+
+    int rc = program_segments_run(fd, flash_size, page_size, segs, n_segs, &local);
+    if (rc == 0 && !local.no_reset)
+        sbl_reset(fd, 1000);
+
+    metrics_close(fd, m, &local, rc);
+    return rc;
+}
+
+int sbl_verify_segments(int fd, const sbl_segment_t *segs, size_t n_segs)
+{
+    return sbl_verify_segments_ex(fd, segs, n_segs, NULL);
+}
+
+int sbl_verify_segments_ex(int fd, const sbl_segment_t *segs, size_t n_segs, const sbl_program_opts_t *opts)
+{
+    for (size_t i = 0; i < n_segs; ++i)
+    {
+        if (sbl_verify_crc(fd, segs[i].addr, segs[i].data, segs[i].len, word_pad(segs[i].len), opts) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int sbl_verify_image(int fd, uint32_t addr, const uint8_t *image, size_t image_len)
+{
+    return sbl_verify_crc(fd, addr, image, image_len, word_pad(image_len), NULL);
+}
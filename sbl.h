@@ -1,26 +1,67 @@
 #ifndef SBL_H
 #define SBL_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
 
+// Exported from the shared library (built with -fvisibility=hidden)
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
+
 // ACK/NACK per TI SBL
 #define SBL_ACK 0xCC
 #define SBL_NACK 0x33
 
-// Bootloader command IDs (CC13xx/CC26xx/CC2538 family)
+// Bootloader commands (CC13xx/CC26xx/CC2538 family), one row each:
+// X(name, id, field widths..., response bytes, default timeout ms).
+// Up to three fields follow the command byte big-endian, each 1 or 4 bytes wide
+// (0 = no such field), so every frame length is a compile-time constant.
+// SEND_DATA carries a raw payload instead; a response of -1 depends on the fields.
+#define SBL_COMMANDS(X)                        \
+    X(PING, 0x20, 0, 0, 0, 0, 100)             \
+    X(DOWNLOAD, 0x21, 4, 4, 0, 0, 1000)        \
+    X(GET_STATUS, 0x23, 0, 0, 0, 1, 500)       \
+    X(SEND_DATA, 0x24, 0, 0, 0, 0, 1000)       \
+    X(RESET, 0x25, 0, 0, 0, 0, 1000)           \
+    X(SECTOR_ERASE, 0x26, 4, 0, 0, 0, 5000)    \
+    X(CRC32, 0x27, 4, 4, 4, 4, 5000)           \
+    X(GET_CHIP_ID, 0x28, 0, 0, 0, 4, 500)      \
+    X(MEMORY_READ, 0x2A, 4, 1, 1, -1, 1000)    \
+    X(BANK_ERASE, 0x2C, 0, 0, 0, 0, 10000)     \
+    X(SET_CCFG, 0x2D, 4, 4, 0, 0, 1000)
+
 enum
 {
-    CMD_PING = 0x20,
-    CMD_DOWNLOAD = 0x21,
-    CMD_GET_STATUS = 0x23,
-    CMD_SEND_DATA = 0x24,
-    CMD_RESET = 0x25,
-    CMD_SECTOR_ERASE = 0x26,
-    CMD_CRC32 = 0x27,
-    CMD_GET_CHIP_ID = 0x28
+#define SBL_CMD_ENUM(name, id, w0, w1, w2, resp, timeout) CMD_##name = id,
+    SBL_COMMANDS(SBL_CMD_ENUM)
+#undef SBL_CMD_ENUM
 };
 
+// Longest fixed command frame: SIZE + CHECKSUM + CMD + three 32-bit fields
+#define SBL_CMD_FRAME_MAX 15
+
+// Table entry of a command, NULL for an id not in SBL_COMMANDS
+typedef struct
+{
+    const char *name;
+    uint8_t id;
+    uint8_t n_fields;
+    uint8_t width[3];   // bytes per field
+    uint8_t frame_len;  // whole frame (SEND_DATA: without its payload)
+    int8_t resp_len;    // 0 = ACK only, -1 = depends on the fields
+    uint16_t timeout_ms;
+} sbl_cmd_info_t;
+
+const sbl_cmd_info_t *sbl_cmd_info(uint8_t cmd);
+
+// Encode cmd with its fields (n_fields of them, in table order) as a complete
+// frame into frame[SBL_CMD_FRAME_MAX]. Returns the frame length, -1 for an
+// unknown command or SEND_DATA (see sbl_send_data()).
+int sbl_cmd_encode(uint8_t *frame, uint8_t cmd, const uint32_t *fields);
+
 // GET_STATUS return codes (subset)
 enum
 {
@@ -35,29 +76,414 @@ enum
 // Returns 0 on success, -1 on error/timeout.
 int sbl_autobaud(int fd, int timeout_ms);
 
-// Try multiple bauds by opening the port for each baud.
+// Try multiple bauds on one open port, switching rate with serial_set_baud().
+// The last rate that worked for this adapter (see sbl_baud_cache_get()) is tried
+// first, and a new winner is written back. dev_path only keys the cache and may
+// be NULL. The port is left at the working rate.
 // Returns 0 on success and writes the working baud to *baud_ok.
 // Returns -1 if none worked.
+int sbl_autobaud_scan_fd(int fd, const char *dev_path,
+                         const int *bauds, size_t n_bauds,
+                         int timeout_ms, int *baud_ok);
+
+// Same as sbl_autobaud_scan_fd() on a port it opens once and closes again.
 int sbl_autobaud_scan(const char *dev_path,
                       const int *bauds, size_t n_bauds,
                       int timeout_ms, int *baud_ok);
 
+// Last working baud per adapter (serial_adapter_id()), kept in
+// $CC1310_BAUD_CACHE, else $XDG_CACHE_HOME/cc1310_flasher.baud or
+// ~/.cache/cc1310_flasher.baud. get returns 0 when nothing is cached. put
+// rewrites the file through a temp file and rename(), one writer at a time
+// (threads and processes alike), so concurrent puts keep every entry.
+int sbl_baud_cache_get(const char *adapter_id);
+int sbl_baud_cache_put(const char *adapter_id, int baud);
+
+// Get back in step with the ROM after a failed command: complete any frame it is
+// still receiving with 0x00 filler, drop whatever it answered, then PING (and
+// if that gets nothing, autobaud again). Returns 0 once the ROM ACKs, -1 if not.
+int sbl_resync(int fd, int timeout_ms);
+
+// --- Adaptive timeouts ---
+// Every command's round trip is tracked per port, command and size the way TCP
+// estimates its RTO: the timeout becomes srtt + max(4 * rttvar, srtt), clamped
+// between SBL_RTO_MIN_MS and the caller's timeout, which stays the worst case.
+// Until a command has SBL_RTO_SAMPLES samples the caller's timeout is used as
+// is; each timeout in a row doubles the estimate. A successful sbl_autobaud()
+// starts the port afresh.
+#define SBL_RTO_MIN_MS 50
+#define SBL_RTO_SAMPLES 4
+
+// Timeout the next cmd on fd gets when asked for ceiling_ms (<= 0: table default).
+// Commands whose round trip grows with their size are estimated per size class
+// of bytes (CRC32: length x (repeat + 1), MEMORY_READ: bytes read, SEND_DATA:
+// payload), so short CRCs never set the timeout of a long one; a class with too
+// few samples gets ceiling_ms. sbl_latency_timeout() is the fixed-cost class.
+int sbl_latency_timeout(int fd, uint8_t cmd, int ceiling_ms);
+int sbl_latency_timeout_len(int fd, uint8_t cmd, uint64_t bytes, int ceiling_ms);
+void sbl_latency_reset(int fd);
+// fixed != 0: always use the caller's timeouts on fd
+void sbl_latency_set_fixed(int fd, int fixed);
+
+// --- Bootloader entry over the adapter's modem lines ---
+typedef enum
+{
+    SBL_LINE_NONE = 0,
+    SBL_LINE_DTR,
+    SBL_LINE_RTS
+} sbl_line_t;
+
+// Which line drives the target's nRESET and bootloader backdoor pin (CCFG
+// BL_PIN_NUMBER), and for how long. sbl_entry_init() gives the usual XDS110 /
+// LaunchPad wiring: RTS on nRESET, DTR on the backdoor pin, and an asserted
+// line pulls its pin low (backdoor active low, BL_LEVEL 0).
+typedef struct
+{
+    sbl_line_t reset_line;
+    sbl_line_t backdoor_line; // SBL_LINE_NONE: reset only (a blank part starts the ROM by itself)
+    int reset_invert;         // nRESET is low while the line is released
+    int backdoor_invert;      // backdoor is active with the line released (BL_LEVEL 1 boards)
+    int reset_ms;             // nRESET held low
+    int hold_ms;              // backdoor kept active after reset is released, while the ROM samples it
+    int settle_ms;            // before the first byte to the ROM
+} sbl_entry_t;
+
+void sbl_entry_init(sbl_entry_t *e);
+
+// Pulse nRESET with the backdoor pin active so the ROM bootloader starts; it then
+// still needs sbl_autobaud(). The lines are left released, so a later RESET
+// command boots the application. Returns 0 on success, -1 on error.
+int sbl_enter_bootloader(int fd, const sbl_entry_t *e);
+
+// Find the fastest rate the adapter and ROM handle cleanly on an open port:
+// candidates are tried highest first with serial_set_baud(), and a rate only
+// counts if autobaud, PING and GET_STATUS all succeed at it. The ROM autobauds
+// once per reset and a failed attempt can leave it locked at a garbled rate,
+// so each candidate starts with sbl_enter_bootloader(entry). Without entry
+// wiring (NULL) only the highest candidate the adapter takes can be tried. The
+// port is left at the winning rate. Returns 0 and writes it to *baud_ok, -1 if
+// none worked.
+int sbl_autobaud_probe(int fd, const int *bauds, size_t n_bauds, const sbl_entry_t *entry,
+                       int timeout_ms, int *baud_ok);
+
 // Send a generic SBL packet: data[0] must be the CMD byte.
 // Returns 0 on ACK, -1 on NACK/error; optionally reads a response payload into out.
 int sbl_send_cmd(int fd, const uint8_t *data, size_t len,
                  uint8_t *out, size_t out_max, int timeout_ms);
 
-// SBL functions
+// --- Resumable command API ---
+// sbl_op_start() queues one command; then poll() the fd for sbl_op_events()
+// with sbl_op_timeout() and hand the revents to sbl_op_step() until it returns 1.
+// sbl_op_chain() sends the next command in the same write as the ACK of this
+// one's response frame; it is then picked up with sbl_op_start_sent().
+// sbl_op_step() consumes every byte already received before returning 0, so a
+// plain poll() on the fd is a sufficient wake-up. Several ops on different fds
+// can share one poll() set. sbl_op_wait() is the blocking form.
+typedef enum
+{
+    SBL_OP_SEND = 1, // writing the command frame
+    SBL_OP_WAIT_ACK,
+    SBL_OP_RESP_SIZE, // waiting for the response frame's SIZE byte
+    SBL_OP_RESP_BODY,
+    SBL_OP_SEND_ACK, // writing our ACK of the response frame
+    SBL_OP_DONE
+} sbl_op_state_t;
+
+typedef struct
+{
+    int fd;
+    sbl_op_state_t state;
+    uint8_t tx[2 + 2 + 253]; // command frame, later our response ACK (+ chained frame)
+    size_t tx_len;
+    size_t tx_off;
+    int resp_len; // expected response payload; 0 = none, -1 = unknown
+    uint8_t *out;
+    size_t out_max;
+    uint8_t rx_size;
+    uint8_t rx_csum;
+    int rx_have_csum;
+    size_t rx_got;
+    int timeout_ms;
+    uint64_t deadline_ms;
+    int result; // when done: payload length (0 = ACK only) or -1
+    int err;    // errno for result -1
+    uint8_t cmd;
+    uint64_t t_start_us, t_sent_us, t_ack_us; // serial_now_us(), for sbl_metrics_t
+    uint64_t work; // bytes the ROM goes through, for the size class of the timeout
+    const uint8_t *chain; // sbl_op_chain() frame: borrowed until the op is done
+    size_t chain_len;
+    int chain_sent; // when done: the chained frame went out
+} sbl_op_t;
+
+// Returns 0 when queued, -1 on bad arguments.
+int sbl_op_start(sbl_op_t *op, int fd, const uint8_t *data, size_t len,
+                 uint8_t *out, size_t out_max, int timeout_ms);
+short sbl_op_events(const sbl_op_t *op);       // POLLIN / POLLOUT, 0 when done
+int sbl_op_timeout(const sbl_op_t *op);        // ms until the current deadline
+int sbl_op_step(sbl_op_t *op, short revents);  // 1 = finished (see result/err), 0 = keep polling
+int sbl_op_wait(sbl_op_t *op);                 // run to completion; returns op->result
+// Only for ops that read a response frame (out set); frame is a complete one
+// from sbl_cmd_encode(). 0 / -1.
+int sbl_op_chain(sbl_op_t *op, const uint8_t *frame, size_t frame_len);
+// For a command whose frame is already out (chained): starts at its ACK.
+int sbl_op_start_sent(sbl_op_t *op, int fd, uint8_t cmd, uint8_t *out, size_t out_max, int timeout_ms);
+// sbl_op_start() for a table command: the frame is encoded straight into op->tx
+// (see sbl_cmd_encode()), the response length comes from the table and
+// timeout_ms <= 0 takes the command's default timeout.
+int sbl_op_start_cmd(sbl_op_t *op, int fd, uint8_t cmd, const uint32_t *fields,
+                     uint8_t *out, size_t out_max, int timeout_ms);
+
+// SBL functions. timeout_ms <= 0 takes the command's default from SBL_COMMANDS.
 int sbl_ping(int fd, int timeout_ms);
 int sbl_get_status(int fd, int timeout_ms, uint8_t *status_out);
 int sbl_get_chip_id(int fd, int timeout_ms, uint32_t *chip_id_out);
 int sbl_reset(int fd, int timeout_ms);
 int sbl_download(int fd, uint32_t addr, uint32_t total_len, int timeout_ms);
 int sbl_sector_erase(int fd, uint32_t addr, int timeout_ms);
+int sbl_bank_erase(int fd, int timeout_ms); // whole main bank, CCFG page included
 int sbl_send_data(int fd, const uint8_t *chunk, size_t n, int timeout_ms);
 int sbl_crc32(int fd, uint32_t addr, uint32_t len, uint32_t repeat, int timeout_ms, uint32_t *crc_out);
+
+// SET_CCFG field IDs (CC13x0 / CC26x0 ROM)
+#define SBL_CCFG_IMAGE_VALID 1
+#define SBL_CCFG_BANK_ERASE_DIS 8
+#define SBL_CCFG_BL_BACKDOOR_EN 11
+#define SBL_CCFG_BL_BACKDOOR_PIN 12
+#define SBL_CCFG_BL_BACKDOOR_LEVEL 13
+#define SBL_CCFG_BL_ENABLE 14
+
+// Write one CCFG field; the ROM programs it without erasing the page.
+int sbl_set_ccfg(int fd, uint32_t field_id, uint32_t value, int timeout_ms);
+
+// MEMORY_READ access widths and the largest count the ROM takes for each
+#define SBL_READ_8BIT 0
+#define SBL_READ_32BIT 1
+#define SBL_READ_MAX_8BIT 253
+#define SBL_READ_MAX_32BIT 63
+
+// One MEMORY_READ of count bytes (8-bit) or words (32-bit, addr word aligned)
+// into out, in memory order. Returns 0 on success, -1 on error.
+int sbl_memory_read(int fd, uint32_t addr, int type, uint8_t count, uint8_t *out, int timeout_ms);
+
+// Read len bytes at addr with 32-bit MEMORY_READs of 63 words (8-bit ones for
+// an unaligned head or tail), each request going out with the ACK of the
+// previous response. A failed read is resynchronised and repeated up to
+// retries times. Returns 0 on success, -1 on error.
+int sbl_read_range(int fd, uint32_t addr, uint8_t *out, size_t len, int retries);
 int sbl_program_binary(int fd,
                        uint32_t flash_size, uint32_t page_size,
                        const uint8_t *image, size_t image_len,
                        uint32_t base_addr);
+
+// Erase len bytes from page-aligned addr one SECTOR_ERASE (+ GET_STATUS) per page.
+// Returns 0 on success, -1 on the first failing page.
+int sbl_erase_pages(int fd, uint32_t addr, uint32_t len, uint32_t page_size);
+
+// Device page state as classified by sbl_plan_erase()
+enum
+{
+    SBL_PAGE_BLANK = 0, // all 0xFF (and the image wants something else)
+    SBL_PAGE_MATCH = 1, // already holds the image's bytes, blank or not
+    SBL_PAGE_DIFF = 2   // anything else; must be erased before programming
+};
+
+// Classify n_pages pages starting at page-aligned addr by comparing the device's
+// CMD_CRC32 of each page with the CRC of a blank page and of the image's bytes
+// (image starts at addr, 0xFF past image_len). Writes one SBL_PAGE_* per page to plan.
+// Returns 0 on success, -1 on error.
+int sbl_plan_erase(int fd, uint32_t addr, uint32_t page_size, uint32_t n_pages,
+                   const uint8_t *image, size_t image_len, uint8_t *plan);
+
+// How sbl_program_binary_ex() erases before downloading
+typedef enum
+{
+    SBL_ERASE_PAGES = 0, // SECTOR_ERASE every page the image covers (CCFG excluded)
+    SBL_ERASE_SMART,     // sbl_plan_erase() and only erase non-blank pages; one BANK_ERASE
+                         // instead when the image spans the whole flash and every page needs it
+    SBL_ERASE_BANK,      // one BANK_ERASE, CCFG included
+    SBL_ERASE_NONE       // nothing; the caller already erased
+} sbl_erase_mode_t;
+
+// Counters filled in by sbl_program_binary_ex() when opts->stats is set
+typedef struct
+{
+    uint32_t pages_erased;    // SECTOR_ERASE pages (a bank erase counts as one)
+    uint32_t pages_unchanged; // delta: pages left alone because their CRC matched
+    uint32_t downloads;       // DOWNLOAD commands issued
+    size_t bytes_sent;        // SEND_DATA payload bytes
+    size_t bytes_skipped;     // blank bytes not transmitted (sparse mode)
+    uint32_t retries;         // commands / transfers repeated after sbl_resync()
+} sbl_program_stats_t;
+
+// Latency histogram: bucket i counts samples in [2^i, 2^(i+1)) microseconds
+// (bucket 0 also takes anything below 1 us, the last one everything above).
+#define SBL_HIST_BUCKETS 24
+typedef struct
+{
+    uint32_t count;
+    uint64_t sum_us;
+    uint64_t min_us;
+    uint64_t max_us;
+    uint32_t bucket[SBL_HIST_BUCKETS];
+} sbl_hist_t;
+
+// Upper bound of the bucket holding the p-th percentile (0 < p <= 100), 0 if empty.
+uint64_t sbl_hist_percentile(const sbl_hist_t *h, double p);
+
+typedef enum
+{
+    SBL_PHASE_PLAN = 0, // CRC32 queries deciding what to erase / rewrite
+    SBL_PHASE_ERASE,
+    SBL_PHASE_PROGRAM,  // DOWNLOAD + SEND_DATA + GET_STATUS checkpoints
+    SBL_PHASE_VERIFY,
+    SBL_PHASE_COUNT
+} sbl_phase_t;
+
+// Timing collected while attached to a port with sbl_metrics_begin().
+typedef struct
+{
+    uint64_t start_us, end_us; // serial_now_us() at begin / end
+    uint64_t phase_us[SBL_PHASE_COUNT];
+    uint32_t commands;         // framed commands completed (SEND_DATA included)
+    sbl_hist_t ack;            // command frame written -> ACK
+    sbl_hist_t data_ack;       // time spent waiting for a pipelined SEND_DATA ACK
+    sbl_hist_t status;         // GET_STATUS round trip
+    sbl_hist_t erase;          // SECTOR_ERASE / BANK_ERASE round trip
+    uint64_t wire_tx, wire_rx; // bytes on the wire while attached
+    uint64_t tx_base, rx_base; // serial_get_counters() at begin
+    FILE *log;                 // optional: one line per command with its timestamp
+} sbl_metrics_t;
+
+void sbl_metrics_init(sbl_metrics_t *m);
+// Attach m to fd until sbl_metrics_end(); SBL calls on fd then record into it.
+void sbl_metrics_begin(int fd, sbl_metrics_t *m);
+void sbl_metrics_end(int fd);
+// JSON summary of m (and stats if not NULL) for a run that returned rc.
+void sbl_metrics_write_json(FILE *out, const sbl_metrics_t *m, const sbl_program_stats_t *stats, int rc);
+
+// What sbl_program_binary_ex() / sbl_program_segments() report through opts->progress.
+// Nothing is printed to stdout by the library; without a callback these are dropped.
+typedef enum
+{
+    SBL_EV_ERASE_PLAN = 0, // done = pages that need erasing, total = pages planned
+    SBL_EV_BANK_ERASED,
+    SBL_EV_PAGE_ERASED,    // addr = page, done / total = pages erased so far in this run
+    SBL_EV_PROGRESS,       // addr = DOWNLOAD start, done / total = bytes sent, value = percent
+    SBL_EV_RESUME,         // addr = where a broken transfer restarts
+    SBL_EV_SPARSE,         // addr = span start, total = span length, done = blank bytes skipped
+    SBL_EV_DELTA,          // done = pages rewritten, total = pages compared, value = runs
+    SBL_EV_VERIFY_OK,      // addr / total = range checked, value = CRC32
+    SBL_EV_CCFG,           // addr = CCFG page, value = 1 written, 0 unchanged
+    SBL_EV_REPROGRAM,      // addr / total = verify group read back wrong, done = attempt
+    SBL_EV_COUNT
+} sbl_event_type_t;
+
+typedef struct
+{
+    sbl_event_type_t type;
+    uint32_t addr;
+    size_t done;
+    size_t total;
+    uint32_t value;
+} sbl_event_t;
+
+// Called on the programming thread between serial commands: it must return
+// quickly and never block on terminal I/O (queue the event and print elsewhere).
+typedef void (*sbl_progress_fn)(const sbl_event_t *ev, void *user);
+
+// Short lower-case name of an event type ("progress", "page_erased", ...)
+const char *sbl_event_name(sbl_event_type_t type);
+
+// Per-page facts about an image as it will sit in flash, worked out once (see
+// sbl_image_meta_build() in sbl_image.h) and shared by every run and device that
+// programs it. Through opts->meta, delta planning, smart erase and resume checks
+// take page CRCs from here and sparse mode skips blank pages whole; verification
+// always compares against CRCs of the image bytes themselves.
+typedef struct
+{
+    uint32_t page_size;
+    uint32_t first_page; // address of the first page the image touches
+    uint32_t n_pages;    // from first_page up to the last page it touches
+    uint32_t *crc;       // CRC32 of each page, 0xFF where the image has no data
+    uint8_t *blank;      // 1 where the page is all 0xFF
+} sbl_image_meta_t;
+
+// Programming options for sbl_program_binary_ex(); fill with sbl_program_opts_init().
+typedef struct
+{
+    sbl_erase_mode_t erase;
+    uint32_t status_interval; // GET_STATUS after every Nth SEND_DATA frame (1 = every frame)
+    uint32_t window;          // SEND_DATA frames written before their ACKs are read (1 = lock-step).
+                              // Either > 1 holds a frame sent without GET_STATUS before it
+                              // until the ACK of the last one plus its flash write, so it fits
+                              // the ROM's 32-byte RX FIFO; the write only starts at the ACK,
+                              // which is therefore read first whatever the window. A range
+                              // that still loses a frame continues lock-step
+    uint32_t chunk_size;      // SEND_DATA payload bytes per frame, rounded down to a multiple
+                              // of 4 (0 = the ROM's maximum, 252)
+    int verify;               // CRC32 readback after programming (default on; forced when either of the above > 1)
+    uint32_t verify_group;    // >0: CRC32 every this many pages as soon as they are written and
+                              // rewrite just a group that reads back wrong (replaces the final readback)
+    int delta;                // only erase/rewrite pages whose device CRC differs (erase mode unused)
+    uint32_t sparse_gap;      // >0: skip word-aligned 0xFF runs of at least this many bytes
+    sbl_program_stats_t *stats; // optional, zeroed and filled in
+    int no_reset;             // stay in the bootloader instead of RESET at the end
+    sbl_metrics_t *metrics;   // optional, initialised and filled in
+    FILE *metrics_json;       // optional: sbl_metrics_write_json() here when done
+    uint32_t retries;         // per failed command or broken transfer (default 3, 0 = abort at once)
+    int ccfg;                 // erase and write the CCFG page last, then CRC-check it; otherwise
+                              // CCFG bytes are programmed over the page unerased
+    sbl_progress_fn progress; // optional event callback, see sbl_event_t
+    void *progress_user;
+    const sbl_image_meta_t *meta; // optional: built from exactly the image being programmed
+                                  // at the same page_size (ignored otherwise)
+} sbl_program_opts_t;
+
+void sbl_program_opts_init(sbl_program_opts_t *opts);
+
+// sbl_program_binary() with options; opts == NULL behaves like sbl_program_binary().
+// With opts->retries a broken transfer is resynchronised and resumed from the
+// last position the device CRC confirms, re-erasing a page only if it must.
+int sbl_program_binary_ex(int fd,
+                          uint32_t flash_size, uint32_t page_size,
+                          const uint8_t *image, size_t image_len,
+                          uint32_t base_addr,
+                          const sbl_program_opts_t *opts);
+
+// A run of bytes to place at a flash address. data is borrowed, not owned.
+typedef struct
+{
+    uint32_t addr;
+    const uint8_t *data;
+    size_t len;
+} sbl_segment_t;
+
+// Program a sparse image: segs sorted by address, non-overlapping, inside flash.
+// Segments on shared or adjacent pages are merged into one span, sent as one
+// DOWNLOAD with 0xFF between them unless opts->sparse_gap splits it; whole
+// blank pages between spans are never erased or sent. A bank
+// erase, if asked for, is issued once up front and opts->ccfg takes the CCFG
+// page out of the spans and writes it last.
+// Returns 0 on success, -1 on error.
+int sbl_program_segments(int fd,
+                         uint32_t flash_size, uint32_t page_size,
+                         const sbl_segment_t *segs, size_t n_segs,
+                         const sbl_program_opts_t *opts);
+
+// sbl_verify_image() over every segment.
+int sbl_verify_segments(int fd, const sbl_segment_t *segs, size_t n_segs);
+
+// Same, with the retries of opts->retries and a SBL_EV_VERIFY_OK per segment;
+// opts may be NULL. The host CRCs come from the segment bytes (opts->meta is
+// not consulted).
+int sbl_verify_segments_ex(int fd, const sbl_segment_t *segs, size_t n_segs, const sbl_program_opts_t *opts);
+
+// Compare the device's CMD_CRC32 over the image (padded to 4 bytes with 0xFF)
+// at addr with the host CRC. Returns 0 on match, -1 on mismatch (errno EIO) or error.
+int sbl_verify_image(int fd, uint32_t addr, const uint8_t *image, size_t image_len);
+
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
+
 #endif
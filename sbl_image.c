@@ -0,0 +1,491 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sbl_image.h"
+#include "crc32.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint32_t rd16(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int add_segment(sbl_image_t *img, size_t *cap, uint32_t addr, const uint8_t *data, size_t len)
+{
+    if (img->n_segs == *cap)
+    {
+        size_t n = *cap ? *cap * 2 : 8;
+        sbl_segment_t *segs = (sbl_segment_t *)realloc(img->segs, n * sizeof(*segs));
+        if (!segs)
+            return -1;
+        img->segs = segs;
+        *cap = n;
+    }
+    img->segs[img->n_segs].addr = addr;
+    img->segs[img->n_segs].data = data;
+    img->segs[img->n_segs].len = len;
+    img->n_segs++;
+    return 0;
+}
+
+static int hex_nibble(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static int hex_byte(const char *p)
+{
+    int hi = hex_nibble(p[0]), lo = hex_nibble(p[1]);
+    return hi < 0 || lo < 0 ? -1 : (hi << 4) | lo;
+}
+
+static int parse_hex(sbl_image_t *img, const char *text, size_t len)
+{
+    // Every data byte takes at least two characters, so this is an upper bound
+    img->decoded = (uint8_t *)malloc(len / 2 + 1);
+    if (!img->decoded)
+        return -1;
+
+    size_t cap = 0, used = 0;
+    uint32_t upper = 0; // extended linear / segment address
+    unsigned line = 0;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        // Skip line endings and blank space between records
+        if (text[i] == '\r' || text[i] == '\n' || text[i] == ' ' || text[i] == '\t')
+        {
+            ++i;
+            continue;
+        }
+        ++line;
+        if (text[i] != ':' || len - i < 11)
+            goto bad;
+
+        const char *r = text + i + 1;
+        int count = hex_byte(r);
+        if (count < 0 || len - i < 11 + (size_t)count * 2)
+            goto bad;
+
+        uint8_t rec[5 + 255];
+        uint8_t sum = 0;
+        for (int k = 0; k < count + 5; ++k)
+        {
+            int v = hex_byte(r + 2 * k);
+            if (v < 0)
+                goto bad;
+            rec[k] = (uint8_t)v;
+            sum += (uint8_t)v;
+        }
+        if (sum != 0)
+            goto bad;
+        i += 11 + (size_t)count * 2;
+
+        uint32_t offset = ((uint32_t)rec[1] << 8) | rec[2];
+        const uint8_t *data = rec + 4;
+        switch (rec[3])
+        {
+        case 0x00:
+        {
+            uint32_t addr = upper + offset;
+            sbl_segment_t *last = img->n_segs ? &img->segs[img->n_segs - 1] : NULL;
+            memcpy(img->decoded + used, data, (size_t)count);
+            // The last segment always ends at decoded + used, so contiguous data just grows it
+            if (last && last->addr + last->len == addr)
+                last->len += (size_t)count;
+            else if (add_segment(img, &cap, addr, img->decoded + used, (size_t)count) != 0)
+                return -1;
+            used += (size_t)count;
+            break;
+        }
+        case 0x01:
+            i = len;
+            break;
+        case 0x02:
+            if (count != 2)
+                goto bad;
+            upper = (((uint32_t)data[0] << 8) | data[1]) << 4;
+            break;
+        case 0x04:
+            if (count != 2)
+                goto bad;
+            upper = (((uint32_t)data[0] << 8) | data[1]) << 16;
+            break;
+        case 0x03:
+        case 0x05:
+            // Start address records: nothing to flash
+            break;
+        default:
+            goto bad;
+        }
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "Malformed Intel HEX record %u\n", line);
+    errno = EINVAL;
+    return -1;
+}
+
+static int parse_elf(sbl_image_t *img, const uint8_t *file, size_t len)
+{
+    // 32-bit, little-endian only: that is what the CC13xx toolchains emit
+    if (len < 52 || file[4] != 1 || file[5] != 1)
+    {
+        fprintf(stderr, "Only 32-bit little-endian ELF images are supported\n");
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t phoff = rd32(file + 28);
+    uint32_t phentsize = rd16(file + 42);
+    uint32_t phnum = rd16(file + 44);
+    if (phentsize < 32 || (uint64_t)phoff + (uint64_t)phentsize * phnum > len)
+        goto bad;
+
+    size_t cap = 0;
+    for (uint32_t k = 0; k < phnum; ++k)
+    {
+        const uint8_t *ph = file + phoff + (size_t)k * phentsize;
+        uint32_t type = rd32(ph + 0);
+        uint32_t offset = rd32(ph + 4);
+        uint32_t paddr = rd32(ph + 12);
+        uint32_t filesz = rd32(ph + 16);
+
+        // Only bytes present in the file go to flash; .bss is the runtime's problem
+        if (type != 1 || filesz == 0)
+            continue;
+        if ((uint64_t)offset + filesz > len)
+            goto bad;
+        if (add_segment(img, &cap, paddr, file + offset, filesz) != 0)
+            return -1;
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "Malformed ELF program headers\n");
+    errno = EINVAL;
+    return -1;
+}
+
+static int seg_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((const sbl_segment_t *)a)->addr, y = ((const sbl_segment_t *)b)->addr;
+    return x < y ? -1 : x > y;
+}
+
+int sbl_image_load(const char *path, uint32_t bin_addr, sbl_image_t *img)
+{
+    memset(img, 0, sizeof(*img));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    img->map_len = (size_t)st.st_size;
+    img->map = mmap(NULL, img->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img->map == MAP_FAILED)
+    {
+        img->map = NULL;
+        return -1;
+    }
+
+    const uint8_t *file = (const uint8_t *)img->map;
+    const char *ext = strrchr(path, '.');
+    int rc;
+    if (ext && strcasecmp(ext, ".bin") == 0)
+        img->format = SBL_IMAGE_BIN;
+    else if (img->map_len >= 4 && memcmp(file, "\x7f" "ELF", 4) == 0)
+        img->format = SBL_IMAGE_ELF;
+    else if (file[0] == ':')
+        img->format = SBL_IMAGE_HEX;
+    else
+        img->format = SBL_IMAGE_BIN;
+
+    if (img->format == SBL_IMAGE_ELF)
+        rc = parse_elf(img, file, img->map_len);
+    else if (img->format == SBL_IMAGE_HEX)
+        rc = parse_hex(img, (const char *)file, img->map_len);
+    else
+    {
+        size_t cap = 0;
+        rc = add_segment(img, &cap, bin_addr, file, img->map_len);
+    }
+    if (rc != 0)
+        goto fail;
+
+    if (img->n_segs == 0)
+    {
+        fprintf(stderr, "%s: no loadable data\n", path);
+        errno = EINVAL;
+        goto fail;
+    }
+
+    // Records and program headers may come in any order; programming wants them sorted
+    qsort(img->segs, img->n_segs, sizeof(img->segs[0]), seg_cmp);
+    for (size_t k = 0; k < img->n_segs; ++k)
+    {
+        if (k > 0 && img->segs[k].addr < (uint64_t)img->segs[k - 1].addr + img->segs[k - 1].len)
+        {
+            fprintf(stderr, "%s: overlapping data at 0x%08X\n", path, img->segs[k].addr);
+            errno = EINVAL;
+            goto fail;
+        }
+        img->total_len += img->segs[k].len;
+    }
+    return 0;
+
+fail:
+    rc = errno;
+    sbl_image_free(img);
+    errno = rc;
+    return -1;
+}
+
+void sbl_image_free(sbl_image_t *img)
+{
+    if (img->map)
+        munmap(img->map, img->map_len);
+    free(img->segs);
+    free(img->decoded);
+    memset(img, 0, sizeof(*img));
+}
+
+const char *sbl_image_format_name(sbl_image_format_t format)
+{
+    switch (format)
+    {
+    case SBL_IMAGE_BIN:
+        return "bin";
+    case SBL_IMAGE_HEX:
+        return "hex";
+    case SBL_IMAGE_ELF:
+        return "elf";
+    }
+    return "?";
+}
+
+// Load one manifest line's image into m->images
+static int manifest_add(sbl_manifest_t *m, size_t *cap, const char *dir, const char *file, uint32_t addr)
+{
+    char path[4096];
+    int plen = file[0] != '/' && dir ? snprintf(path, sizeof(path), "%s/%s", dir, file)
+                                     : snprintf(path, sizeof(path), "%s", file);
+    if (plen < 0 || (size_t)plen >= sizeof(path))
+    {
+        fprintf(stderr, "%s: path too long\n", file);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (m->n_images == *cap)
+    {
+        size_t ncap = *cap ? *cap * 2 : 4;
+        sbl_image_t *n = (sbl_image_t *)realloc(m->images, ncap * sizeof(*n));
+        if (!n)
+            return -1;
+        m->images = n;
+        *cap = ncap;
+    }
+    if (sbl_image_load(path, addr, &m->images[m->n_images]) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    m->n_images++;
+    return 0;
+}
+
+int sbl_manifest_load(const char *path, sbl_manifest_t *m)
+{
+    memset(m, 0, sizeof(*m));
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char dir[4096];
+    const char *slash = strrchr(path, '/');
+    if (slash)
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+    char line[4096];
+    unsigned line_no = 0;
+    size_t cap = 0;
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f))
+    {
+        ++line_no;
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        char *save = NULL;
+        char *file = strtok_r(line, " \t\r\n", &save);
+        if (!file)
+            continue;
+        char *addr_s = strtok_r(NULL, " \t\r\n", &save);
+        char *end = NULL;
+        uint32_t addr = addr_s ? (uint32_t)strtoul(addr_s, &end, 0) : 0;
+        if ((addr_s && *end) || strtok_r(NULL, " \t\r\n", &save))
+        {
+            fprintf(stderr, "%s:%u: expected <file> [addr]\n", path, line_no);
+            errno = EINVAL;
+            rc = -1;
+            break;
+        }
+        rc = manifest_add(m, &cap, slash ? (slash == path ? "" : dir) : NULL, file, addr);
+    }
+    fclose(f);
+    if (rc == 0 && m->n_images == 0)
+    {
+        fprintf(stderr, "%s: no images listed\n", path);
+        errno = EINVAL;
+        rc = -1;
+    }
+
+    // One sorted segment list across all images
+    for (size_t i = 0; rc == 0 && i < m->n_images; ++i)
+        m->n_segs += m->images[i].n_segs;
+    if (rc == 0 && !(m->segs = (sbl_segment_t *)malloc(m->n_segs * sizeof(*m->segs))))
+        rc = -1;
+    if (rc == 0)
+    {
+        size_t k = 0;
+        for (size_t i = 0; i < m->n_images; ++i)
+        {
+            memcpy(m->segs + k, m->images[i].segs, m->images[i].n_segs * sizeof(*m->segs));
+            k += m->images[i].n_segs;
+        }
+        qsort(m->segs, m->n_segs, sizeof(m->segs[0]), seg_cmp);
+        for (k = 0; k < m->n_segs; ++k)
+        {
+            if (k > 0 && m->segs[k].addr < (uint64_t)m->segs[k - 1].addr + m->segs[k - 1].len)
+            {
+                fprintf(stderr, "%s: images overlap at 0x%08X\n", path, m->segs[k].addr);
+                errno = EINVAL;
+                rc = -1;
+                break;
+            }
+            m->total_len += m->segs[k].len;
+        }
+    }
+
+    if (rc != 0)
+    {
+        int err = errno;
+        sbl_manifest_free(m);
+        errno = err;
+    }
+    return rc;
+}
+
+void sbl_manifest_free(sbl_manifest_t *m)
+{
+    for (size_t i = 0; i < m->n_images; ++i)
+        sbl_image_free(&m->images[i]);
+    free(m->images);
+    free(m->segs);
+    memset(m, 0, sizeof(*m));
+}
+
+// --- page metadata, worked out in memory once per loaded image ---
+
+static int meta_pages(const sbl_segment_t *segs, size_t n_segs, uint32_t page_size, sbl_image_meta_t *meta)
+{
+    uint64_t end = 0;
+    for (size_t i = 0; i < n_segs; ++i)
+    {
+        if (segs[i].addr + (uint64_t)segs[i].len > end)
+            end = segs[i].addr + (uint64_t)segs[i].len;
+    }
+    meta->page_size = page_size;
+    meta->first_page = segs[0].addr & ~(page_size - 1);
+    meta->n_pages = (uint32_t)((end - meta->first_page + page_size - 1) / page_size);
+    meta->crc = (uint32_t *)malloc((meta->n_pages ? meta->n_pages : 1) * sizeof(uint32_t));
+    meta->blank = (uint8_t *)malloc(meta->n_pages ? meta->n_pages : 1);
+    uint8_t *page = (uint8_t *)malloc(page_size);
+    if (!meta->crc || !meta->blank || !page)
+    {
+        free(page);
+        sbl_image_meta_free(meta);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t first_seg = 0;
+    for (uint32_t p = 0; p < meta->n_pages; ++p)
+    {
+        uint64_t lo = meta->first_page + (uint64_t)p * page_size;
+        uint64_t hi = lo + page_size;
+        memset(page, 0xFF, page_size);
+        while (first_seg < n_segs && segs[first_seg].addr + (uint64_t)segs[first_seg].len <= lo)
+            ++first_seg;
+        for (size_t i = first_seg; i < n_segs && segs[i].addr < hi; ++i)
+        {
+            uint64_t from = segs[i].addr > lo ? segs[i].addr : lo;
+            uint64_t to = segs[i].addr + (uint64_t)segs[i].len;
+            if (to > hi)
+                to = hi;
+            if (from < to)
+                memcpy(page + (from - lo), segs[i].data + (from - segs[i].addr), (size_t)(to - from));
+        }
+        meta->crc[p] = sbl_crc32_update(0, page, page_size);
+        size_t k = 0;
+        while (k < page_size && page[k] == 0xFF)
+            ++k;
+        meta->blank[p] = k == page_size;
+    }
+    free(page);
+    return 0;
+}
+
+int sbl_image_meta_build(const sbl_segment_t *segs, size_t n_segs, uint32_t page_size, sbl_image_meta_t *meta)
+{
+    memset(meta, 0, sizeof(*meta));
+    if (!segs || n_segs == 0 || page_size == 0 || (page_size & (page_size - 1)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return meta_pages(segs, n_segs, page_size, meta);
+}
+
+void sbl_image_meta_free(sbl_image_meta_t *meta)
+{
+    free(meta->crc);
+    free(meta->blank);
+    meta->crc = NULL;
+    meta->blank = NULL;
+    meta->n_pages = 0;
+}
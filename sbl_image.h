@@ -0,0 +1,73 @@
+#ifndef SBL_IMAGE_H
+#define SBL_IMAGE_H
+
+#include "sbl.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Exported from the shared library (built with -fvisibility=hidden)
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
+
+typedef enum
+{
+    SBL_IMAGE_BIN = 0, // raw bytes, placed at the address given to sbl_image_load()
+    SBL_IMAGE_HEX,     // Intel HEX (record types 00/01/02/04)
+    SBL_IMAGE_ELF      // 32-bit little-endian ELF, PT_LOAD segments at their LMA
+} sbl_image_format_t;
+
+// A firmware image as a sparse, address-sorted segment list. The file is mmapped:
+// BIN and ELF segments point straight into the mapping, HEX records are decoded
+// into one buffer. Read-only once loaded, so one image can feed several jobs.
+typedef struct
+{
+    sbl_image_format_t format;
+    sbl_segment_t *segs;
+    size_t n_segs;
+    size_t total_len; // sum of segment lengths
+    void *map;
+    size_t map_len;
+    uint8_t *decoded; // HEX payload the segments point into
+} sbl_image_t;
+
+// Load path, detecting the format from its contents (".bin" files are always raw).
+// bin_addr is the flash address of a raw image; HEX and ELF carry their own.
+// Returns 0 on success, -1 on error with errno set (EINVAL for a malformed file).
+int sbl_image_load(const char *path, uint32_t bin_addr, sbl_image_t *img);
+
+void sbl_image_free(sbl_image_t *img);
+
+const char *sbl_image_format_name(sbl_image_format_t format);
+
+// Several images programmed in one session, listed one per line in a manifest:
+//   <file> [addr_hex]   # addr places a raw image, HEX and ELF carry their own
+// Relative paths are taken from the manifest's directory. The segments of all
+// images are merged into one sorted list; images may not overlap.
+typedef struct
+{
+    sbl_image_t *images;
+    size_t n_images;
+    sbl_segment_t *segs; // point into images
+    size_t n_segs;
+    size_t total_len;
+} sbl_manifest_t;
+
+// Returns 0 on success, -1 on error with errno set (EINVAL for a malformed manifest).
+int sbl_manifest_load(const char *path, sbl_manifest_t *m);
+
+void sbl_manifest_free(sbl_manifest_t *m);
+
+// Work out the page CRCs and blank map of segs (sorted, non-overlapping) for
+// page_size, in memory: once per loaded image, then handed to every run that
+// programs it. Returns 0 on success, -1 on error with errno set.
+int sbl_image_meta_build(const sbl_segment_t *segs, size_t n_segs, uint32_t page_size, sbl_image_meta_t *meta);
+
+void sbl_image_meta_free(sbl_image_meta_t *meta);
+
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+#define _XOPEN_SOURCE 600
+#include "sbl_multi.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct multi_ctx
+{
+    const char *const *devs;
+    size_t n_devs;
+    const sbl_multi_job_t *job;
+    sbl_job_result_t *results;
+    pthread_mutex_t lock;
+    size_t next; // next device index to hand out
+};
+
+const char *sbl_job_step_name(sbl_job_step_t step)
+{
+    switch (step)
+    {
+    case SBL_JOB_OPEN:
+        return "open";
+    case SBL_JOB_ENTER:
+        return "enter";
+    case SBL_JOB_AUTOBAUD:
+        return "autobaud";
+    case SBL_JOB_PROGRAM:
+        return "program";
+    case SBL_JOB_VERIFY:
+        return "verify";
+    case SBL_JOB_RESET:
+        return "reset";
+    case SBL_JOB_DONE:
+        return "done";
+    }
+    return "?";
+}
+
+struct device_progress
+{
+    const sbl_multi_job_t *job;
+    const char *dev;
+};
+
+static void device_progress(const sbl_event_t *ev, void *user)
+{
+    const struct device_progress *p = (const struct device_progress *)user;
+    p->job->progress(p->dev, ev, p->job->progress_user);
+}
+
+int sbl_run_job(int fd, const sbl_multi_job_t *job, int synced, sbl_job_result_t *res)
+{
+    uint64_t t0 = serial_now_ms();
+    res->rc = -1;
+    serial_set_drain(fd, job->drain);
+    sbl_latency_set_fixed(fd, job->fixed_timeouts);
+    sbl_metrics_init(&res->metrics);
+    sbl_metrics_begin(fd, &res->metrics);
+
+    res->step = SBL_JOB_ENTER;
+    if (job->entry && sbl_enter_bootloader(fd, job->entry) != 0)
+        goto out;
+
+    // A port left in the bootloader by the last job only needs a PING
+    res->step = SBL_JOB_AUTOBAUD;
+    if ((job->entry || !synced || sbl_ping(fd, 100) != 0) &&
+        sbl_autobaud(fd, job->autobaud_timeout_ms > 0 ? job->autobaud_timeout_ms : 500) != 0)
+        goto out;
+
+    res->step = SBL_JOB_PROGRAM;
+    sbl_program_opts_t opts = job->opts;
+    opts.stats = &res->stats;
+    opts.no_reset = 1;
+    opts.verify = 0; // the VERIFY step below does it, unless verify groups already did
+    opts.metrics = NULL; // already attached for the whole session
+    opts.metrics_json = NULL;
+    struct device_progress progress = {job, res->dev};
+    opts.progress = job->progress ? device_progress : NULL;
+    opts.progress_user = &progress;
+    if (job->n_segs > 0)
+    {
+        if (sbl_program_segments(fd, job->flash_size, job->page_size, job->segs, job->n_segs, &opts) != 0)
+            goto out;
+    }
+    else if (sbl_program_binary_ex(fd, job->flash_size, job->page_size,
+                                   job->image, job->image_len, job->base_addr, &opts) != 0)
+        goto out;
+
+    res->step = SBL_JOB_VERIFY;
+    sbl_segment_t whole = {job->base_addr, job->image, job->image_len};
+    if (opts.meta && opts.meta->page_size != job->page_size)
+        opts.meta = NULL;
+    if (!opts.verify_group && (job->n_segs > 0 ? sbl_verify_segments_ex(fd, job->segs, job->n_segs, &opts) != 0
+                                               : sbl_verify_segments_ex(fd, &whole, 1, &opts) != 0))
+        goto out;
+
+    res->step = SBL_JOB_RESET;
+    if (!job->opts.no_reset && sbl_reset(fd, 1000) != 0)
+        goto out;
+
+    res->step = SBL_JOB_DONE;
+    res->rc = 0;
+
+out:
+    if (res->rc != 0)
+        res->err = errno;
+    sbl_metrics_end(fd);
+    res->seconds = (double)(serial_now_ms() - t0) / 1000.0;
+    return res->rc;
+}
+
+// Run one device through open -> (enter) -> autobaud -> program -> verify -> reset.
+static void run_device(const sbl_multi_job_t *job, sbl_job_result_t *res)
+{
+    uint64_t t0 = serial_now_ms();
+    res->step = SBL_JOB_OPEN;
+    int fd = serial_open_configure(res->dev, job->baud);
+    if (fd < 0)
+    {
+        res->rc = -1;
+        res->err = errno;
+    }
+    else
+    {
+        sbl_run_job(fd, job, 0, res);
+        serial_close(fd);
+    }
+    res->seconds = (double)(serial_now_ms() - t0) / 1000.0;
+}
+
+static void *multi_worker(void *arg)
+{
+    struct multi_ctx *ctx = (struct multi_ctx *)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&ctx->lock);
+        size_t i = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (i >= ctx->n_devs)
+            return NULL;
+        run_device(ctx->job, &ctx->results[i]);
+    }
+}
+
+int sbl_program_many(const char *const *devs, size_t n_devs,
+                     const sbl_multi_job_t *job, sbl_job_result_t *results)
+{
+    if (!devs || !job || !results || (!job->image && job->n_segs == 0) || n_devs == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < n_devs; ++i)
+    {
+        memset(&results[i], 0, sizeof(results[i]));
+        results[i].dev = devs[i];
+    }
+
+    struct multi_ctx ctx = {devs, n_devs, job, results, PTHREAD_MUTEX_INITIALIZER, 0};
+    size_t n_threads = job->max_parallel ? job->max_parallel : n_devs;
+    if (n_threads > n_devs)
+        n_threads = n_devs;
+
+    pthread_t *threads = (pthread_t *)calloc(n_threads, sizeof(pthread_t));
+    if (!threads)
+        return -1;
+
+    size_t started = 0;
+    for (; started < n_threads; ++started)
+        if (pthread_create(&threads[started], NULL, multi_worker, &ctx) != 0)
+            break;
+    if (started == 0)
+    {
+        // No threads at all: run the queue on this one
+        multi_worker(&ctx);
+    }
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&ctx.lock);
+
+    int failed = 0;
+    for (size_t i = 0; i < n_devs; ++i)
+        failed += results[i].rc != 0;
+    return failed;
+}
@@ -0,0 +1,77 @@
+#ifndef SBL_MULTI_H
+#define SBL_MULTI_H
+
+#include "sbl.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Exported from the shared library (built with -fvisibility=hidden)
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
+
+// Per-device steps of sbl_program_many(), in order
+typedef enum
+{
+    SBL_JOB_OPEN = 0,
+    SBL_JOB_ENTER, // DTR/RTS bootloader entry, when job->entry is set
+    SBL_JOB_AUTOBAUD,
+    SBL_JOB_PROGRAM, // erase + download (+ any verify opts asks for)
+    SBL_JOB_VERIFY,
+    SBL_JOB_RESET,
+    SBL_JOB_DONE
+} sbl_job_step_t;
+
+// One flashing job, shared read-only by every device it runs on
+typedef struct
+{
+    int baud;
+    int autobaud_timeout_ms;
+    uint32_t flash_size;
+    uint32_t page_size;
+    uint32_t base_addr;
+    const uint8_t *image;    // contiguous image at base_addr, or...
+    size_t image_len;
+    const sbl_segment_t *segs; // ...a sparse one (sbl_program_segments()) when n_segs > 0
+    size_t n_segs;
+    sbl_program_opts_t opts; // opts.stats is managed per device; opts.no_reset skips the RESET step
+    unsigned max_parallel;   // worker threads; 0 = one per device
+    int drain;               // serial_set_drain() on every port
+    int fixed_timeouts;      // sbl_latency_set_fixed() on every port
+    const sbl_entry_t *entry; // optional: sbl_enter_bootloader() before autobaud
+    // optional: opts.progress events tagged with their device (opts.progress itself
+    // is ignored), called on that device's worker thread
+    void (*progress)(const char *dev, const sbl_event_t *ev, void *user);
+    void *progress_user;
+} sbl_multi_job_t;
+
+// Outcome for one device
+typedef struct
+{
+    const char *dev;
+    sbl_job_step_t step; // SBL_JOB_DONE on success, otherwise the step that failed
+    int rc;              // 0 on success, -1 on failure
+    int err;             // errno at the failure
+    double seconds;      // wall time from open to reset (or the end, with opts.no_reset)
+    sbl_program_stats_t stats;
+    sbl_metrics_t metrics; // the whole session from autobaud to reset
+} sbl_job_result_t;
+
+// Program the same image onto n_devs ports at once; results[i] belongs to devs[i].
+// Returns the number of devices that failed (0 = all good), or -1 on setup error.
+int sbl_program_many(const char *const *devs, size_t n_devs,
+                     const sbl_multi_job_t *job, sbl_job_result_t *results);
+
+// One device's steps from ENTER on, on a port the caller opened and keeps;
+// synced says it was left in the bootloader (opts.no_reset) by the last job.
+// res->dev only labels progress events. Returns res->rc.
+int sbl_run_job(int fd, const sbl_multi_job_t *job, int synced, sbl_job_result_t *res);
+
+const char *sbl_job_step_name(sbl_job_step_t step);
+
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
+
+#endif
@@ -0,0 +1,500 @@
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include "sbl_sim.h"
+#include "sbl.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+struct sbl_sim
+{
+    sbl_sim_config_t cfg;
+    int master;
+    int slave;
+    char path[64];
+    pthread_t thread;
+    volatile int stop;
+    uint8_t *flash;
+    uint8_t status;
+    int locked;
+    uint32_t dl_addr;
+    uint32_t dl_left;
+    unsigned data_frames;
+    uint8_t rx_held[256]; // what the RX FIFO kept while flash was busy, read before the pty
+    size_t rx_held_pos;
+    size_t rx_held_len;
+};
+
+void sbl_sim_config_init(sbl_sim_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->flash_size = 0x20000;
+    cfg->page_size = 0x1000;
+    cfg->chip_id = 0x2B9BE02F;
+    cfg->rx_fifo = 32;
+}
+
+static void sim_sleep_us(int us)
+{
+    if (us <= 0)
+        return;
+    struct timespec ts = {us / 1000000, (long)(us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+// Blocking read of one byte; returns -1 when the sim is stopping.
+static int sim_getc(sbl_sim_t *s)
+{
+    if (s->rx_held_pos < s->rx_held_len)
+        return s->rx_held[s->rx_held_pos++];
+    while (!s->stop)
+    {
+        struct pollfd pfd = {.fd = s->master, .events = POLLIN};
+        int pr = poll(&pfd, 1, 20);
+        if (pr <= 0)
+            continue;
+        uint8_t b;
+        ssize_t n = read(s->master, &b, 1);
+        if (n == 1)
+            return b;
+        if (n < 0 && errno != EAGAIN && errno != EINTR && errno != EIO)
+            return -1;
+        if (n < 0 && errno == EIO)
+            sim_sleep_us(1000); // no slave opened by the host right now
+    }
+    return -1;
+}
+
+static uint64_t sim_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// Time len bytes take on a wire_baud UART (8N1), if one is being modelled.
+static uint64_t sim_wire_us(const sbl_sim_t *s, size_t len)
+{
+    return s->cfg.wire_baud > 0 ? (uint64_t)len * 10u * 1000000u / (uint64_t)s->cfg.wire_baud : 0;
+}
+
+static void sim_wire_delay(const sbl_sim_t *s, size_t len)
+{
+    sim_sleep_us((int)sim_wire_us(s, len));
+}
+
+// Wait until len bytes whose first one arrived at t0 are through the wire;
+// reading them already took part of that time.
+static void sim_wire_wait(const sbl_sim_t *s, uint64_t t0, size_t len)
+{
+    uint64_t end = t0 + sim_wire_us(s, len), now = sim_now_us();
+    if (end > now)
+        sim_sleep_us((int)(end - now));
+}
+
+static void sim_write(sbl_sim_t *s, const uint8_t *buf, size_t len)
+{
+    sim_wire_delay(s, len);
+    while (len)
+    {
+        ssize_t n = write(s->master, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+// Flash busy for us without the UART being read. What the host sends meanwhile
+// reaches the RX FIFO from when it was written, no faster than the wire carries
+// it; the bytes that do not fit are gone, and the rest of a frame still on the
+// wire arrives afterwards.
+static void sim_busy(sbl_sim_t *s, int us)
+{
+    if (s->cfg.rx_fifo <= 0)
+    {
+        sim_sleep_us(us);
+        return;
+    }
+
+    // Watch for the first byte in 50 us steps; held bytes were there all along
+    uint64_t t0 = sim_now_us(), end = t0 + (uint64_t)(us > 0 ? us : 0), first = 0;
+    if (s->rx_held_pos < s->rx_held_len)
+        first = t0;
+    for (uint64_t now = t0; now < end; now = sim_now_us())
+    {
+        struct pollfd pfd = {.fd = s->master, .events = POLLIN};
+        if (!first && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+            first = now;
+        sim_sleep_us(end - now < 50 ? (int)(end - now) : 50);
+        if (first)
+        {
+            sim_sleep_us((int)(end > sim_now_us() ? end - sim_now_us() : 0));
+            break;
+        }
+    }
+    if (!first)
+        return;
+
+    size_t room = s->rx_held_len - s->rx_held_pos;
+    memmove(s->rx_held, s->rx_held + s->rx_held_pos, room);
+    s->rx_held_len = room;
+    s->rx_held_pos = 0;
+    room = (size_t)s->cfg.rx_fifo > room ? (size_t)s->cfg.rx_fifo - room : 0;
+
+    uint64_t arrive = s->cfg.wire_baud > 0 ? (end - first) * (uint64_t)s->cfg.wire_baud / 10000000u + 1 : UINT64_MAX;
+    while (arrive > 0)
+    {
+        struct pollfd pfd = {.fd = s->master, .events = POLLIN};
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+            break;
+        uint8_t buf[256];
+        ssize_t n = read(s->master, buf, arrive < sizeof(buf) ? (size_t)arrive : sizeof(buf));
+        if (n <= 0)
+            break;
+        arrive -= (uint64_t)n;
+        for (ssize_t i = 0; i < n && room > 0; ++i, --room)
+            s->rx_held[s->rx_held_len++] = buf[i];
+    }
+}
+
+static void sim_ack(sbl_sim_t *s, uint8_t code)
+{
+    uint8_t a[2] = {0x00, code};
+    sim_sleep_us(s->cfg.ack_latency_us);
+    sim_write(s, a, 2);
+}
+
+static void sim_respond(sbl_sim_t *s, const uint8_t *data, size_t len)
+{
+    uint8_t frame[2 + 253];
+    unsigned sum = 0;
+    for (size_t i = 0; i < len; ++i)
+        sum += data[i];
+    frame[0] = (uint8_t)(len + 2);
+    frame[1] = (uint8_t)sum;
+    memcpy(&frame[2], data, len);
+    sim_write(s, frame, len + 2);
+
+    // Host acknowledges the response frame
+    for (;;)
+    {
+        int c = sim_getc(s);
+        if (c < 0 || c == SBL_ACK || c == SBL_NACK)
+            return;
+    }
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Reference bitwise CRC-32 (IEEE 802.3), every location read repeat+1 times.
+static uint32_t sim_crc32(const uint8_t *p, uint32_t len, uint32_t repeat)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        for (uint32_t r = 0; r <= repeat; ++r)
+        {
+            crc ^= p[i];
+            for (int k = 0; k < 8; ++k)
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static void sim_command(sbl_sim_t *s, const uint8_t *d, size_t len)
+{
+    const sbl_sim_config_t *c = &s->cfg;
+    uint8_t cmd = d[0];
+
+    switch (cmd)
+    {
+    case CMD_PING:
+        sim_ack(s, SBL_ACK);
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    case CMD_GET_STATUS:
+        sim_ack(s, SBL_ACK);
+        sim_respond(s, &s->status, 1);
+        break;
+    case CMD_GET_CHIP_ID:
+    {
+        uint8_t id[4] = {(uint8_t)c->chip_id, (uint8_t)(c->chip_id >> 8),
+                         (uint8_t)(c->chip_id >> 16), (uint8_t)(c->chip_id >> 24)};
+        sim_ack(s, SBL_ACK);
+        sim_respond(s, id, 4);
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    }
+    case CMD_MEMORY_READ:
+    {
+        // Only flash is modelled; words come back in memory order
+        uint32_t addr = len == 7 ? be32(&d[1]) : 0;
+        size_t n = len == 7 ? (d[5] ? (size_t)d[6] * 4 : d[6]) : 0;
+        if (len != 7 || d[5] > 1 || n == 0 || n > 253 || (d[5] && (addr & 3)) ||
+            (uint64_t)addr + n > c->flash_size)
+        {
+            sim_ack(s, SBL_NACK);
+            s->status = COMMAND_RET_INVALID_CMD;
+            break;
+        }
+        sim_ack(s, SBL_ACK);
+        sim_respond(s, s->flash + addr, n);
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    }
+    case CMD_RESET:
+        sim_ack(s, SBL_ACK);
+        s->locked = 0;
+        s->dl_left = 0;
+        break;
+    case CMD_DOWNLOAD:
+        if (len != 9)
+        {
+            sim_ack(s, SBL_NACK);
+            break;
+        }
+        sim_ack(s, SBL_ACK);
+        s->dl_addr = be32(&d[1]);
+        s->dl_left = be32(&d[5]);
+        if ((uint64_t)s->dl_addr + s->dl_left > c->flash_size || (s->dl_left & 3))
+        {
+            s->dl_left = 0;
+            s->status = COMMAND_RET_INVALID_ADR;
+        }
+        else
+            s->status = COMMAND_RET_SUCCESS;
+        break;
+    case CMD_SEND_DATA:
+    {
+        size_t n = len - 1;
+        ++s->data_frames;
+        if (c->drop_every && s->data_frames % (unsigned)c->drop_every == 0)
+            break; // lost on the wire: the host has to time out
+        if (len < 2 || (c->nack_every && s->data_frames % (unsigned)c->nack_every == 0))
+        {
+            sim_ack(s, SBL_NACK);
+            break;
+        }
+        sim_ack(s, SBL_ACK);
+        if (n > s->dl_left)
+        {
+            s->status = COMMAND_RET_INVALID_CMD;
+            break;
+        }
+        for (size_t i = 0; i < n; ++i)
+            s->flash[s->dl_addr + i] &= d[1 + i];
+        // A cell that did not take the write: only a CRC readback notices
+        if (c->corrupt_every && s->data_frames % (unsigned)c->corrupt_every == 0)
+            s->flash[s->dl_addr + n / 2] ^= 0x01;
+        sim_busy(s, (int)((long)c->program_ns_per_byte * (long)n / 1000));
+        s->dl_addr += (uint32_t)n;
+        s->dl_left -= (uint32_t)n;
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    }
+    case CMD_SECTOR_ERASE:
+    {
+        if (len != 5)
+        {
+            sim_ack(s, SBL_NACK);
+            break;
+        }
+        uint32_t a = be32(&d[1]);
+        sim_ack(s, SBL_ACK);
+        if (a >= c->flash_size)
+        {
+            s->status = COMMAND_RET_INVALID_ADR;
+            break;
+        }
+        a -= a % c->page_size;
+        memset(&s->flash[a], 0xFF, c->page_size);
+        sim_busy(s, c->erase_page_us);
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    }
+    case CMD_SET_CCFG:
+        // Field layout is not modelled: accept any well-formed request
+        sim_ack(s, len == 9 ? SBL_ACK : SBL_NACK);
+        if (len == 9)
+            s->status = be32(&d[1]) <= 14 ? COMMAND_RET_SUCCESS : COMMAND_RET_INVALID_CMD;
+        break;
+    case CMD_BANK_ERASE:
+        sim_ack(s, SBL_ACK);
+        memset(s->flash, 0xFF, c->flash_size);
+        sim_busy(s, c->bank_erase_us);
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    case CMD_CRC32:
+    {
+        if (len != 13)
+        {
+            sim_ack(s, SBL_NACK);
+            break;
+        }
+        uint32_t a = be32(&d[1]), n = be32(&d[5]), rep = be32(&d[9]);
+        sim_ack(s, SBL_ACK);
+        if ((uint64_t)a + n > c->flash_size)
+        {
+            s->status = COMMAND_RET_INVALID_ADR;
+            uint8_t z[4] = {0};
+            sim_respond(s, z, 4);
+            break;
+        }
+        uint32_t crc = sim_crc32(&s->flash[a], n, rep);
+        sim_sleep_us((int)((uint64_t)c->crc_ns_per_byte * n * ((uint64_t)rep + 1) / 1000));
+        uint8_t r[4] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+        sim_respond(s, r, 4);
+        s->status = COMMAND_RET_SUCCESS;
+        break;
+    }
+    default:
+        sim_ack(s, SBL_ACK);
+        s->status = COMMAND_RET_UNKNOWN_CMD;
+        break;
+    }
+}
+
+static void *sim_main(void *arg)
+{
+    sbl_sim_t *s = (sbl_sim_t *)arg;
+    uint8_t d[256];
+
+    while (!s->stop)
+    {
+        int c = sim_getc(s);
+        if (c < 0)
+            break;
+
+        if (!s->locked)
+        {
+            // Autobaud: two consecutive 0x55
+            if (c == 0x55)
+            {
+                int c2 = sim_getc(s);
+                if (c2 == 0x55)
+                {
+                    s->locked = 1;
+                    sim_ack(s, SBL_ACK);
+                }
+            }
+            continue;
+        }
+
+        if (c == 0 || c < 3)
+            continue; // idle filler / invalid size
+        uint64_t t0 = sim_now_us();
+        int csum = sim_getc(s);
+        if (csum < 0)
+            break;
+        size_t n = (size_t)c - 2;
+        unsigned sum = 0;
+        size_t i;
+        for (i = 0; i < n; ++i)
+        {
+            int b = sim_getc(s);
+            if (b < 0)
+                break;
+            d[i] = (uint8_t)b;
+            sum += d[i];
+        }
+        if (i != n)
+            break;
+        sim_wire_wait(s, t0, 2 + n);
+        if ((uint8_t)sum != (uint8_t)csum)
+        {
+            sim_ack(s, SBL_NACK);
+            continue;
+        }
+        sim_command(s, d, n);
+    }
+    return NULL;
+}
+
+sbl_sim_t *sbl_sim_start(const sbl_sim_config_t *cfg)
+{
+    sbl_sim_t *s = (sbl_sim_t *)calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    if (cfg)
+        s->cfg = *cfg;
+    else
+        sbl_sim_config_init(&s->cfg);
+    if (s->cfg.rx_fifo > (int)sizeof(s->rx_held))
+        s->cfg.rx_fifo = (int)sizeof(s->rx_held);
+    s->master = s->slave = -1;
+
+    s->flash = (uint8_t *)malloc(s->cfg.flash_size);
+    if (!s->flash)
+        goto fail;
+    memset(s->flash, 0xFF, s->cfg.flash_size);
+
+    s->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (s->master < 0 || grantpt(s->master) != 0 || unlockpt(s->master) != 0)
+        goto fail;
+    const char *name = ptsname(s->master);
+    if (!name)
+        goto fail;
+    strncpy(s->path, name, sizeof(s->path) - 1);
+
+    // Keep one slave fd open so the master never sees a hangup between host opens
+    s->slave = open(s->path, O_RDWR | O_NOCTTY);
+    if (s->slave < 0)
+        goto fail;
+    struct termios tio;
+    if (tcgetattr(s->slave, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(s->slave, TCSANOW, &tio);
+    }
+
+    if (pthread_create(&s->thread, NULL, sim_main, s) != 0)
+        goto fail;
+    return s;
+
+fail:
+    if (s->slave >= 0)
+        close(s->slave);
+    if (s->master >= 0)
+        close(s->master);
+    free(s->flash);
+    free(s);
+    return NULL;
+}
+
+const char *sbl_sim_path(const sbl_sim_t *sim)
+{
+    return sim->path;
+}
+
+uint8_t *sbl_sim_flash(sbl_sim_t *sim)
+{
+    return sim->flash;
+}
+
+void sbl_sim_stop(sbl_sim_t *sim)
+{
+    if (!sim)
+        return;
+    sim->stop = 1;
+    pthread_join(sim->thread, NULL);
+    close(sim->slave);
+    close(sim->master);
+    free(sim->flash);
+    free(sim);
+}
@@ -0,0 +1,40 @@
+#ifndef SBL_SIM_H
+#define SBL_SIM_H
+
+#include <stdint.h>
+
+// Simulated CC13xx ROM bootloader on a pseudo terminal. The host side opens
+// sbl_sim_path() like any other serial device. Autobaud, ACK/NACK, GET_STATUS,
+// DOWNLOAD/SEND_DATA, SECTOR/BANK_ERASE, CRC32 (with read repeat) and
+// GET_CHIP_ID are emulated against an in-memory flash, on a thread per sim.
+// Like the ROM, the sim does not read its UART while it programs or erases flash:
+// of the bytes that arrive in that time only rx_fifo fit, the rest are lost.
+typedef struct
+{
+    uint32_t flash_size;
+    uint32_t page_size;
+    uint32_t chip_id;
+    int ack_latency_us;   // delay before every ACK/NACK
+    int erase_page_us;    // SECTOR_ERASE duration
+    int bank_erase_us;    // BANK_ERASE duration
+    int program_ns_per_byte; // SEND_DATA flash write time
+    int crc_ns_per_byte;  // CRC32 time per location read, between its ACK and its response
+    int nack_every;       // NACK every Nth SEND_DATA (0 = never)
+    int drop_every;       // swallow every Nth SEND_DATA without a reply (0 = never)
+    int corrupt_every;    // ACK every Nth SEND_DATA but leave one byte of it wrong (0 = never)
+    int wire_baud;        // >0: charge 10 bit times per byte each way, like a real UART
+    int rx_fifo;          // UART RX FIFO bytes kept while flash is busy (<= 256, 0 = unlimited)
+} sbl_sim_config_t;
+
+typedef struct sbl_sim sbl_sim_t;
+
+// 128 KiB flash, 4 KiB pages, CC1310 chip ID, the ROM's 32-byte RX FIFO, no added latency.
+void sbl_sim_config_init(sbl_sim_config_t *cfg);
+// NULL on failure (cfg == NULL uses the defaults).
+sbl_sim_t *sbl_sim_start(const sbl_sim_config_t *cfg);
+const char *sbl_sim_path(const sbl_sim_t *sim);
+// The simulated flash, flash_size bytes; read or preload it while the host is idle.
+uint8_t *sbl_sim_flash(sbl_sim_t *sim);
+void sbl_sim_stop(sbl_sim_t *sim);
+
+#endif
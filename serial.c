@@ -1,14 +1,90 @@
 #define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
 #include "serial.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <asm/ioctls.h>
+#include <linux/serial.h>
+#if defined(TCGETS2) && !defined(__mips__) && !defined(__sparc__)
+// Arbitrary rates via termios2/BOTHER. <asm/termbits.h> clashes with
+// <termios.h>, so mirror the asm-generic layout and flag values here.
+#define SERIAL_HAVE_TERMIOS2 1
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#define SERIAL_CBAUD  0010017
+#define SERIAL_BOTHER 0010000
+#define SERIAL_IBSHIFT 16
+#endif
+#elif defined(__APPLE__)
+#include <IOKit/serial/ioss.h>
+#endif
+
+// Per-port state (receive buffer, drain mode), indexed by fd.
+// Ports past the table read unbuffered and never drain.
+#define SERIAL_MAX_FDS 1024
+#define SERIAL_RX_BUF 512
+
+struct rx_buf {
+    uint8_t data[SERIAL_RX_BUF];
+    size_t head; // next byte to hand out
+    size_t tail; // end of valid data
+    int drain;   // tcdrain() after every complete write
+    int baud;    // last rate set through serial_set_baud(), see serial_get_baud()
+    uint64_t tx_bytes; // totals since open, see serial_get_counters()
+    uint64_t rx_bytes;
+    // Low-latency profile as applied by serial_open_configure(), undone on close
+    int low_latency;   // ASYNC_LOW_LATENCY: 1 set by us, 2 already set, 0 not applied, -1 refused
+    int timer_before;  // FTDI latency_timer in ms before / after, -1 if no such adapter
+    int timer_after;
+    int timer_err;     // errno of a failed latency_timer write, else 0
+    char *timer_path;  // sysfs attribute to restore, NULL if untouched
+    char timer_text[8]; // timer_before as written back, formatted up front for serial_restore_all()
+};
+
+static struct rx_buf *rx_bufs[SERIAL_MAX_FDS];
+
+// Low-latency profile for ports opened from now on, see serial_set_low_latency()
+static int latency_on;
+static int latency_ms;
+
+static struct rx_buf *rx_get(int fd) {
+    return (fd >= 0 && fd < SERIAL_MAX_FDS) ? rx_bufs[fd] : NULL;
+}
+
+// Protocol trace, shared by every port; lines are written whole under the stdio lock.
+static FILE *trace_out;
+static uint64_t trace_t0;
+
+static void trace_buf(int fd, const char *dir, const uint8_t *buf, size_t len) {
+    if (!trace_out || len == 0) return;
+    flockfile(trace_out);
+    fprintf(trace_out, "%12llu %3d %s %3zu:", (unsigned long long)(serial_now_us() - trace_t0), fd, dir, len);
+    for (size_t i = 0; i < len; ++i) fprintf(trace_out, " %02X", buf[i]);
+    fputc('\n', trace_out);
+    funlockfile(trace_out);
+}
+
 // Map integer baud to termios speed_t
 static speed_t baud_to_speed_t(int baud) {
     switch (baud) {
@@ -35,10 +111,74 @@ static speed_t baud_to_speed_t(int baud) {
     }
 }
 
+// Rates with no Bxxx constant: ask the driver for the exact rate and check
+// what the divisor actually gives (termios2 reads back the real value).
+static int set_custom_baud(int fd, int baud) {
+#if defined(SERIAL_HAVE_TERMIOS2)
+    struct termios2 t2;
+    if (ioctl(fd, TCGETS2, &t2) < 0) return -1;
+    t2.c_cflag &= ~(tcflag_t)(SERIAL_CBAUD | (SERIAL_CBAUD << SERIAL_IBSHIFT));
+    t2.c_cflag |= SERIAL_BOTHER | (SERIAL_BOTHER << SERIAL_IBSHIFT);
+    t2.c_ispeed = (speed_t)baud;
+    t2.c_ospeed = (speed_t)baud;
+    if (ioctl(fd, TCSETS2, &t2) < 0) return -1;
+    if (ioctl(fd, TCGETS2, &t2) < 0) return -1;
+    // Anything more than ~3% off will not autobaud reliably
+    long diff = (long)t2.c_ospeed - (long)baud;
+    if (t2.c_ospeed != 0 && (diff < 0 ? -diff : diff) * 100 > (long)baud * 3) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+#elif defined(__APPLE__)
+    // Must follow tcsetattr(), which would reset it
+    speed_t spd = (speed_t)baud;
+    return ioctl(fd, IOSSIOSPEED, &spd);
+#else
+    (void)fd;
+    (void)baud;
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+int serial_set_baud(int fd, int baud) {
+    if (baud <= 0) { errno = EINVAL; return -1; }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) return -1;
+
+    speed_t spd = baud_to_speed_t(baud);
+    int rc;
+    if (spd == 0) rc = set_custom_baud(fd, baud);
+    else if (cfsetispeed(&tio, spd) < 0 || cfsetospeed(&tio, spd) < 0) rc = -1;
+    else rc = tcsetattr(fd, TCSANOW, &tio);
+
+    struct rx_buf *rb = rx_get(fd);
+    if (rc == 0 && rb) rb->baud = baud;
+    return rc;
+}
+
+int serial_get_baud(int fd) {
+    struct rx_buf *rb = rx_get(fd);
+    return rb ? rb->baud : 0;
+}
+
+static void latency_apply(int fd, const char *dev_path, struct rx_buf *rb);
+static void latency_restore(int fd, struct rx_buf *rb);
+
+void serial_set_low_latency(int on, int timer_ms) {
+    latency_on = on;
+    latency_ms = timer_ms < 1 ? 1 : timer_ms > 255 ? 255 : timer_ms;
+}
+
 int serial_open_configure(const char *dev_path, int baud) {
     if (!dev_path) { errno = EINVAL; return -1; }
 
-    int fd = open(dev_path, O_RDWR | O_NOCTTY | O_SYNC);
+    // Nonblocking so sbl_op_* can drive the port from a poll() loop;
+    // serial_write_all() waits for POLLOUT itself. No O_SYNC: writes return
+    // once queued with the driver, see serial_set_drain().
+    int fd = open(dev_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (fd < 0) {
         perror("open");
         return -1;
@@ -75,68 +215,472 @@ int serial_open_configure(const char *dev_path, int baud) {
     tio.c_cc[VMIN]  = 0;  // return immediately if no data
     tio.c_cc[VTIME] = 0;  // no interbyte timer
 
-    // Baud rate
-    speed_t spd = baud_to_speed_t(baud);
-    if (spd == 0) {
-        fprintf(stderr, "Unsupported baud: %d\n", baud);
-        close(fd);
-        errno = EINVAL;
-        return -1;
-    }
-    if (cfsetispeed(&tio, spd) < 0 || cfsetospeed(&tio, spd) < 0) {
-        perror("cfset*speed");
+    // Apply raw mode immediately, then the rate (which may need termios2)
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        perror("tcsetattr");
         close(fd);
         return -1;
     }
-
-    // Apply immediately
-    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
-        perror("tcsetattr");
+    if (serial_set_baud(fd, baud) < 0) {
+        fprintf(stderr, "Unsupported baud: %d\n", baud);
         close(fd);
+        errno = EINVAL;
         return -1;
     }
 
     // Clear pending I/O
     tcflush(fd, TCIOFLUSH);
+
+    if (fd < SERIAL_MAX_FDS) {
+        if (rx_bufs[fd]) free(rx_bufs[fd]->timer_path);
+        free(rx_bufs[fd]);
+        rx_bufs[fd] = calloc(1, sizeof(struct rx_buf)); // NULL just means unbuffered
+        if (rx_bufs[fd]) rx_bufs[fd]->baud = baud;
+        // The profile is only applied where it can be undone again on close
+        if (rx_bufs[fd]) latency_apply(fd, dev_path, rx_bufs[fd]);
+    }
     return fd;
 }
 
+int serial_set_modem_lines(int fd, int dtr, int rts) {
+    int bits;
+    if (ioctl(fd, TIOCMGET, &bits) < 0) return -1;
+    if (dtr >= 0) bits = dtr ? (bits | TIOCM_DTR) : (bits & ~TIOCM_DTR);
+    if (rts >= 0) bits = rts ? (bits | TIOCM_RTS) : (bits & ~TIOCM_RTS);
+    return ioctl(fd, TIOCMSET, &bits);
+}
+
 void serial_close(int fd) {
-    if (fd >= 0) close(fd);
+    if (fd < 0) return;
+    if (fd < SERIAL_MAX_FDS && rx_bufs[fd]) {
+        latency_restore(fd, rx_bufs[fd]);
+        free(rx_bufs[fd]);
+        rx_bufs[fd] = NULL;
+    }
+    close(fd);
+}
+
+ssize_t serial_write_some(int fd, const uint8_t *buf, size_t len) {
+    for (;;) {
+        ssize_t n = write(fd, buf, len);
+        if (n >= 0) {
+            trace_buf(fd, "TX", buf, (size_t)n);
+            struct rx_buf *rb = rx_get(fd);
+            if (rb) rb->tx_bytes += (uint64_t)n;
+            return n;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        return -1;
+    }
 }
 
 int serial_write_byte(int fd, uint8_t b) {
-    ssize_t n = write(fd, &b, 1);
+    ssize_t n = serial_write_all(fd, &b, 1);
     if (n < 0) return -1;
-    // Ensure it's pushed out to the driver
-    if (tcdrain(fd) < 0) return -1;
     return (int)n;
 }
 
 ssize_t serial_write_all(int fd, const uint8_t *buf, size_t len) {
     size_t sent = 0;
     while (sent < len) {
-        ssize_t n = write(fd, buf + sent, len - sent);
+        ssize_t n = serial_write_some(fd, buf + sent, len - sent);
+        if (n < 0) return -1;
+        if (n == 0) {
+            // Output queue full: wait for room
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+            continue;
+        }
+        sent += (size_t)n;
+    }
+    if (serial_write_done(fd) < 0) return -1;
+    return (ssize_t)sent;
+}
+
+ssize_t serial_writev_all(int fd, const struct iovec *iov, int iovcnt) {
+    struct iovec v[8];
+    if (iovcnt < 0 || iovcnt > (int)(sizeof(v) / sizeof(v[0]))) { errno = EINVAL; return -1; }
+    memcpy(v, iov, (size_t)iovcnt * sizeof(v[0]));
+
+    size_t sent = 0;
+    struct iovec *cur = v;
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, cur, iovcnt);
         if (n < 0) {
             if (errno == EINTR) continue;
-            return -1;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+            continue;
         }
         sent += (size_t)n;
+        struct rx_buf *rb = rx_get(fd);
+        if (rb) rb->tx_bytes += (uint64_t)n;
+        if (trace_out) {
+            // One line per writev(), however many pieces went into it
+            uint8_t line[256 * 8];
+            size_t got = 0;
+            for (int i = 0; i < iovcnt && got < (size_t)n && got < sizeof(line); ++i) {
+                size_t k = cur[i].iov_len;
+                if (k > (size_t)n - got) k = (size_t)n - got;
+                if (k > sizeof(line) - got) k = sizeof(line) - got;
+                memcpy(line + got, cur[i].iov_base, k);
+                got += k;
+            }
+            trace_buf(fd, "TX", line, got);
+        }
+        // Skip what went out, including any empty entries
+        while (iovcnt > 0 && (size_t)n >= cur->iov_len) {
+            n -= (ssize_t)cur->iov_len;
+            ++cur;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            cur->iov_base = (uint8_t *)cur->iov_base + n;
+            cur->iov_len -= (size_t)n;
+        }
     }
-    // Block until transmitted
-    if (tcdrain(fd) < 0) return -1;
+    if (serial_write_done(fd) < 0) return -1;
     return (ssize_t)sent;
 }
 
+int serial_drain(int fd) {
+    while (tcdrain(fd) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+void serial_set_drain(int fd, int on) {
+    struct rx_buf *rb = rx_get(fd);
+    if (rb) rb->drain = on;
+}
+
+int serial_write_done(int fd) {
+    struct rx_buf *rb = rx_get(fd);
+    return (rb && rb->drain) ? serial_drain(fd) : 0;
+}
+
+// read() after a poll() that saw POLLIN: 0 bytes is EIO on a hung-up port
+static ssize_t read_ready(int fd, void *buf, size_t len, int hup) {
+    ssize_t n = read(fd, buf, len);
+    if (n == 0 && hup) {
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
 ssize_t serial_read_timeout(int fd, uint8_t *buf, size_t len, int timeout_ms) {
+    struct rx_buf *rb = rx_get(fd);
+    if (rb && rb->head < rb->tail) {
+        size_t n = rb->tail - rb->head;
+        if (n > len) n = len;
+        memcpy(buf, rb->data + rb->head, n);
+        rb->head += n;
+        return (ssize_t)n;
+    }
+
     struct pollfd pfd = { .fd = fd, .events = POLLIN };
     int pr = poll(&pfd, 1, timeout_ms);
     if (pr < 0) return -1;          // error
     if (pr == 0) return 0;          // timeout
+    int hup = (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
     if (pfd.revents & POLLIN) {
-        ssize_t n = read(fd, buf, len);
-        if (n < 0) return -1;
+        ssize_t n = read_ready(fd, buf, len, hup);
+        if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        trace_buf(fd, "RX", buf, (size_t)n);
+        if (rb) rb->rx_bytes += (uint64_t)n;
         return n;
     }
+    if (hup) {
+        errno = EIO; // hung up, nothing left to read
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t serial_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)(ts.tv_nsec / 1000000);
+}
+
+uint64_t serial_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)(ts.tv_nsec / 1000);
+}
+
+int serial_trace_open(const char *path) {
+    serial_trace_close();
+    FILE *f = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (!f) return -1;
+    trace_t0 = serial_now_us();
+    trace_out = f;
+    return 0;
+}
+
+void serial_trace_close(void) {
+    if (!trace_out) return;
+    if (trace_out != stderr) fclose(trace_out);
+    else fflush(trace_out);
+    trace_out = NULL;
+}
+
+void serial_get_counters(int fd, uint64_t *tx_bytes, uint64_t *rx_bytes) {
+    struct rx_buf *rb = rx_get(fd);
+    if (tx_bytes) *tx_bytes = rb ? rb->tx_bytes : 0;
+    if (rx_bytes) *rx_bytes = rb ? rb->rx_bytes : 0;
+}
+
+// Wait until input is readable or the deadline passes. Returns 1 / 0 / -1.
+// A port that hung up (USB adapter unplugged) is -1 with errno EIO once it has
+// nothing left to read; while it still has, *hup says that the next read() of 0
+// bytes is the hang-up rather than an empty VMIN=0 read.
+static int wait_readable(int fd, uint64_t deadline_ms, int *hup) {
+    for (;;) {
+        uint64_t now = serial_now_ms();
+        int wait_ms = now >= deadline_ms ? 0 : (int)(deadline_ms - now);
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, wait_ms);
+        if (pr < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (pr == 0) return 0;
+        *hup = (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+        if (*hup && !(pfd.revents & POLLIN)) {
+            errno = EIO;
+            return -1;
+        }
+        return 1;
+    }
+}
+
+// Pull whatever the kernel holds into rb (one read()). Returns bytes added, 0 on deadline, -1 on error.
+static ssize_t rx_fill(int fd, struct rx_buf *rb, uint64_t deadline_ms) {
+    if (rb->head == rb->tail) rb->head = rb->tail = 0;
+    for (;;) {
+        int hup = 0;
+        int r = wait_readable(fd, deadline_ms, &hup);
+        if (r <= 0) return r;
+        ssize_t n = read_ready(fd, rb->data + rb->tail, sizeof(rb->data) - rb->tail, hup);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        if (n == 0) {
+            // VMIN=0 read can come back empty; retry until the deadline
+            if (serial_now_ms() >= deadline_ms) return 0;
+            continue;
+        }
+        trace_buf(fd, "RX", rb->data + rb->tail, (size_t)n);
+        rb->tail += (size_t)n;
+        rb->rx_bytes += (uint64_t)n;
+        return n;
+    }
+}
+
+int serial_rx_exact(int fd, uint8_t *buf, size_t len, uint64_t deadline_ms) {
+    struct rx_buf *rb = rx_get(fd);
+    size_t got = 0;
+
+    while (got < len) {
+        if (!rb) {
+            int hup = 0;
+            int r = wait_readable(fd, deadline_ms, &hup);
+            if (r <= 0) return r;
+            ssize_t n = read_ready(fd, buf + got, len - got, hup);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return -1;
+            }
+            if (n == 0 && serial_now_ms() >= deadline_ms) return 0;
+            trace_buf(fd, "RX", buf + got, (size_t)n);
+            got += (size_t)n;
+            continue;
+        }
+
+        if (rb->head == rb->tail) {
+            ssize_t n = rx_fill(fd, rb, deadline_ms);
+            if (n <= 0) return (int)n;
+        }
+        size_t n = rb->tail - rb->head;
+        if (n > len - got) n = len - got;
+        memcpy(buf + got, rb->data + rb->head, n);
+        rb->head += n;
+        got += n;
+    }
+    return 1;
+}
+
+int serial_rx_byte(int fd, uint8_t *b, uint64_t deadline_ms) {
+    return serial_rx_exact(fd, b, 1, deadline_ms);
+}
+
+void serial_rx_flush(int fd) {
+    struct rx_buf *rb = rx_get(fd);
+    if (rb) rb->head = rb->tail = 0;
+    tcflush(fd, TCIFLUSH);
+}
+
+// Read the first line of a small sysfs attribute into buf (newline stripped).
+static int read_attr(const char *dir, const char *name, char *buf, size_t len) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char *ok = fgets(buf, (int)len, f);
+    fclose(f);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return buf[0] ? 0 : -1;
+}
+
+// Write text to a sysfs attribute in one write(), which is where the kernel
+// rejects a bad value. Only async-signal-safe calls, for serial_restore_all().
+static int write_attr(const char *path, const char *text) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    size_t len = strlen(text);
+    int ok = write(fd, text, len) == (ssize_t)len;
+    if (close(fd) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+// Low-latency profile (Linux). ASYNC_LOW_LATENCY makes the tty layer hand
+// received bytes to the reader at once rather than from deferred work; FTDI
+// adapters also hold received bytes for latency_timer ms (16 by default) before
+// sending a USB packet, which is what bounds every request/ACK round trip.
+static void latency_apply(int fd, const char *dev_path, struct rx_buf *rb) {
+    rb->timer_before = rb->timer_after = -1;
+    if (!latency_on) return;
+#if defined(__linux__)
+    struct serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) < 0) {
+        rb->low_latency = -1;
+    } else if (ss.flags & ASYNC_LOW_LATENCY) {
+        rb->low_latency = 2;
+    } else {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        rb->low_latency = ioctl(fd, TIOCSSERIAL, &ss) < 0 ? -1 : 1;
+    }
+
+    // Only ftdi_sio has a latency_timer attribute on the port's device
+    char node[PATH_MAX];
+    if (!realpath(dev_path, node)) return;
+    const char *name = strrchr(node, '/');
+    name = name ? name + 1 : node;
+    char dir[PATH_MAX + 32], val[16];
+    snprintf(dir, sizeof(dir), "/sys/class/tty/%s/device", name);
+    if (read_attr(dir, "latency_timer", val, sizeof(val)) != 0) return;
+    rb->timer_before = rb->timer_after = atoi(val);
+    if (rb->timer_before <= latency_ms) return;
+
+    char path[PATH_MAX + 64], text[8];
+    snprintf(path, sizeof(path), "%s/latency_timer", dir);
+    snprintf(text, sizeof(text), "%d\n", latency_ms);
+    snprintf(rb->timer_text, sizeof(rb->timer_text), "%d\n", rb->timer_before);
+    if (write_attr(path, text) != 0) {
+        rb->timer_err = errno; // usually EACCES: needs root or a udev rule
+        return;
+    }
+    rb->timer_after = latency_ms;
+    rb->timer_path = strdup(path);
+#else
+    (void)fd;
+    (void)dev_path;
+#endif
+}
+
+// Put back what latency_apply() changed; both settings outlive the open file
+// (and the process). Only async-signal-safe calls: serial_restore_all() runs
+// it from signal handlers. The caller frees timer_path.
+static void latency_undo(int fd, struct rx_buf *rb) {
+#if defined(__linux__)
+    if (rb->low_latency == 1) {
+        struct serial_struct ss;
+        if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+            ss.flags &= ~ASYNC_LOW_LATENCY;
+            ioctl(fd, TIOCSSERIAL, &ss);
+        }
+        rb->low_latency = 0;
+    }
+    if (rb->timer_path && rb->timer_after != rb->timer_before) {
+        write_attr(rb->timer_path, rb->timer_text);
+        rb->timer_after = rb->timer_before;
+    }
+#else
+    (void)fd;
+    (void)rb;
+#endif
+}
+
+static void latency_restore(int fd, struct rx_buf *rb) {
+    latency_undo(fd, rb);
+    free(rb->timer_path);
+    rb->timer_path = NULL;
+}
+
+void serial_restore_all(void) {
+    for (int fd = 0; fd < SERIAL_MAX_FDS; ++fd)
+        if (rx_bufs[fd]) latency_undo(fd, rx_bufs[fd]);
+}
+
+int serial_latency_describe(int fd, char *buf, size_t len) {
+    struct rx_buf *rb = rx_get(fd);
+    if (!buf || len == 0 || !rb) { errno = EINVAL; return -1; }
+    if (!latency_on) return snprintf(buf, len, "low-latency profile off");
+
+    static const char *const ll_text[] = { "refused", "not applied", "set", "already set" };
+    int n = snprintf(buf, len, "low_latency %s", ll_text[rb->low_latency + 1]);
+    if (n < 0 || (size_t)n >= len) return n;
+    if (rb->timer_before < 0)
+        return n + snprintf(buf + n, len - (size_t)n, ", no FTDI latency timer");
+    if (rb->timer_err)
+        return n + snprintf(buf + n, len - (size_t)n, ", FTDI latency_timer %d ms (cannot lower: %s)",
+                            rb->timer_before, strerror(rb->timer_err));
+    if (rb->timer_after != rb->timer_before)
+        return n + snprintf(buf + n, len - (size_t)n, ", FTDI latency_timer %d -> %d ms",
+                            rb->timer_before, rb->timer_after);
+    return n + snprintf(buf + n, len - (size_t)n, ", FTDI latency_timer %d ms", rb->timer_before);
+}
+
+int serial_adapter_id(const char *dev_path, char *buf, size_t len) {
+    if (!dev_path || !buf || len == 0) { errno = EINVAL; return -1; }
+
+    // Resolve /dev/serial/by-id/... style links to the real node
+    char node[PATH_MAX];
+    if (!realpath(dev_path, node)) {
+        strncpy(node, dev_path, sizeof(node) - 1);
+        node[sizeof(node) - 1] = '\0';
+    }
+
+#if defined(__linux__)
+    // Walk up from the tty's sysfs device to the USB device that owns a serial number
+    const char *name = strrchr(node, '/');
+    name = name ? name + 1 : node;
+    char link[PATH_MAX + 32], dir[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/class/tty/%s/device", name);
+    if (realpath(link, dir)) {
+        for (int depth = 0; depth < 6; ++depth) {
+            char serial[128], vid[16], pid[16];
+            if (read_attr(dir, "serial", serial, sizeof(serial)) == 0) {
+                if (read_attr(dir, "idVendor", vid, sizeof(vid)) != 0) strcpy(vid, "?");
+                if (read_attr(dir, "idProduct", pid, sizeof(pid)) != 0) strcpy(pid, "?");
+                snprintf(buf, len, "usb-%s:%s-%s", vid, pid, serial);
+                return 0;
+            }
+            char *slash = strrchr(dir, '/');
+            if (!slash || slash == dir) break;
+            *slash = '\0';
+        }
+    }
+#endif
+
+    // No serial number to be found: the device node is the best we have
+    snprintf(buf, len, "%s", node);
     return 0;
 }
@@ -4,6 +4,12 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+// Exported from the shared library (built with -fvisibility=hidden)
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
 
 #ifdef __cplusplus
 extern "C"
@@ -14,6 +20,39 @@ extern "C"
     // Returns file descriptor >= 0 on success, or -1 on error.
     int serial_open_configure(const char *dev_path, int baud);
 
+    // Low-latency profile for every port opened after the call (default off; set
+    // it before ports are in use from several threads). On Linux each
+    // serial_open_configure() then sets ASYNC_LOW_LATENCY and, on FTDI adapters,
+    // lowers the USB latency timer (16 ms by default, which bounds every
+    // request/ACK round trip) to timer_ms (1..255) through sysfs. serial_close()
+    // puts both back. Failures only show in serial_latency_describe().
+    // The latency timer belongs to the adapter, not the open file: a process that
+    // exits without serial_close() leaves it lowered until the adapter is replugged,
+    // so call serial_restore_all() from atexit() and fatal signal handlers.
+    void serial_set_low_latency(int on, int timer_ms);
+
+    // Undo the low-latency profile on every port still open; the ports stay open
+    // and usable. Async-signal-safe, apart from racing a concurrent open or close.
+    void serial_restore_all(void);
+
+    // What the profile applied to fd, e.g. "low_latency set, FTDI latency_timer
+    // 16 -> 1 ms". Returns what snprintf() does, -1 if fd is not tracked.
+    int serial_latency_describe(int fd, char *buf, size_t len);
+
+    // Change the rate of an open port. Standard rates use Bxxx constants; any
+    // other rate goes through termios2/BOTHER (Linux) or IOSSIOSPEED (macOS)
+    // and fails with EINVAL if the adapter can't get within 3% of it.
+    // Returns 0 on success, -1 on error.
+    int serial_set_baud(int fd, int baud);
+
+    // The rate fd was last set to, or 0 if it is not a port opened here.
+    int serial_get_baud(int fd);
+
+    // Assert (1) or release (0) DTR and RTS in one TIOCMSET; -1 leaves a line as is.
+    // On a typical USB-UART an asserted line drives its pin low.
+    // Returns 0 on success, -1 on error.
+    int serial_set_modem_lines(int fd, int dtr, int rts);
+
     // Close (safe)
     void serial_close(int fd);
 
@@ -21,13 +60,72 @@ extern "C"
     int serial_write_byte(int fd, uint8_t b);
 
     // Write a buffer (handles partial writes). Returns bytes written or -1 on error.
+    // Returns once the data is queued with the driver unless drain mode is on.
     ssize_t serial_write_all(int fd, const uint8_t *buf, size_t len);
 
-    // Optional: read with timeout (ms). Returns >0 bytes read, 0 on timeout, -1 on error.
+    // serial_write_all() over several buffers with one writev() per attempt, so a
+    // frame can be sent from a header and the caller's payload without copying.
+    // Returns bytes written or -1 on error.
+    ssize_t serial_writev_all(int fd, const struct iovec *iov, int iovcnt);
+
+    // Write as much as the driver takes right now. Returns bytes written (0 if the
+    // output queue is full) or -1 on error. Never drains.
+    ssize_t serial_write_some(int fd, const uint8_t *buf, size_t len);
+
+    // Block until everything written has left the UART (tcdrain). 0 / -1.
+    int serial_drain(int fd);
+
+    // Drain mode (default off): when on, every complete write waits for the UART
+    // to empty before returning, as the port did before writes went asynchronous.
+    void serial_set_drain(int fd, int on);
+
+    // Call after finishing a frame written with serial_write_some(): drains if
+    // drain mode is on, otherwise returns 0 immediately.
+    int serial_write_done(int fd);
+
+    // Optional: read with timeout (ms). Returns >0 bytes read, 0 on timeout, -1 on error
+    // (EIO after a hang-up, as for serial_rx_exact()).
+    // Bytes already held by the receive buffer below are returned first.
     ssize_t serial_read_timeout(int fd, uint8_t *buf, size_t len, int timeout_ms);
 
+    // Monotonic clock in milliseconds; deadlines below are absolute values of it.
+    uint64_t serial_now_ms(void);
+    // Same clock in microseconds, for timing individual commands.
+    uint64_t serial_now_us(void);
+
+    // Bytes written to / read from the port since it was opened (0 if untracked).
+    void serial_get_counters(int fd, uint64_t *tx_bytes, uint64_t *rx_bytes);
+
+    // Protocol trace: every buffer written to or read from any port is logged as
+    // "<us since open> <fd> TX|RX <len>: <hex bytes>". path "-" is stderr.
+    // Open before the ports are in use from several threads. 0 / -1.
+    int serial_trace_open(const char *path);
+    void serial_trace_close(void);
+
+    // Buffered receive: each refill takes whatever the kernel already holds in a
+    // single read() and later calls are served from a per-port buffer.
+    // A deadline of 0 never waits: only already-received bytes are returned.
+    // Read one byte. Returns 1 on success, 0 on deadline, -1 on error.
+    int serial_rx_byte(int fd, uint8_t *b, uint64_t deadline_ms);
+
+    // Read exactly len bytes. Returns 1 on success, 0 on deadline, -1 on error;
+    // a port that hung up (USB adapter unplugged) is -1 with errno EIO at once.
+    int serial_rx_exact(int fd, uint8_t *buf, size_t len, uint64_t deadline_ms);
+
+    // Drop buffered and kernel-queued input.
+    void serial_rx_flush(int fd);
+
+    // Stable identifier for the adapter behind dev_path: "usb-VID:PID-SERIAL" when
+    // a USB serial number can be found (Linux sysfs), else the resolved device path.
+    // Returns 0 on success, -1 on error.
+    int serial_adapter_id(const char *dev_path, char *buf, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
 
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
+
 #endif // SERIAL_H
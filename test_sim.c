@@ -0,0 +1,233 @@
+// make check: sbl_program_binary_ex() against the simulated ROM (sbl_sim.c) with
+// NACKed, dropped and wrongly programmed SEND_DATA frames injected, for each
+// transfer mode. A case passes when programming succeeds, the fault was really
+// met (a retry or a rewrite happened), a case without faults needed no retry,
+// and the sim's flash holds the image. What the library reports on stderr
+// along the way (every retry and resync) is only shown for a failing case.
+//
+//   test_sim [case ...]    (default: all of them)
+#define _POSIX_C_SOURCE 200809L
+#include "sbl.h"
+#include "sbl_sim.h"
+#include "serial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FLASH_SIZE 0x20000u
+#define PAGE_SIZE 0x1000u
+#define IMAGE_LEN 0x18000u // well short of CCFG, which is left alone
+
+typedef struct
+{
+    const char *name;
+    int nack_every;
+    int drop_every;
+    int corrupt_every;
+    uint32_t window;
+    uint32_t status_interval;
+    uint32_t sparse_gap;
+    uint32_t verify_group;
+    int delta; // program a copy differing on every 4th page first (faults and
+               // all), then the image with --delta
+    int wire_baud; // the sim's UART and flash timing as bench's, at this rate
+                   // (0 = none, so nothing can overrun its RX FIFO)
+} test_case_t;
+
+static const test_case_t cases[] = {
+    {"lockstep-nack", 23, 0, 0, 1, 1, 0, 0, 0, 0},
+    {"resume-drop", 0, 41, 0, 1, 1, 0, 0, 0, 0},
+    {"pipelined-paced", 0, 0, 0, 4, 16, 0, 0, 0, 921600},
+    {"pipelined-nack", 29, 0, 0, 4, 16, 0, 0, 0, 0},
+    {"pipelined-drop", 0, 37, 0, 4, 16, 0, 0, 0, 0},
+    {"sparse-nack", 19, 0, 0, 1, 1, 256, 0, 0, 0},
+    {"sparse-drop", 0, 31, 0, 4, 16, 256, 0, 0, 0},
+    {"delta-nack", 7, 0, 0, 1, 1, 0, 0, 1, 0},
+    {"delta-drop", 0, 11, 0, 4, 16, 0, 0, 1, 0},
+    {"grouped-corrupt", 0, 0, 97, 1, 1, 0, 4, 0, 0},
+};
+
+// Pseudo-random data with blank pages and 0xFF runs for sparse mode to skip
+static void make_image(uint8_t *img, size_t len)
+{
+    uint32_t x = 0x12345678u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        img[i] = (uint8_t)x;
+    }
+    for (size_t page = 3; page * PAGE_SIZE < len; page += 5)
+        memset(img + page * PAGE_SIZE, 0xFF, PAGE_SIZE);
+    for (size_t off = 0x800; off + 0x300 < len; off += 0x2000)
+        memset(img + off, 0xFF, 0x300);
+}
+
+static int run_case(const test_case_t *tc, const uint8_t *image)
+{
+    sbl_sim_config_t c;
+    sbl_sim_config_init(&c);
+    c.flash_size = FLASH_SIZE;
+    c.page_size = PAGE_SIZE;
+    c.nack_every = tc->nack_every;
+    c.drop_every = tc->drop_every;
+    c.corrupt_every = tc->corrupt_every;
+    if (tc->wire_baud)
+    {
+        c.wire_baud = tc->wire_baud;
+        c.ack_latency_us = 100;
+        c.erase_page_us = 10000;
+        c.program_ns_per_byte = 2000;
+        c.crc_ns_per_byte = 1000;
+    }
+    sbl_sim_t *sim = sbl_sim_start(&c);
+    if (!sim)
+    {
+        perror("sbl_sim_start");
+        return -1;
+    }
+
+    int rc = -1;
+    uint8_t *first = NULL;
+    int fd = serial_open_configure(sbl_sim_path(sim), tc->wire_baud ? tc->wire_baud : 115200);
+    if (fd < 0 || sbl_autobaud(fd, 500) != 0)
+    {
+        fprintf(stderr, "%s: no bootloader on %s\n", tc->name, sbl_sim_path(sim));
+        goto out;
+    }
+
+    sbl_program_stats_t stats;
+    sbl_program_opts_t opts;
+    sbl_program_opts_init(&opts);
+    opts.no_reset = 1;
+    opts.window = tc->window;
+    opts.status_interval = tc->status_interval;
+    opts.sparse_gap = tc->sparse_gap;
+    opts.verify_group = tc->verify_group;
+    opts.stats = &stats;
+    if (tc->delta)
+    {
+        if (!(first = (uint8_t *)malloc(IMAGE_LEN)))
+            goto out;
+        memcpy(first, image, IMAGE_LEN);
+        for (size_t off = 0; off < IMAGE_LEN; off += 4 * (size_t)PAGE_SIZE)
+            first[off + 0x10] ^= 0x5A;
+        if (sbl_program_binary_ex(fd, FLASH_SIZE, PAGE_SIZE, first, IMAGE_LEN, 0, &opts) != 0)
+        {
+            fprintf(stderr, "%s: first programming failed\n", tc->name);
+            goto out;
+        }
+        opts.delta = 1;
+    }
+
+    if (sbl_program_binary_ex(fd, FLASH_SIZE, PAGE_SIZE, image, IMAGE_LEN, 0, &opts) != 0)
+    {
+        fprintf(stderr, "%s: programming failed\n", tc->name);
+        goto out;
+    }
+    int faults = tc->nack_every || tc->drop_every;
+    if (faults && stats.retries == 0)
+    {
+        fprintf(stderr, "%s: no fault was met\n", tc->name);
+        goto out;
+    }
+    if (!faults && !tc->corrupt_every && stats.retries != 0)
+    {
+        fprintf(stderr, "%s: %u retries without a fault\n", tc->name, stats.retries);
+        goto out;
+    }
+    if (tc->delta && stats.pages_unchanged == 0)
+    {
+        fprintf(stderr, "%s: delta rewrote every page\n", tc->name);
+        goto out;
+    }
+    const uint8_t *flash = sbl_sim_flash(sim);
+    for (size_t i = 0; i < IMAGE_LEN; ++i)
+    {
+        if (flash[i] != image[i])
+        {
+            fprintf(stderr, "%s: flash differs at 0x%05zX: 0x%02X, image 0x%02X\n", tc->name, i, flash[i],
+                    image[i]);
+            goto out;
+        }
+    }
+    rc = 0;
+
+out:
+    free(first);
+    serial_close(fd);
+    sbl_sim_stop(sim);
+    return rc;
+}
+
+// Send stderr to a temp file until capture_end(); returns the saved stderr fd,
+// -1 if it could not be redirected (output then goes through as usual)
+static int capture_begin(FILE **log)
+{
+    fflush(stderr);
+    *log = tmpfile();
+    int saved = *log ? dup(STDERR_FILENO) : -1;
+    if (saved >= 0 && dup2(fileno(*log), STDERR_FILENO) < 0)
+    {
+        close(saved);
+        saved = -1;
+    }
+    return saved;
+}
+
+// Restore stderr and, if show, replay what was captured on it
+static void capture_end(FILE *log, int saved, int show)
+{
+    fflush(stderr);
+    if (saved >= 0)
+    {
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+        if (show)
+        {
+            char buf[4096];
+            size_t n;
+            rewind(log);
+            while ((n = fread(buf, 1, sizeof(buf), log)) > 0)
+                fwrite(buf, 1, n, stderr);
+        }
+    }
+    if (log)
+        fclose(log);
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *image = (uint8_t *)malloc(IMAGE_LEN);
+    if (!image)
+        return 1;
+    make_image(image, IMAGE_LEN);
+
+    int failures = 0, run = 0;
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k)
+    {
+        int wanted = argc < 2;
+        for (int i = 1; i < argc && !wanted; ++i)
+            wanted = strcmp(argv[i], cases[k].name) == 0;
+        if (!wanted)
+            continue;
+        FILE *log;
+        int saved = capture_begin(&log);
+        int rc = run_case(&cases[k], image);
+        capture_end(log, saved, rc != 0);
+        printf("%-20s %s\n", cases[k].name, rc == 0 ? "ok" : "FAIL");
+        fflush(stdout);
+        failures += rc != 0;
+        ++run;
+    }
+    free(image);
+    if (run == 0)
+    {
+        fprintf(stderr, "no such case\n");
+        return 1;
+    }
+    return failures ? 1 : 0;
+}